@@ -70,9 +70,15 @@
 
 #define KVM_MSI_HASHTAB_SIZE    256
 
+/* Only architectures that define it support the dirty ring */
+#ifndef KVM_DIRTY_LOG_PAGE_OFFSET
+#define KVM_DIRTY_LOG_PAGE_OFFSET 0
+#endif
+
 struct KVMParkedVcpu {
     unsigned long vcpu_id;
     int kvm_fd;
+    uint32_t kvm_fetch_index;
     QLIST_ENTRY(KVMParkedVcpu) node;
 };
 
@@ -97,11 +103,16 @@ struct KVMState
     int many_ioeventfds;
     int intx_set_mask;
     int kvm_shadow_mem;
+    int dirty_sync_threads;
     bool kernel_irqchip_allowed;
     bool kernel_irqchip_required;
     OnOffAuto kernel_irqchip_split;
     bool sync_mmu;
     bool manual_dirty_log_protect;
+    /* Dirty ring entries per vCPU, or 0 to use the dirty log bitmaps */
+    uint32_t dirty_ring_size;
+    uint64_t dirty_ring_bytes;
+    QemuThread dirty_ring_reaper;
     /* The man page (and posix) say ioctl numbers are signed int, but
      * they're not.  Linux, glibc and *BSD all treat ioctl numbers as
      * unsigned, and treating them as signed here can break things */
@@ -157,6 +168,8 @@ static const KVMCapabilityInfo kvm_required_capabilites[] = {
     KVM_CAP_LAST_INFO
 };
 
+static uint64_t kvm_dirty_ring_reap(KVMState *s);
+
 static NotifierList kvm_irqchip_change_notifiers =
     NOTIFIER_LIST_INITIALIZER(kvm_irqchip_change_notifiers);
 
@@ -405,15 +418,27 @@ int kvm_destroy_vcpu(CPUState *cpu)
         goto err;
     }
 
+    if (cpu->kvm_dirty_gfns) {
+        /* Do not lose the pages that this vCPU dirtied last */
+        kvm_dirty_ring_reap(s);
+        ret = munmap(cpu->kvm_dirty_gfns, s->dirty_ring_bytes);
+        if (ret < 0) {
+            goto err;
+        }
+        cpu->kvm_dirty_gfns = NULL;
+    }
+
     vcpu = g_malloc0(sizeof(*vcpu));
     vcpu->vcpu_id = kvm_arch_vcpu_id(cpu);
     vcpu->kvm_fd = cpu->kvm_fd;
+    vcpu->kvm_fetch_index = cpu->kvm_fetch_index;
     QLIST_INSERT_HEAD(&kvm_state->kvm_parked_vcpus, vcpu, node);
 err:
     return ret;
 }
 
-static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id)
+static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id,
+                        uint32_t *fetch_index)
 {
     struct KVMParkedVcpu *cpu;
 
@@ -423,11 +448,14 @@ static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id)
 
             QLIST_REMOVE(cpu, node);
             kvm_fd = cpu->kvm_fd;
+            /* The kernel keeps its position in the dirty ring */
+            *fetch_index = cpu->kvm_fetch_index;
             g_free(cpu);
             return kvm_fd;
         }
     }
 
+    *fetch_index = 0;
     return kvm_vm_ioctl(s, KVM_CREATE_VCPU, (void *)vcpu_id);
 }
 
@@ -439,7 +467,7 @@ int kvm_init_vcpu(CPUState *cpu)
 
     DPRINTF("kvm_init_vcpu\n");
 
-    ret = kvm_get_vcpu(s, kvm_arch_vcpu_id(cpu));
+    ret = kvm_get_vcpu(s, kvm_arch_vcpu_id(cpu), &cpu->kvm_fetch_index);
     if (ret < 0) {
         DPRINTF("kvm_create_vcpu failed\n");
         goto err;
@@ -469,6 +497,20 @@ int kvm_init_vcpu(CPUState *cpu)
             (void *)cpu->kvm_run + s->coalesced_mmio * PAGE_SIZE;
     }
 
+    if (s->dirty_ring_size) {
+        /* Use MAP_SHARED to share pages with the kernel */
+        cpu->kvm_dirty_gfns = mmap(NULL, s->dirty_ring_bytes,
+                                   PROT_READ | PROT_WRITE, MAP_SHARED,
+                                   cpu->kvm_fd,
+                                   PAGE_SIZE * KVM_DIRTY_LOG_PAGE_OFFSET);
+        if (cpu->kvm_dirty_gfns == MAP_FAILED) {
+            cpu->kvm_dirty_gfns = NULL;
+            ret = -errno;
+            DPRINTF("mmap'ing vcpu dirty ring failed\n");
+            goto err;
+        }
+    }
+
     ret = kvm_arch_init_vcpu(cpu);
 err:
     return ret;
@@ -572,15 +614,103 @@ static void kvm_log_stop(MemoryListener *listener,
     }
 }
 
+/* Slots smaller than this are merged by a single thread */
+#define KVM_DIRTY_SYNC_THREAD_PAGES  (1ULL << 20)
+
+typedef struct KVMDirtySyncJob {
+    QemuThread thread;
+    RAMBlock *rb;
+    const unsigned long *bitmap;
+    ram_addr_t offset;
+    ram_addr_t pages;
+    uint64_t new_dirty;
+    uint64_t real_dirty;
+} KVMDirtySyncJob;
+
+static void kvm_dirty_sync_job_run(KVMDirtySyncJob *job)
+{
+    job->new_dirty =
+        cpu_physical_memory_merge_dirty_lebitmap(job->rb, job->bitmap,
+                                                 job->offset, job->pages,
+                                                 &job->real_dirty);
+}
+
+static void *kvm_dirty_sync_thread(void *opaque)
+{
+    rcu_register_thread();
+    kvm_dirty_sync_job_run(opaque);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/*
+ * Merge the dirty log of a slot straight into the migration bitmap of
+ * its RAMBlock, splitting large slots across dirty-sync-threads threads.
+ */
+static void kvm_merge_dirty_pages(RAMBlock *rb, unsigned long *bitmap,
+                                  ram_addr_t offset, ram_addr_t pages)
+{
+    KVMState *s = kvm_state;
+    g_autofree KVMDirtySyncJob *jobs = NULL;
+    ram_addr_t chunk, first;
+    int nr_jobs, i;
+
+    nr_jobs = MIN(s->dirty_sync_threads,
+                  DIV_ROUND_UP(pages, KVM_DIRTY_SYNC_THREAD_PAGES));
+    nr_jobs = MAX(nr_jobs, 1);
+    jobs = g_new0(KVMDirtySyncJob, nr_jobs);
+
+    /* Keep every chunk aligned to a 64-bit word of the KVM bitmap */
+    chunk = ROUND_UP(DIV_ROUND_UP(pages, nr_jobs), 64);
+    for (i = 0; i < nr_jobs; i++) {
+        first = MIN(i * chunk, pages);
+        jobs[i].rb = rb;
+        jobs[i].bitmap = bitmap + BIT_WORD(first);
+        jobs[i].offset = offset + (first << TARGET_PAGE_BITS);
+        jobs[i].pages = MIN(chunk, pages - first);
+        if (i > 0) {
+            qemu_thread_create(&jobs[i].thread, "kvm-dirty-sync",
+                               kvm_dirty_sync_thread, &jobs[i],
+                               QEMU_THREAD_JOINABLE);
+        }
+    }
+
+    kvm_dirty_sync_job_run(&jobs[0]);
+    for (i = 1; i < nr_jobs; i++) {
+        qemu_thread_join(&jobs[i].thread);
+    }
+
+    for (i = 0; i < nr_jobs; i++) {
+        rb->merged_new_dirty_pages += jobs[i].new_dirty;
+        rb->merged_dirty_pages += jobs[i].real_dirty;
+    }
+    trace_kvm_merge_dirty_pages(rb->idstr, offset, pages, nr_jobs);
+}
+
+/* update qemu's dirty bitmaps for @pages pages at byte @offset of @rb */
+static void kvm_set_dirty_pages(RAMBlock *rb, ram_addr_t offset,
+                                unsigned long *bitmap, ram_addr_t pages)
+{
+    /*
+     * During a migration bitmap sync, skip the global dirty bitmaps and
+     * fill the migration bitmap in the same pass.
+     */
+    if (cpu_physical_memory_can_merge_dirty_lebitmap(rb, offset, pages)) {
+        kvm_merge_dirty_pages(rb, bitmap, offset, pages);
+        return;
+    }
+
+    cpu_physical_memory_set_dirty_lebitmap(bitmap, rb->offset + offset, pages);
+}
+
 /* get kvm's dirty pages bitmap and update qemu's */
 static int kvm_get_dirty_pages_log_range(MemoryRegionSection *section,
                                          unsigned long *bitmap)
 {
-    ram_addr_t start = section->offset_within_region +
-                       memory_region_get_ram_addr(section->mr);
     ram_addr_t pages = int128_get64(section->size) / qemu_real_host_page_size;
 
-    cpu_physical_memory_set_dirty_lebitmap(bitmap, start, pages);
+    kvm_set_dirty_pages(section->mr->ram_block, section->offset_within_region,
+                        bitmap, pages);
     return 0;
 }
 
@@ -607,6 +737,189 @@ static void kvm_memslot_init_dirty_bitmap(KVMSlot *mem)
     mem->dirty_bmap = g_malloc0(bitmap_size);
 }
 
+/*
+ * Dirty ring support
+ *
+ * With KVM_CAP_DIRTY_LOG_RING, each vCPU pushes the pages it dirties
+ * into a ring shared with QEMU instead of the kernel keeping a bitmap
+ * per slot.  Harvested pages are accumulated into KVMSlot.dirty_bmap,
+ * which is then consumed by log_sync_global just like the bitmap that
+ * KVM_GET_DIRTY_LOG returns.  Rings are harvested by a reaper thread,
+ * by vCPUs whose ring is full, and before every sync.
+ *
+ * Harvesting and the slot updates that consume dirty_bmap are all
+ * serialized by the BQL.
+ */
+
+static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
+                                     uint32_t slot_id, uint64_t offset)
+{
+    KVMMemoryListener *kml = NULL;
+    KVMSlot *mem;
+    int i;
+
+    for (i = 0; i < s->nr_as; i++) {
+        if (s->as[i].ml && s->as[i].ml->as_id == as_id) {
+            kml = s->as[i].ml;
+            break;
+        }
+    }
+    if (!kml || slot_id >= s->nr_slots) {
+        return;
+    }
+
+    mem = &kml->slots[slot_id];
+    if (!mem->memory_size ||
+        offset >= (mem->memory_size / qemu_real_host_page_size)) {
+        /* The slot went away after the page was pushed */
+        return;
+    }
+
+    if (!mem->dirty_bmap) {
+        kvm_memslot_init_dirty_bitmap(mem);
+    }
+    set_bit(offset, mem->dirty_bmap);
+}
+
+static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
+{
+    return atomic_load_acquire(&gfn->flags) == KVM_DIRTY_GFN_F_DIRTY;
+}
+
+static void dirty_gfn_set_collected(struct kvm_dirty_gfn *gfn)
+{
+    atomic_store_release(&gfn->flags, KVM_DIRTY_GFN_F_RESET);
+}
+
+static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
+{
+    struct kvm_dirty_gfn *cur;
+    uint32_t fetch = cpu->kvm_fetch_index;
+    uint32_t count = 0;
+
+    for (;;) {
+        cur = &cpu->kvm_dirty_gfns[fetch % s->dirty_ring_size];
+        if (!dirty_gfn_is_dirtied(cur)) {
+            break;
+        }
+        kvm_dirty_ring_mark_page(s, cur->slot >> 16, cur->slot & 0xffff,
+                                 cur->offset);
+        dirty_gfn_set_collected(cur);
+        fetch++;
+        count++;
+    }
+    cpu->kvm_fetch_index = fetch;
+
+    return count;
+}
+
+/*
+ * Harvest the dirty rings of all vCPUs into the slot bitmaps and let
+ * KVM recycle the entries.  Must be called with the BQL held.
+ */
+static uint64_t kvm_dirty_ring_reap(KVMState *s)
+{
+    CPUState *cpu;
+    uint64_t total = 0;
+    int ret;
+
+    assert(qemu_mutex_iothread_locked());
+
+    CPU_FOREACH(cpu) {
+        if (cpu->kvm_dirty_gfns) {
+            total += kvm_dirty_ring_reap_one(s, cpu);
+        }
+    }
+
+    if (total) {
+        ret = kvm_vm_ioctl(s, KVM_RESET_DIRTY_RINGS);
+        assert(ret == total);
+    }
+
+    trace_kvm_dirty_ring_reap(total);
+    return total;
+}
+
+static void do_kvm_cpu_synchronize_kick(CPUState *cpu, run_on_cpu_data arg)
+{
+    /* No need to do anything, leaving guest mode is enough */
+}
+
+/*
+ * Make sure that all pages dirtied so far are in the slot bitmaps.
+ * Hardware may buffer dirty pages (e.g. Intel PML) until the vCPU leaves
+ * guest mode, so kick every vCPU out synchronously before harvesting.
+ */
+static void kvm_dirty_ring_flush(KVMState *s)
+{
+    CPUState *cpu;
+
+    assert(qemu_mutex_iothread_locked());
+
+    CPU_FOREACH(cpu) {
+        run_on_cpu(cpu, do_kvm_cpu_synchronize_kick, RUN_ON_CPU_NULL);
+    }
+    kvm_dirty_ring_reap(s);
+}
+
+static void *kvm_dirty_ring_reaper_thread(void *opaque)
+{
+    KVMState *s = opaque;
+
+    rcu_register_thread();
+
+    for (;;) {
+        /*
+         * Harvest once a second so that vCPUs rarely fill their ring;
+         * a vCPU with a full ring harvests on its own.
+         */
+        g_usleep(G_USEC_PER_SEC);
+
+        qemu_mutex_lock_iothread();
+        kvm_dirty_ring_reap(s);
+        qemu_mutex_unlock_iothread();
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/* Called with the BQL and kml->slots_lock held */
+static void kvm_slot_sync_dirty_pages(KVMSlot *mem)
+{
+    ram_addr_t pages = mem->memory_size / qemu_real_host_page_size;
+    ram_addr_t offset;
+    RAMBlock *rb;
+
+    if (!mem->dirty_bmap) {
+        return;
+    }
+
+    rb = qemu_ram_block_from_host(mem->ram, false, &offset);
+    assert(rb);
+    kvm_set_dirty_pages(rb, offset, mem->dirty_bmap, pages);
+    bitmap_zero(mem->dirty_bmap, mem->memory_size >> TARGET_PAGE_BITS);
+}
+
+static void kvm_log_sync_global(MemoryListener *listener)
+{
+    KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
+    KVMState *s = kvm_state;
+    KVMSlot *mem;
+    int i;
+
+    kvm_dirty_ring_flush(s);
+
+    kvm_slots_lock(kml);
+    for (i = 0; i < s->nr_slots; i++) {
+        mem = &kml->slots[i];
+        if (mem->memory_size && (mem->flags & KVM_MEM_LOG_DIRTY_PAGES)) {
+            kvm_slot_sync_dirty_pages(mem);
+        }
+    }
+    kvm_slots_unlock(kml);
+}
+
 /**
  * kvm_physical_sync_dirty_bitmap - Sync dirty bitmap from kernel space
  *
@@ -1146,7 +1459,12 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
                 goto out;
             }
             if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
-                kvm_physical_sync_dirty_bitmap(kml, section);
+                if (kvm_state->dirty_ring_size) {
+                    kvm_dirty_ring_reap(kvm_state);
+                    kvm_slot_sync_dirty_pages(mem);
+                } else {
+                    kvm_physical_sync_dirty_bitmap(kml, section);
+                }
             }
 
             /* unregister the slot */
@@ -1335,8 +1653,12 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
     kml->listener.region_del = kvm_region_del;
     kml->listener.log_start = kvm_log_start;
     kml->listener.log_stop = kvm_log_stop;
-    kml->listener.log_sync = kvm_log_sync;
-    kml->listener.log_clear = kvm_log_clear;
+    if (s->dirty_ring_size) {
+        kml->listener.log_sync_global = kvm_log_sync_global;
+    } else {
+        kml->listener.log_sync = kvm_log_sync;
+        kml->listener.log_clear = kvm_log_clear;
+    }
     kml->listener.priority = 10;
 
     memory_listener_register(&kml->listener, as);
@@ -2120,7 +2442,39 @@ static int kvm_init(MachineState *ms)
     s->coalesced_pio = s->coalesced_mmio &&
                        kvm_check_extension(s, KVM_CAP_COALESCED_PIO);
 
-    s->manual_dirty_log_protect =
+    /*
+     * Enable the dirty ring if requested and supported, otherwise fall
+     * back to the dirty log bitmaps.
+     */
+    if (s->dirty_ring_size) {
+        uint64_t ring_bytes = s->dirty_ring_size * sizeof(struct kvm_dirty_gfn);
+
+        /* Returns the maximum ring size in bytes */
+        ret = kvm_vm_check_extension(s, KVM_CAP_DIRTY_LOG_RING);
+        if (ret <= 0 || !KVM_DIRTY_LOG_PAGE_OFFSET) {
+            warn_report("KVM dirty ring not available, "
+                        "using the dirty log bitmaps");
+            s->dirty_ring_size = 0;
+        } else if (ring_bytes > ret) {
+            error_report("KVM dirty ring size %" PRIu32 " too big "
+                         "(maximum is %zu)", s->dirty_ring_size,
+                         ret / sizeof(struct kvm_dirty_gfn));
+            ret = -EINVAL;
+            goto err;
+        } else {
+            ret = kvm_vm_enable_cap(s, KVM_CAP_DIRTY_LOG_RING, 0, ring_bytes);
+            if (ret) {
+                warn_report("Enabling the KVM dirty ring failed: %s, "
+                            "using the dirty log bitmaps", strerror(-ret));
+                s->dirty_ring_size = 0;
+            } else {
+                s->dirty_ring_bytes = ring_bytes;
+            }
+        }
+    }
+
+    /* The dirty ring has no use for KVM_CLEAR_DIRTY_LOG */
+    s->manual_dirty_log_protect = !s->dirty_ring_size &&
         kvm_check_extension(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2);
     if (s->manual_dirty_log_protect) {
         ret = kvm_vm_enable_cap(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2, 0, 1);
@@ -2225,6 +2579,12 @@ static int kvm_init(MachineState *ms)
         qemu_balloon_inhibit(true);
     }
 
+    if (s->dirty_ring_size) {
+        qemu_thread_create(&s->dirty_ring_reaper, "kvm-reaper",
+                           kvm_dirty_ring_reaper_thread, s,
+                           QEMU_THREAD_DETACHED);
+    }
+
     return 0;
 
 err:
@@ -2532,6 +2892,17 @@ int kvm_cpu_exec(CPUState *cpu)
         case KVM_EXIT_INTERNAL_ERROR:
             ret = kvm_handle_internal_error(cpu, run);
             break;
+        case KVM_EXIT_DIRTY_RING_FULL:
+            /*
+             * The vCPU cannot run until its ring has room again, which
+             * KVM_RESET_DIRTY_RINGS provides.
+             */
+            trace_kvm_dirty_ring_full(cpu->cpu_index);
+            qemu_mutex_lock_iothread();
+            kvm_dirty_ring_reap(kvm_state);
+            qemu_mutex_unlock_iothread();
+            ret = 0;
+            break;
         case KVM_EXIT_SYSTEM_EVENT:
             switch (run->system_event.type) {
             case KVM_SYSTEM_EVENT_SHUTDOWN:
@@ -3118,6 +3489,68 @@ static void kvm_set_kvm_shadow_mem(Object *obj, Visitor *v,
     s->kvm_shadow_mem = value;
 }
 
+static void kvm_get_dirty_sync_threads(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    int64_t value = s->dirty_sync_threads;
+
+    visit_type_int(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_sync_threads(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    Error *error = NULL;
+    int64_t value;
+
+    visit_type_int(v, name, &value, &error);
+    if (error) {
+        error_propagate(errp, error);
+        return;
+    }
+    if (value < 1 || value > 64) {
+        error_setg(errp, "dirty-sync-threads must be between 1 and 64");
+        return;
+    }
+
+    s->dirty_sync_threads = value;
+}
+
+static void kvm_get_dirty_ring_size(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->dirty_ring_size;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    Error *error = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, name, &value, &error);
+    if (error) {
+        error_propagate(errp, error);
+        return;
+    }
+    if (value & (value - 1)) {
+        error_setg(errp, "dirty-ring-size must be a power of two");
+        return;
+    }
+
+    s->dirty_ring_size = value;
+}
+
 static void kvm_set_kernel_irqchip(Object *obj, Visitor *v,
                                    const char *name, void *opaque,
                                    Error **errp)
@@ -3176,6 +3609,7 @@ static void kvm_accel_instance_init(Object *obj)
     KVMState *s = KVM_STATE(obj);
 
     s->kvm_shadow_mem = -1;
+    s->dirty_sync_threads = 1;
     s->kernel_irqchip_allowed = true;
     s->kernel_irqchip_split = ON_OFF_AUTO_AUTO;
 }
@@ -3199,6 +3633,18 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
         NULL, NULL);
     object_class_property_set_description(oc, "kvm-shadow-mem",
         "KVM shadow MMU size");
+
+    object_class_property_add(oc, "dirty-ring-size", "uint32",
+        kvm_get_dirty_ring_size, kvm_set_dirty_ring_size,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-size",
+        "Size of the KVM dirty ring of each vCPU, 0 to use dirty bitmaps");
+
+    object_class_property_add(oc, "dirty-sync-threads", "int",
+        kvm_get_dirty_sync_threads, kvm_set_dirty_sync_threads,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-sync-threads",
+        "Threads used to merge the dirty log of large slots during migration");
 }
 
 static const TypeInfo kvm_accel_type = {
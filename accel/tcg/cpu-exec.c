@@ -23,6 +23,7 @@
 #include "trace.h"
 #include "disas/disas.h"
 #include "exec/exec-all.h"
+#include "exec/tb-async.h"
 #include "tcg/tcg.h"
 #include "qemu/atomic.h"
 #include "sysemu/qtest.h"
@@ -320,10 +321,73 @@ static bool tb_lookup_cmp(const void *p, const void *d)
     return false;
 }
 
+static TranslationBlock *tb_l2_cache_lookup(CPUState *cpu,
+                                            const struct tb_desc *desc,
+                                            uint32_t h)
+{
+    TBL2Cache *c = &cpu->tb_l2_cache;
+    TranslationBlock **set = c->tb[h & (TB_L2_CACHE_SETS - 1)];
+    TranslationBlock *tb;
+    int i;
+
+    atomic_set(&c->lookups, c->lookups + 1);
+    for (i = 0; i < TB_L2_CACHE_WAYS; i++) {
+        tb = set[i];
+        if (tb && tb_lookup_cmp(tb, desc)) {
+            memmove(&set[1], &set[0], i * sizeof(*set));
+            set[0] = tb;
+            atomic_set(&c->hits, c->hits + 1);
+            return tb;
+        }
+    }
+    return NULL;
+}
+
+void tb_l2_cache_evict(CPUState *cpu, TranslationBlock *tb)
+{
+    TranslationBlock **set;
+    tb_page_addr_t phys_pc;
+    uint32_t cflags, h;
+    int i;
+
+    if (!tb) {
+        return;
+    }
+    cflags = tb_cflags(tb);
+    if (cflags & CF_INVALID) {
+        return;
+    }
+
+    phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
+    h = tb_hash_func(phys_pc, tb->pc, tb->flags, cflags & CF_HASH_MASK,
+                     tb->trace_vcpu_dstate);
+    set = cpu->tb_l2_cache.tb[h & (TB_L2_CACHE_SETS - 1)];
+
+    /* Move @tb to the front, or drop the least recently used entry.  */
+    for (i = 0; i < TB_L2_CACHE_WAYS - 1; i++) {
+        if (set[i] == tb) {
+            break;
+        }
+    }
+    memmove(&set[1], &set[0], i * sizeof(*set));
+    set[0] = tb;
+}
+
+void tb_jmp_cache_evict(CPUState *cpu)
+{
+    unsigned int i;
+
+    for (i = 0; i < TB_JMP_CACHE_SIZE; i++) {
+        tb_l2_cache_evict(cpu, atomic_read(&cpu->tb_jmp_cache[i]));
+        atomic_set(&cpu->tb_jmp_cache[i], NULL);
+    }
+}
+
 TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
                                    target_ulong cs_base, uint32_t flags,
                                    uint32_t cf_mask)
 {
+    TranslationBlock *tb;
     tb_page_addr_t phys_pc;
     struct tb_desc desc;
     uint32_t h;
@@ -340,6 +404,10 @@ TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
     }
     desc.phys_page1 = phys_pc & TARGET_PAGE_MASK;
     h = tb_hash_func(phys_pc, pc, flags, cf_mask, *cpu->trace_dstate);
+    tb = tb_l2_cache_lookup(cpu, &desc, h);
+    if (tb) {
+        return tb;
+    }
     return qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
 }
 
@@ -408,6 +476,20 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
         mmap_unlock();
         /* We add the TB in the virtual pc hash table for the fast lookup */
         atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
+    } else if (atomic_read(&tb->hot_count) < 0 &&
+               !tb_async_promote(cpu, tb)) {
+        /*
+         * The TB has run superblock_threshold times and no translator
+         * thread took it; replace it with a superblock.  If another
+         * vCPU got here first, tb_gen_code() returns its superblock
+         * instead.
+         */
+        mmap_lock();
+        tb_phys_invalidate(tb, -1);
+        tb = tb_gen_code(cpu, pc, cs_base, flags, cf_mask | CF_SUPERBLOCK);
+        mmap_unlock();
+        atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
+        last_tb = NULL;
     }
 #ifndef CONFIG_USER_ONLY
     /* We don't take care of direct jumps when address mapping changes in
@@ -637,8 +719,12 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
         return;
     }
 
+    if (!use_icount) {
+        /* The TB became hot, tb_find() will retranslate it.  */
+        return;
+    }
+
     /* Instruction counter expired.  */
-    assert(use_icount);
 #ifndef CONFIG_USER_ONLY
     /* Ensure global icount has gone forward */
     cpu_update_icount(cpu);
@@ -25,6 +25,7 @@
 #include "exec/address-spaces.h"
 #include "exec/cpu_ldst.h"
 #include "exec/cputlb.h"
+#include "exec/tb-hash.h"
 #include "exec/memory-internal.h"
 #include "exec/ram_addr.h"
 #include "tcg/tcg.h"
@@ -346,7 +347,7 @@ static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 
-    cpu_tb_jmp_cache_clear(cpu);
+    tb_jmp_cache_evict(cpu);
 
     if (to_clean == ALL_MMUIDX_BITS) {
         atomic_set(&env_tlb(env)->c.full_flush_count,
@@ -666,6 +667,214 @@ void tlb_flush_page_all_cpus_synced(CPUState *src, target_ulong addr)
     tlb_flush_page_by_mmuidx_all_cpus_synced(src, addr, ALL_MMUIDX_BITS);
 }
 
+/* Called with tlb_c.lock held */
+static void tlb_flush_range_locked(CPUArchState *env, int midx,
+                                   target_ulong addr, target_ulong len)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    CPUTLBDescFast *f = &env_tlb(env)->f[midx];
+    target_ulong last = addr + len - 1;
+    target_ulong i;
+
+    /*
+     * If the range covers more pages than the TLB has entries, then
+     * it is cheaper to drop the whole TLB than to probe every page.
+     */
+    if ((len >> TARGET_PAGE_BITS) > tlb_n_entries(f)) {
+        tlb_debug("forcing full flush midx %d ("
+                  TARGET_FMT_lx "+" TARGET_FMT_lx ")\n",
+                  midx, addr, len);
+        tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
+        return;
+    }
+
+    /* Check if we need to flush due to large pages.  */
+    if (addr <= (d->large_page_addr | ~d->large_page_mask) &&
+        d->large_page_addr <= last) {
+        tlb_debug("forcing full flush midx %d ("
+                  TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
+                  midx, d->large_page_addr, d->large_page_mask);
+        tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
+        return;
+    }
+
+    for (i = 0; i < len; i += TARGET_PAGE_SIZE) {
+        target_ulong page = addr + i;
+
+        if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
+            tlb_n_used_entries_dec(env, midx);
+        }
+        tlb_flush_vtlb_page_locked(env, midx, page);
+    }
+}
+
+typedef struct {
+    target_ulong addr;
+    target_ulong len;
+    uint16_t idxmap;
+} TLBFlushRangeData;
+
+/**
+ * tlb_flush_range_by_mmuidx_async_0:
+ * @cpu: cpu on which to flush
+ * @d: page-aligned range and set of mmu_idx to flush
+ *
+ * Helper for tlb_flush_range_by_mmuidx and friends, flush the pages
+ * in [@d.addr, @d.addr + @d.len) from the tlbs indicated by @d.idxmap
+ * from @cpu.
+ */
+static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
+                                              TLBFlushRangeData d)
+{
+    CPUArchState *env = cpu->env_ptr;
+    target_ulong i;
+    int mmu_idx;
+
+    assert_cpu_is_self(cpu);
+
+    tlb_debug("range:" TARGET_FMT_lx "/" TARGET_FMT_lx " mmu_map:0x%x\n",
+              d.addr, d.len, d.idxmap);
+
+    qemu_spin_lock(&env_tlb(env)->c.lock);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        if ((d.idxmap >> mmu_idx) & 1) {
+            tlb_flush_range_locked(env, mmu_idx, d.addr, d.len);
+        }
+    }
+    qemu_spin_unlock(&env_tlb(env)->c.lock);
+
+    /*
+     * Each call to tb_flush_jmp_cache clears two pages worth of the
+     * jump cache; past a certain range length, clearing it all is
+     * cheaper than clearing it piecemeal.
+     */
+    if ((d.len >> TARGET_PAGE_BITS) >= TB_JMP_CACHE_SIZE / TB_JMP_PAGE_SIZE) {
+        tb_jmp_cache_evict(cpu);
+        return;
+    }
+
+    for (i = 0; i < d.len; i += TARGET_PAGE_SIZE) {
+        tb_flush_jmp_cache(cpu, d.addr + i);
+    }
+}
+
+/**
+ * tlb_flush_range_by_mmuidx_async_1:
+ * @cpu: cpu on which to flush
+ * @data: allocated TLBFlushRangeData
+ *
+ * Helper for tlb_flush_range_by_mmuidx and friends, called through
+ * async_run_on_cpu.  Free the structure when done.
+ */
+static void tlb_flush_range_by_mmuidx_async_1(CPUState *cpu,
+                                              run_on_cpu_data data)
+{
+    TLBFlushRangeData *d = data.host_ptr;
+
+    tlb_flush_range_by_mmuidx_async_0(cpu, *d);
+    g_free(d);
+}
+
+/*
+ * Round the range out to whole pages.  Return false if, after doing
+ * so, the request degenerates to a single page, which the callers
+ * hand over to the existing page flush paths.
+ */
+static bool tlb_flush_range_prepare(TLBFlushRangeData *d, target_ulong addr,
+                                    target_ulong len, uint16_t idxmap)
+{
+    target_ulong last = addr + len - 1;
+
+    d->addr = addr & TARGET_PAGE_MASK;
+    d->len = (last & TARGET_PAGE_MASK) - d->addr + TARGET_PAGE_SIZE;
+    d->idxmap = idxmap;
+
+    return d->len > TARGET_PAGE_SIZE;
+}
+
+void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                               target_ulong len, uint16_t idxmap)
+{
+    TLBFlushRangeData d;
+
+    tlb_debug("addr: "TARGET_FMT_lx" len: "TARGET_FMT_lx" mmu_idx:%" PRIx16
+              "\n", addr, len, idxmap);
+
+    if (len == 0) {
+        return;
+    }
+    if (!tlb_flush_range_prepare(&d, addr, len, idxmap)) {
+        tlb_flush_page_by_mmuidx(cpu, d.addr, idxmap);
+        return;
+    }
+
+    if (qemu_cpu_is_self(cpu)) {
+        tlb_flush_range_by_mmuidx_async_0(cpu, d);
+    } else {
+        async_run_on_cpu(cpu, tlb_flush_range_by_mmuidx_async_1,
+                         RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
+    }
+}
+
+void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu, target_ulong addr,
+                                        target_ulong len, uint16_t idxmap)
+{
+    TLBFlushRangeData d;
+    CPUState *dst_cpu;
+
+    tlb_debug("addr: "TARGET_FMT_lx" len: "TARGET_FMT_lx" mmu_idx:%" PRIx16
+              "\n", addr, len, idxmap);
+
+    if (len == 0) {
+        return;
+    }
+    if (!tlb_flush_range_prepare(&d, addr, len, idxmap)) {
+        tlb_flush_page_by_mmuidx_all_cpus(src_cpu, d.addr, idxmap);
+        return;
+    }
+
+    /* Allocate a separate data block for each destination cpu.  */
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
+                             RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
+        }
+    }
+
+    tlb_flush_range_by_mmuidx_async_0(src_cpu, d);
+}
+
+void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
+                                               target_ulong addr,
+                                               target_ulong len,
+                                               uint16_t idxmap)
+{
+    TLBFlushRangeData d;
+    CPUState *dst_cpu;
+
+    tlb_debug("addr: "TARGET_FMT_lx" len: "TARGET_FMT_lx" mmu_idx:%" PRIx16
+              "\n", addr, len, idxmap);
+
+    if (len == 0) {
+        return;
+    }
+    if (!tlb_flush_range_prepare(&d, addr, len, idxmap)) {
+        tlb_flush_page_by_mmuidx_all_cpus_synced(src_cpu, d.addr, idxmap);
+        return;
+    }
+
+    /* Allocate a separate data block for each destination cpu.  */
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
+                             RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
+        }
+    }
+
+    async_safe_run_on_cpu(src_cpu, tlb_flush_range_by_mmuidx_async_1,
+                          RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
+}
+
 /* update the TLBs so that writes to code in the virtual page 'addr'
    can be detected */
 void tlb_protect_code(ram_addr_t ram_addr)
@@ -0,0 +1,217 @@
+/*
+ * Background translation of hot translation blocks
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Translation is tiered: a TB is first translated on its own, and once
+ * it has run superblock_threshold times it is translated again as a
+ * superblock.  The second translation is the expensive one, and it is
+ * not needed for the vCPU to make progress, so it can be moved off the
+ * vCPU thread: the hot TB goes on running while a translator thread
+ * replaces it in the TB hash table.  The vCPUs then find the superblock
+ * on their next lookup.
+ *
+ * Translator threads take mmap_lock like any other translation, so that
+ * they are serialized against the vCPUs, mmap and tb_flush.  They only
+ * translate code from pages that are readable, since a fault in the
+ * translator could not be delivered to the guest.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "cpu.h"
+#include "trace.h"
+#include "qapi/error.h"
+#include "qemu/queue.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "exec/exec-all.h"
+#include "exec/tb-async.h"
+#include "exec/tb-context.h"
+#include "tcg/tcg.h"
+
+#define TB_ASYNC_MAX_THREADS    16
+
+/* Beyond this, vCPUs translate superblocks themselves.  */
+#define TB_ASYNC_MAX_PENDING    256
+
+typedef struct TBAsyncRequest {
+    CPUState *cpu;
+    TranslationBlock *tb;
+    /* tb_ctx.tb_flush_count when the request was made */
+    unsigned flush_count;
+    QSIMPLEQ_ENTRY(TBAsyncRequest) next;
+} TBAsyncRequest;
+
+static struct {
+    QemuMutex lock;
+    QemuCond cond;
+    QSIMPLEQ_HEAD(, TBAsyncRequest) queue;
+    unsigned int nb_threads;
+    unsigned int nb_pending;
+} tb_async;
+
+/*
+ * Once extended, a superblock stays within the page of its start, so
+ * it only reads the pages that @tb covers: the last instruction of @tb
+ * may end on the next one.  Do not fault on any other page.
+ */
+static bool tb_async_code_readable(TranslationBlock *tb)
+{
+    target_ulong page = tb->pc & TARGET_PAGE_MASK;
+    target_ulong last = (tb->pc + tb->size - 1) & TARGET_PAGE_MASK;
+
+    return (page_get_flags(page) & PAGE_READ) &&
+           (last == page || (page_get_flags(last) & PAGE_READ));
+}
+
+static void tb_async_translate(TBAsyncRequest *req)
+{
+    CPUState *cpu = req->cpu;
+    TranslationBlock *tb = req->tb;
+    TranslationBlock *sb = NULL;
+    uint32_t cflags;
+
+    mmap_lock();
+    /* After a flush, req->tb may have been reused for another TB.  */
+    if (atomic_read(&tb_ctx.tb_flush_count) != req->flush_count) {
+        goto out;
+    }
+    cflags = atomic_read(&tb->cflags);
+    if ((cflags & CF_INVALID) || !tb_async_code_readable(tb)) {
+        goto out;
+    }
+
+    /* The superblock has the same key, so @tb must leave the table first. */
+    tb_phys_invalidate(tb, -1);
+    sb = tb_try_gen_code(cpu, tb->pc, tb->cs_base, tb->flags,
+                         (cflags & CF_HASH_MASK) | CF_SUPERBLOCK);
+    if (sb) {
+        atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(tb->pc)], sb);
+    }
+ out:
+    mmap_unlock();
+    trace_tb_async_translate(tb, sb);
+}
+
+static void *tb_async_thread(void *opaque)
+{
+    TBAsyncRequest *req;
+
+    rcu_register_thread();
+    tcg_register_thread();
+
+    qemu_mutex_lock(&tb_async.lock);
+    for (;;) {
+        while (QSIMPLEQ_EMPTY(&tb_async.queue)) {
+            qemu_cond_wait(&tb_async.cond, &tb_async.lock);
+        }
+        req = QSIMPLEQ_FIRST(&tb_async.queue);
+        QSIMPLEQ_REMOVE_HEAD(&tb_async.queue, next);
+        qemu_mutex_unlock(&tb_async.lock);
+
+        tb_async_translate(req);
+        object_unref(OBJECT(req->cpu));
+        g_free(req);
+
+        qemu_mutex_lock(&tb_async.lock);
+        tb_async.nb_pending--;
+    }
+
+    return NULL;
+}
+
+bool tb_async_init(unsigned int threads, Error **errp)
+{
+    QemuThread thread;
+    unsigned int i;
+
+    /* Without superblocks no TB ever becomes hot.  */
+    if (!tb_counts_hot(0)) {
+        error_setg(errp, "Background translation needs superblocks");
+        return false;
+    }
+    if (threads > TB_ASYNC_MAX_THREADS) {
+        error_setg(errp, "At most %d translator threads are supported",
+                   TB_ASYNC_MAX_THREADS);
+        return false;
+    }
+
+    qemu_mutex_init(&tb_async.lock);
+    qemu_cond_init(&tb_async.cond);
+    QSIMPLEQ_INIT(&tb_async.queue);
+    for (i = 0; i < threads; i++) {
+        qemu_thread_create(&thread, "tb-async", tb_async_thread, NULL,
+                           QEMU_THREAD_DETACHED);
+    }
+    tb_async.nb_threads = threads;
+    return true;
+}
+
+bool tb_async_promote(CPUState *cpu, TranslationBlock *tb)
+{
+    TBAsyncRequest *req;
+
+    if (!tb_async.nb_threads) {
+        return false;
+    }
+
+    qemu_mutex_lock(&tb_async.lock);
+    if (tb_async.nb_pending == TB_ASYNC_MAX_PENDING) {
+        qemu_mutex_unlock(&tb_async.lock);
+        return false;
+    }
+    /* Only one of the vCPUs that found @tb hot queues it.  */
+    if (atomic_xchg(&tb->hot_count, INT32_MAX) >= 0) {
+        qemu_mutex_unlock(&tb_async.lock);
+        return true;
+    }
+
+    /*
+     * No flush can happen while this vCPU is running, so the count
+     * read here is the one @tb was translated under.
+     */
+    req = g_new(TBAsyncRequest, 1);
+    req->cpu = cpu;
+    req->tb = tb;
+    req->flush_count = atomic_read(&tb_ctx.tb_flush_count);
+    object_ref(OBJECT(cpu));
+
+    QSIMPLEQ_INSERT_TAIL(&tb_async.queue, req, next);
+    tb_async.nb_pending++;
+    qemu_cond_signal(&tb_async.cond);
+    qemu_mutex_unlock(&tb_async.lock);
+    return true;
+}
+
+void tb_async_fork_start(void)
+{
+    if (tb_async.nb_threads) {
+        qemu_mutex_lock(&tb_async.lock);
+    }
+}
+
+void tb_async_fork_end(int child)
+{
+    TBAsyncRequest *req, *next_req;
+
+    if (!tb_async.nb_threads) {
+        return;
+    }
+    if (!child) {
+        qemu_mutex_unlock(&tb_async.lock);
+        return;
+    }
+
+    /* The translator threads did not survive the fork.  */
+    QSIMPLEQ_FOREACH_SAFE(req, &tb_async.queue, next, next_req) {
+        object_unref(OBJECT(req->cpu));
+        g_free(req);
+    }
+    QSIMPLEQ_INIT(&tb_async.queue);
+    tb_async.nb_pending = 0;
+    tb_async.nb_threads = 0;
+    qemu_mutex_init(&tb_async.lock);
+    qemu_cond_init(&tb_async.cond);
+}
@@ -0,0 +1,733 @@
+/*
+ * Persistent translation block cache
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Short-lived processes spend most of their time translating code that
+ * the previous run of the same binary already translated.  The TB cache
+ * keeps the host code of each TB, together with its search data, in a
+ * file so that the next run can copy it straight into code_gen_buffer.
+ *
+ * A cached TB is reused only if the guest code it was translated from is
+ * byte-for-byte unchanged, and only by a process whose QEMU binary, host
+ * CPU features, prologue and guest configuration all match those of the
+ * process that wrote the file.  The guest configuration is that of the
+ * CPU model and its properties, not the whole command line, so that
+ * options that do not change the generated code do not invalidate the
+ * cache.  The only host addresses the code may refer to are the
+ * prologue and functions of the QEMU binary; the backend records the
+ * branches and constants that hold them in TCGContext.tb_relocs, and
+ * they are patched when the TB is loaded.
+ * References to the TB descriptor and to the TB's own code move with it.
+ * TBs that refer to anything else are not cached.
+ *
+ * The cache holds at most TB_CACHE_MAX_SIZE bytes, in memory and in the
+ * file.  When it is full, the translations that were least recently
+ * stored or reused are dropped.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "cpu.h"
+#include "trace.h"
+#include "qapi/error.h"
+#include "qemu/bswap.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/plugin.h"
+#include "qemu/units.h"
+#include "qemu/xxhash.h"
+#include "qom/object.h"
+#include "exec/exec-all.h"
+#include "exec/tb-cache.h"
+#include "tcg/tcg.h"
+
+#define TB_CACHE_MAGIC          "QEMUTBC"
+#define TB_CACHE_VERSION        2
+#define TB_CACHE_DIGEST_LEN     32
+
+/* Number of translations kept for the same lookup key.  */
+#define TB_CACHE_MAX_VARIANTS   4
+
+/* Total size of the entries, not counting the file header.  */
+#define TB_CACHE_MAX_SIZE       (64 * MiB)
+
+typedef struct TBCacheFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint8_t digest[TB_CACHE_DIGEST_LEN];
+} TBCacheFileHeader;
+
+typedef struct TBCacheKey {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t trace_vcpu_dstate;
+    uint32_t reserved;
+} TBCacheKey;
+
+typedef struct TBCacheReloc {
+    uint32_t offset;
+    uint16_t base;
+    uint16_t kind;
+    int64_t addend;
+} TBCacheReloc;
+
+/*
+ * Each entry of the file is a header followed by the relocations,
+ * the host code with its search data and the guest code, padded to
+ * a multiple of 8 bytes.
+ */
+typedef struct TBCacheEntryHeader {
+    TBCacheKey key;
+    uint16_t size;
+    uint16_t icount;
+    uint16_t jmp_reset_offset[2];
+    uint32_t jmp_insn_offset[2];
+    uint32_t code_size;
+    uint32_t search_size;
+    uint32_t nb_relocs;
+    uint32_t reserved;
+} TBCacheEntryHeader;
+
+QEMU_BUILD_BUG_ON(sizeof(TBCacheFileHeader) % 8);
+QEMU_BUILD_BUG_ON(sizeof(TBCacheEntryHeader) % 8);
+
+typedef struct TBCacheEntry {
+    const TBCacheEntryHeader *hdr;
+    struct TBCacheEntry *next;  /* same key, different guest code */
+    QTAILQ_ENTRY(TBCacheEntry) lru;
+    bool allocated;             /* hdr is not part of the mapped file */
+} TBCacheEntry;
+
+static struct {
+    QemuMutex lock;
+    char *path;
+    GMappedFile *file;
+    GHashTable *table;
+    /* All entries, the least recently stored or reused first.  */
+    QTAILQ_HEAD(, TBCacheEntry) lru;
+    uint64_t size;
+    GChecksum *sum;             /* digest until tb_cache_start() */
+    uint8_t digest[TB_CACHE_DIGEST_LEN];
+    bool dirty;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stores;
+    uint64_t evictions;
+} tb_cache;
+
+static const TBCacheReloc *tb_cache_entry_relocs(const TBCacheEntryHeader *hdr)
+{
+    return (const void *)(hdr + 1);
+}
+
+static const uint8_t *tb_cache_entry_code(const TBCacheEntryHeader *hdr)
+{
+    return (const void *)(tb_cache_entry_relocs(hdr) + hdr->nb_relocs);
+}
+
+static const uint8_t *tb_cache_entry_guest(const TBCacheEntryHeader *hdr)
+{
+    return tb_cache_entry_code(hdr) + hdr->code_size + hdr->search_size;
+}
+
+static uint64_t tb_cache_entry_size(const TBCacheEntryHeader *hdr)
+{
+    uint64_t size = sizeof(*hdr);
+
+    size += (uint64_t)hdr->nb_relocs * sizeof(TBCacheReloc);
+    size += (uint64_t)hdr->code_size + hdr->search_size + hdr->size;
+    return ROUND_UP(size, 8);
+}
+
+static bool tb_cache_entry_valid(const TBCacheEntryHeader *hdr)
+{
+    const TBCacheReloc *r = tb_cache_entry_relocs(hdr);
+    uint32_t i;
+
+    if (hdr->size == 0 || hdr->icount == 0 || hdr->code_size == 0
+        || hdr->nb_relocs > TCG_MAX_TB_RELOCS) {
+        return false;
+    }
+    for (i = 0; i < 2; i++) {
+        if (hdr->jmp_reset_offset[i] != TB_JMP_RESET_OFFSET_INVALID
+            && (hdr->jmp_reset_offset[i] > hdr->code_size
+                || hdr->jmp_insn_offset[i] + 4 > hdr->code_size)) {
+            return false;
+        }
+    }
+    for (i = 0; i < hdr->nb_relocs; i++) {
+        uint32_t size = r[i].kind == TCG_TB_RELOC_ABS64 ? 8 : 4;
+
+        if (r[i].base > TCG_TB_RELOC_TEXT || r[i].kind > TCG_TB_RELOC_ABS64
+            || r[i].offset + size > hdr->code_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static guint tb_cache_key_hash(gconstpointer p)
+{
+    const TBCacheKey *k = p;
+
+    return qemu_xxhash7(k->pc, k->cs_base, k->flags, k->cflags,
+                        k->trace_vcpu_dstate);
+}
+
+static gboolean tb_cache_key_equal(gconstpointer a, gconstpointer b)
+{
+    return !memcmp(a, b, sizeof(TBCacheKey));
+}
+
+static void tb_cache_key_init(TBCacheKey *k, const TranslationBlock *tb)
+{
+    memset(k, 0, sizeof(*k));
+    k->pc = tb->pc;
+    k->cs_base = tb->cs_base;
+    k->flags = tb->flags;
+    k->cflags = tb->cflags & (CF_HASH_MASK | CF_SUPERBLOCK);
+    k->trace_vcpu_dstate = tb->trace_vcpu_dstate;
+}
+
+static void tb_cache_entry_free(TBCacheEntry *e)
+{
+    QTAILQ_REMOVE(&tb_cache.lru, e, lru);
+    tb_cache.size -= tb_cache_entry_size(e->hdr);
+    if (e->allocated) {
+        g_free((void *)e->hdr);
+    }
+    g_free(e);
+}
+
+static bool tb_cache_same_guest(const TBCacheEntryHeader *a,
+                                const TBCacheEntryHeader *b)
+{
+    return a->size == b->size &&
+           !memcmp(tb_cache_entry_guest(a), tb_cache_entry_guest(b), a->size);
+}
+
+/* Called with tb_cache.lock held, or before any vCPU runs.  */
+static void tb_cache_remove(TBCacheEntry *e)
+{
+    TBCacheEntry *head = g_hash_table_lookup(tb_cache.table, &e->hdr->key);
+    TBCacheEntry **pe;
+
+    if (head == e) {
+        /* As in tb_cache_insert(), the key belongs to the head entry.  */
+        g_hash_table_steal(tb_cache.table, &e->hdr->key);
+        if (e->next) {
+            g_hash_table_insert(tb_cache.table, (gpointer)&e->next->hdr->key,
+                                e->next);
+        }
+    } else {
+        pe = &head->next;
+        while (*pe != e) {
+            pe = &(*pe)->next;
+        }
+        *pe = e->next;
+    }
+    tb_cache_entry_free(e);
+}
+
+/*
+ * Drop the least recently used entries other than @e until the cache fits
+ * in its budget.  Called with tb_cache.lock held, or before any vCPU runs.
+ */
+static void tb_cache_evict(TBCacheEntry *e)
+{
+    while (tb_cache.size > TB_CACHE_MAX_SIZE) {
+        TBCacheEntry *old = QTAILQ_FIRST(&tb_cache.lru);
+
+        if (old == e) {
+            break;
+        }
+        tb_cache_remove(old);
+        tb_cache.evictions++;
+        tb_cache.dirty = true;
+    }
+}
+
+/* Called with tb_cache.lock held, or before any vCPU runs.  */
+static void tb_cache_insert(const TBCacheEntryHeader *hdr, bool allocated)
+{
+    TBCacheEntry *head = g_hash_table_lookup(tb_cache.table, &hdr->key);
+    TBCacheEntry *e = g_new0(TBCacheEntry, 1);
+    TBCacheEntry **pe = &head;
+    int n = 1;
+
+    /* The key is part of the head entry, which may go away below.  */
+    g_hash_table_steal(tb_cache.table, &hdr->key);
+
+    /* The new translation replaces any older one of the same guest code.  */
+    while (*pe) {
+        TBCacheEntry *old = *pe;
+
+        if (n == TB_CACHE_MAX_VARIANTS || tb_cache_same_guest(old->hdr, hdr)) {
+            *pe = old->next;
+            tb_cache_entry_free(old);
+        } else {
+            pe = &old->next;
+            n++;
+        }
+    }
+
+    e->hdr = hdr;
+    e->allocated = allocated;
+    e->next = head;
+    g_hash_table_insert(tb_cache.table, (gpointer)&hdr->key, e);
+    QTAILQ_INSERT_TAIL(&tb_cache.lru, e, lru);
+    tb_cache.size += tb_cache_entry_size(hdr);
+    tb_cache_evict(e);
+}
+
+static void tb_cache_chain_free(gpointer p)
+{
+    TBCacheEntry *e = p;
+
+    while (e) {
+        TBCacheEntry *next = e->next;
+
+        tb_cache_entry_free(e);
+        e = next;
+    }
+}
+
+/*
+ * Copy @len bytes of guest code at @pc to @buf, or compare them with
+ * @cmp.  Returns false if the code is not in RAM, or differs from @cmp.
+ * Never raises a guest exception.
+ */
+static bool tb_cache_guest_code(CPUArchState *env, target_ulong pc,
+                                size_t len, uint8_t *buf, const uint8_t *cmp)
+{
+    while (len) {
+        size_t n = MIN(len, -(pc | TARGET_PAGE_MASK));
+        void *host;
+
+#ifdef CONFIG_USER_ONLY
+        int flags = page_get_flags(pc);
+
+        if ((flags & (PAGE_VALID | PAGE_READ)) != (PAGE_VALID | PAGE_READ)) {
+            return false;
+        }
+        host = g2h(pc);
+#else
+        host = tlb_vaddr_to_host(env, pc, MMU_INST_FETCH,
+                                 cpu_mmu_index(env, true));
+        if (!host) {
+            return false;
+        }
+#endif
+        if (buf) {
+            memcpy(buf, host, n);
+            buf += n;
+        } else if (memcmp(cmp, host, n)) {
+            return false;
+        } else {
+            cmp += n;
+        }
+        pc += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool tb_cache_usable(CPUState *cpu, const TranslationBlock *tb)
+{
+    if (!tb_cache.table || (tb->cflags & CF_NOCACHE)) {
+        return false;
+    }
+    /* The translator inserts checks for these into the code.  */
+    if (singlestep || cpu->singlestep_enabled ||
+        !QTAILQ_EMPTY(&cpu->breakpoints)) {
+        return false;
+    }
+#ifdef CONFIG_PLUGIN
+    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask)) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+/* Called with tb_cache.lock held.  */
+static bool tb_cache_install(const TBCacheEntryHeader *hdr,
+                             TranslationBlock *tb, int *search_size)
+{
+    const TBCacheReloc *r = tb_cache_entry_relocs(hdr);
+    uint8_t *buf = tb->tc.ptr;
+    size_t len = hdr->code_size + hdr->search_size;
+    uint32_t i;
+
+    if (buf + len > (uint8_t *)tcg_ctx->code_gen_highwater) {
+        return false;
+    }
+    memcpy(buf, tb_cache_entry_code(hdr), len);
+
+    for (i = 0; i < hdr->nb_relocs; i++) {
+        uintptr_t target = tcg_tb_reloc_base(r[i].base) + r[i].addend;
+        intptr_t disp = target - (uintptr_t)(buf + r[i].offset + 4);
+
+        if (r[i].kind == TCG_TB_RELOC_ABS64) {
+            stq_he_p(buf + r[i].offset, target);
+        } else if (disp == (int32_t)disp) {
+            stl_he_p(buf + r[i].offset, disp);
+        } else {
+            return false;
+        }
+    }
+    flush_icache_range((uintptr_t)buf, (uintptr_t)buf + hdr->code_size);
+
+    tb->size = hdr->size;
+    tb->icount = hdr->icount;
+    tb->tc.size = hdr->code_size;
+    for (i = 0; i < 2; i++) {
+        tb->jmp_reset_offset[i] = hdr->jmp_reset_offset[i];
+        tb->jmp_target_arg[i] = hdr->jmp_insn_offset[i];
+    }
+    *search_size = hdr->search_size;
+    return true;
+}
+
+bool tb_cache_load(CPUState *cpu, TranslationBlock *tb, int *search_size)
+{
+    CPUArchState *env = cpu->env_ptr;
+    TBCacheEntry *e;
+    TBCacheKey key;
+    bool hit = false;
+
+    if (!tb_cache_usable(cpu, tb)) {
+        return false;
+    }
+    tb_cache_key_init(&key, tb);
+
+    qemu_mutex_lock(&tb_cache.lock);
+    for (e = g_hash_table_lookup(tb_cache.table, &key); e; e = e->next) {
+        if (tb_cache_guest_code(env, tb->pc, e->hdr->size, NULL,
+                                tb_cache_entry_guest(e->hdr))) {
+            hit = tb_cache_install(e->hdr, tb, search_size);
+            if (hit) {
+                QTAILQ_REMOVE(&tb_cache.lru, e, lru);
+                QTAILQ_INSERT_TAIL(&tb_cache.lru, e, lru);
+            }
+            break;
+        }
+    }
+    if (hit) {
+        tb_cache.hits++;
+    } else {
+        tb_cache.misses++;
+    }
+    qemu_mutex_unlock(&tb_cache.lock);
+    return hit;
+}
+
+void tb_cache_store(CPUState *cpu, TranslationBlock *tb, int search_size)
+{
+    TCGContext *s = tcg_ctx;
+    TBCacheEntryHeader *hdr;
+    TBCacheReloc *r;
+    uint8_t *code;
+    int i;
+
+    if (!tb_cache_usable(cpu, tb) || !s->tb_relocatable) {
+        return;
+    }
+
+    hdr = g_malloc0(sizeof(*hdr) + s->nb_tb_relocs * sizeof(TBCacheReloc)
+                    + tb->tc.size + search_size + tb->size);
+    tb_cache_key_init(&hdr->key, tb);
+    hdr->size = tb->size;
+    hdr->icount = tb->icount;
+    for (i = 0; i < 2; i++) {
+        hdr->jmp_reset_offset[i] = tb->jmp_reset_offset[i];
+        hdr->jmp_insn_offset[i] = tb->jmp_target_arg[i];
+    }
+    hdr->code_size = tb->tc.size;
+    hdr->search_size = search_size;
+    hdr->nb_relocs = s->nb_tb_relocs;
+
+    r = (TBCacheReloc *)tb_cache_entry_relocs(hdr);
+    for (i = 0; i < s->nb_tb_relocs; i++) {
+        r[i].offset = s->tb_relocs[i].offset;
+        r[i].base = s->tb_relocs[i].base;
+        r[i].kind = s->tb_relocs[i].kind;
+        r[i].addend = s->tb_relocs[i].addend;
+    }
+    code = (uint8_t *)tb_cache_entry_code(hdr);
+    memcpy(code, tb->tc.ptr, hdr->code_size + hdr->search_size);
+
+    if (!tb_cache_guest_code(cpu->env_ptr, tb->pc, tb->size,
+                             code + hdr->code_size + hdr->search_size,
+                             NULL)) {
+        g_free(hdr);
+        return;
+    }
+
+    qemu_mutex_lock(&tb_cache.lock);
+    tb_cache_insert(hdr, true);
+    tb_cache.stores++;
+    tb_cache.dirty = true;
+    qemu_mutex_unlock(&tb_cache.lock);
+}
+
+/* Return true if object_property_print() can format @prop.  */
+static bool tb_cache_scalar_property(ObjectProperty *prop)
+{
+    static const char *const types[] = {
+        "bool", "str", "string", "size", "int",
+        "int8", "int16", "int32", "int64",
+        "uint8", "uint16", "uint32", "uint64",
+    };
+    int i;
+
+    if (!prop->get) {
+        return false;
+    }
+    for (i = 0; i < ARRAY_SIZE(types); i++) {
+        if (!strcmp(prop->type, types[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Hash the CPU model of @cpu and the values of its properties, which
+ * include the guest CPU features that the translator depends on.
+ */
+static void tb_cache_digest_cpu(GChecksum *sum, CPUState *cpu)
+{
+    GPtrArray *props = g_ptr_array_new_with_free_func(g_free);
+    ObjectPropertyIterator iter;
+    ObjectProperty *prop;
+    int i;
+
+    object_property_iter_init(&iter, OBJECT(cpu));
+    while ((prop = object_property_iter_next(&iter))) {
+        char *value;
+
+        if (!tb_cache_scalar_property(prop)) {
+            continue;
+        }
+        value = object_property_print(OBJECT(cpu), prop->name, false, NULL);
+        if (value) {
+            g_ptr_array_add(props, g_strdup_printf("%s=%s", prop->name,
+                                                   value));
+            g_free(value);
+        }
+    }
+    /* The order of the property tables is not significant.  */
+    g_ptr_array_sort(props, (GCompareFunc)qemu_pstrcmp0);
+
+    g_checksum_update(sum, (const guchar *)object_get_typename(OBJECT(cpu)),
+                      -1);
+    for (i = 0; i < props->len; i++) {
+        const char *p = g_ptr_array_index(props, i);
+
+        g_checksum_update(sum, (const guchar *)p, strlen(p) + 1);
+    }
+    g_ptr_array_free(props, true);
+}
+
+static bool tb_cache_digest_host(GChecksum *sum, Error **errp)
+{
+#if TCG_TARGET_HAS_tb_relocs
+    struct stat st;
+    uint32_t features = tcg_target_code_features();
+    uint32_t tb_size = sizeof(TranslationBlock);
+    uint32_t page_bits = TARGET_PAGE_BITS;
+    uint8_t counts_hot = superblock_threshold != 0;
+
+    /* Host code from a different build of QEMU is useless.  */
+    if (stat("/proc/self/exe", &st) < 0) {
+        error_setg_errno(errp, errno, "Cannot identify the QEMU binary");
+        return false;
+    }
+
+    g_checksum_update(sum, (const guchar *)QEMU_VERSION, -1);
+    g_checksum_update(sum, (const guchar *)TARGET_NAME, -1);
+    g_checksum_update(sum, (const guchar *)&st.st_dev, sizeof(st.st_dev));
+    g_checksum_update(sum, (const guchar *)&st.st_ino, sizeof(st.st_ino));
+    g_checksum_update(sum, (const guchar *)&st.st_size, sizeof(st.st_size));
+    g_checksum_update(sum, (const guchar *)&st.st_mtime, sizeof(st.st_mtime));
+    g_checksum_update(sum, (const guchar *)&features, sizeof(features));
+    g_checksum_update(sum, (const guchar *)&qemu_icache_linesize,
+                      sizeof(qemu_icache_linesize));
+    g_checksum_update(sum, (const guchar *)&tb_size, sizeof(tb_size));
+    g_checksum_update(sum, (const guchar *)&page_bits, sizeof(page_bits));
+    g_checksum_update(sum, &counts_hot, sizeof(counts_hot));
+    g_checksum_update(sum, tcg_ctx->code_gen_prologue,
+                      tcg_ctx->code_gen_buffer - tcg_ctx->code_gen_prologue);
+    return true;
+#else
+    error_setg(errp, "The TB cache is not supported on this host");
+    return false;
+#endif
+}
+
+static void tb_cache_open(void)
+{
+    g_autoptr(GError) gerr = NULL;
+    const TBCacheFileHeader *fh;
+    const uint8_t *p, *end;
+    int n = 0;
+
+    tb_cache.file = g_mapped_file_new(tb_cache.path, FALSE, &gerr);
+    if (!tb_cache.file) {
+        if (!g_error_matches(gerr, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            warn_report("Cannot read TB cache: %s", gerr->message);
+        }
+        return;
+    }
+
+    p = (const uint8_t *)g_mapped_file_get_contents(tb_cache.file);
+    end = p + g_mapped_file_get_length(tb_cache.file);
+    fh = (const TBCacheFileHeader *)p;
+
+    /* A cache built for another configuration is simply replaced.  */
+    if (end - p < sizeof(*fh) ||
+        memcmp(fh->magic, TB_CACHE_MAGIC, sizeof(fh->magic)) ||
+        fh->version != TB_CACHE_VERSION ||
+        memcmp(fh->digest, tb_cache.digest, TB_CACHE_DIGEST_LEN)) {
+        trace_tb_cache_open(tb_cache.path, 0);
+        return;
+    }
+
+    for (p += sizeof(*fh); end - p >= sizeof(TBCacheEntryHeader); n++) {
+        const TBCacheEntryHeader *hdr = (const TBCacheEntryHeader *)p;
+        uint64_t size = tb_cache_entry_size(hdr);
+
+        if (size > end - p || !tb_cache_entry_valid(hdr)) {
+            warn_report("%s: ignoring corrupt TB cache entries",
+                        tb_cache.path);
+            break;
+        }
+        tb_cache_insert(hdr, false);
+        p += size;
+    }
+    trace_tb_cache_open(tb_cache.path, n);
+}
+
+bool tb_cache_init(const char *path, Error **errp)
+{
+    assert(!tb_cache.sum);
+
+    tb_cache.sum = g_checksum_new(G_CHECKSUM_SHA256);
+    if (!tb_cache_digest_host(tb_cache.sum, errp)) {
+        g_checksum_free(tb_cache.sum);
+        tb_cache.sum = NULL;
+        return false;
+    }
+
+    qemu_mutex_init(&tb_cache.lock);
+    tb_cache.path = g_strdup(path);
+
+    /* Translations done from now on must be movable to be cached.  */
+    tcg_ctx->tb_record_relocs = true;
+    return true;
+}
+
+void tb_cache_start(CPUState *cpu, const void *config, size_t config_len)
+{
+    gsize len = TB_CACHE_DIGEST_LEN;
+
+    if (!tb_cache.sum) {
+        return;
+    }
+    assert(!tb_cache.table);
+
+    tb_cache_digest_cpu(tb_cache.sum, cpu);
+    g_checksum_update(tb_cache.sum, config, config_len);
+    g_checksum_get_digest(tb_cache.sum, tb_cache.digest, &len);
+    g_checksum_free(tb_cache.sum);
+    tb_cache.sum = NULL;
+
+    QTAILQ_INIT(&tb_cache.lru);
+    tb_cache.table = g_hash_table_new_full(tb_cache_key_hash,
+                                           tb_cache_key_equal,
+                                           NULL, tb_cache_chain_free);
+    tb_cache_open();
+}
+
+static void tb_cache_write_entry(FILE *f, const TBCacheEntry *e)
+{
+    static const uint8_t zero[8];
+    uint64_t size;
+
+    size = sizeof(*e->hdr) + e->hdr->nb_relocs * sizeof(TBCacheReloc)
+           + e->hdr->code_size + e->hdr->search_size + e->hdr->size;
+    fwrite(e->hdr, size, 1, f);
+    fwrite(zero, tb_cache_entry_size(e->hdr) - size, 1, f);
+}
+
+void tb_cache_save(void)
+{
+    TBCacheFileHeader fh = {
+        .magic = TB_CACHE_MAGIC,
+        .version = TB_CACHE_VERSION,
+    };
+    g_autofree char *tmp = NULL;
+    TBCacheEntry *e;
+    FILE *f;
+    int fd, n = 0;
+    bool failed;
+
+    if (!tb_cache.table) {
+        return;
+    }
+
+    qemu_mutex_lock(&tb_cache.lock);
+    trace_tb_cache_stats(tb_cache.hits, tb_cache.misses, tb_cache.stores,
+                         tb_cache.evictions);
+    if (!tb_cache.dirty) {
+        goto out;
+    }
+
+    /* Replace the file atomically; other processes may be reading it.  */
+    tmp = g_strdup_printf("%s.XXXXXX", tb_cache.path);
+    fd = g_mkstemp(tmp);
+    if (fd < 0) {
+        warn_report("Cannot write TB cache %s: %s", tmp, strerror(errno));
+        goto out;
+    }
+    f = fdopen(fd, "wb");
+    if (!f) {
+        warn_report("Cannot write TB cache %s: %s", tmp, strerror(errno));
+        close(fd);
+        unlink(tmp);
+        goto out;
+    }
+
+    memcpy(fh.digest, tb_cache.digest, TB_CACHE_DIGEST_LEN);
+    fwrite(&fh, sizeof(fh), 1, f);
+
+    /*
+     * Write the least recently used translation first, so that loading
+     * the file gives the same order and the same translations are
+     * evicted first.
+     */
+    QTAILQ_FOREACH(e, &tb_cache.lru, lru) {
+        tb_cache_write_entry(f, e);
+        n++;
+    }
+
+    failed = ferror(f);
+    failed |= fclose(f) != 0;
+    if (failed || rename(tmp, tb_cache.path) < 0) {
+        warn_report("Cannot write TB cache %s: %s", tb_cache.path,
+                    strerror(errno));
+        unlink(tmp);
+        goto out;
+    }
+    tb_cache.dirty = false;
+    trace_tb_cache_save(tb_cache.path, n);
+
+ out:
+    qemu_mutex_unlock(&tb_cache.lock);
+}
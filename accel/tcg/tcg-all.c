@@ -35,12 +35,16 @@
 #include "qemu/error-report.h"
 #include "hw/boards.h"
 #include "qapi/qapi-builtin-visit.h"
+#include "sysemu/sysemu.h"
+#include "exec/tb-cache.h"
 
 typedef struct TCGState {
     AccelState parent_obj;
 
     bool mttcg_enabled;
     unsigned long tb_size;
+    char *tb_cache;
+    uint32_t superblock_threshold;
 } TCGState;
 
 #define TYPE_TCG_ACCEL ACCEL_CLASS_NAME("tcg")
@@ -122,11 +126,54 @@ static void tcg_accel_instance_init(Object *obj)
     s->mttcg_enabled = default_mttcg_enabled();
 }
 
+static void tcg_tb_cache_exit(Notifier *n, void *data)
+{
+    tb_cache_save();
+}
+
+static Notifier tb_cache_exit_notifier = {
+    .notify = tcg_tb_cache_exit,
+};
+
+/*
+ * The CPU model and its features are known once the machine is built.
+ * Together with the machine type, they pin down the translated code.
+ */
+static void tcg_tb_cache_start(Notifier *n, void *data)
+{
+    const char *machine = object_get_typename(OBJECT(current_machine));
+
+    if (!first_cpu) {
+        return;
+    }
+    tb_cache_start(first_cpu, machine, strlen(machine));
+}
+
+static Notifier tb_cache_start_notifier = {
+    .notify = tcg_tb_cache_start,
+};
+
+static void tcg_tb_cache_init(const char *path)
+{
+    Error *err = NULL;
+
+    if (!tb_cache_init(path, &err)) {
+        warn_reportf_err(err, "TB cache disabled: ");
+        return;
+    }
+    qemu_add_machine_init_done_notifier(&tb_cache_start_notifier);
+    qemu_add_exit_notifier(&tb_cache_exit_notifier);
+}
+
 static int tcg_init(MachineState *ms)
 {
     TCGState *s = TCG_STATE(current_accel());
 
+    superblock_threshold = s->superblock_threshold;
     tcg_exec_init(s->tb_size * 1024 * 1024);
+    if (s->tb_cache) {
+        tcg_tb_cache_init(s->tb_cache);
+    }
     cpu_interrupt_handler = tcg_handle_interrupt;
     mttcg_enabled = s->mttcg_enabled;
     return 0;
@@ -194,6 +241,59 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static char *tcg_get_tb_cache(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return g_strdup(s->tb_cache);
+}
+
+static void tcg_set_tb_cache(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    g_free(s->tb_cache);
+    s->tb_cache = g_strdup(value);
+}
+
+static void tcg_get_superblock_threshold(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->superblock_threshold;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_superblock_threshold(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    Error *error = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, name, &value, &error);
+    if (error) {
+        error_propagate(errp, error);
+        return;
+    }
+    if (value > INT32_MAX) {
+        error_setg(errp, "superblock-threshold must be at most %d",
+                   INT32_MAX);
+        return;
+    }
+#ifndef TARGET_HAS_SUPERBLOCKS
+    if (value) {
+        warn_report("Guest does not support superblocks, "
+                    "superblock-threshold ignored");
+    }
+#endif
+
+    s->superblock_threshold = value;
+}
+
 static void tcg_accel_class_init(ObjectClass *oc, void *data)
 {
     AccelClass *ac = ACCEL_CLASS(oc);
@@ -211,6 +311,19 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add_str(oc, "tb-cache",
+                                  tcg_get_tb_cache,
+                                  tcg_set_tb_cache);
+    object_class_property_set_description(oc, "tb-cache",
+        "File keeping translated code between runs (holds host code "
+        "that is run, so it must be in a trusted location)");
+
+    object_class_property_add(oc, "superblock-threshold", "int",
+        tcg_get_superblock_threshold, tcg_set_superblock_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "superblock-threshold",
+        "Executions after which a TB is retranslated as a superblock");
+
 }
 
 static const TypeInfo tcg_accel_type = {
@@ -49,6 +49,7 @@
 
 #include "exec/cputlb.h"
 #include "exec/tb-hash.h"
+#include "exec/tb-cache.h"
 #include "translate-all.h"
 #include "qemu/bitmap.h"
 #include "qemu/error-report.h"
@@ -220,6 +221,7 @@ TCGContext tcg_init_ctx;
 __thread TCGContext *tcg_ctx;
 TBContext tb_ctx;
 bool parallel_cpus;
+uint32_t superblock_threshold;
 
 static void page_table_config_init(void)
 {
@@ -1240,6 +1242,7 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 
     CPU_FOREACH(cpu) {
         cpu_tb_jmp_cache_clear(cpu);
+        cpu_tb_l2_cache_clear(cpu);
     }
 
     qht_reset_size(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
@@ -1664,10 +1667,15 @@ tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
     return tb;
 }
 
-/* Called with mmap_lock held for user mode emulation.  */
-TranslationBlock *tb_gen_code(CPUState *cpu,
-                              target_ulong pc, target_ulong cs_base,
-                              uint32_t flags, int cflags)
+/*
+ * Called with mmap_lock held for user mode emulation.  If @can_exit is
+ * false, return NULL instead of flushing the TBs and leaving the cpu
+ * loop when the code buffer is full.
+ */
+static TranslationBlock *do_tb_gen_code(CPUState *cpu,
+                                        target_ulong pc, target_ulong cs_base,
+                                        uint32_t flags, int cflags,
+                                        bool can_exit)
 {
     CPUArchState *env = cpu->env_ptr;
     TranslationBlock *tb, *existing_tb;
@@ -1707,6 +1715,10 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
  buffer_overflow:
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
+        if (!can_exit) {
+            /* Leave the flush to the next vCPU that translates.  */
+            return NULL;
+        }
         /* flush must be done */
         tb_flush(cpu);
         mmap_unlock();
@@ -1723,7 +1735,13 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cflags = cflags;
     tb->orig_tb = NULL;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    tb->hot_count = tb_counts_hot(cflags) ? superblock_threshold : INT32_MAX;
     tcg_ctx->tb_cflags = cflags;
+
+    if (tb_cache_load(cpu, tb, &search_size)) {
+        gen_code_size = tb->tc.size;
+        goto code_ready;
+    }
  tb_overflow:
 
 #ifdef CONFIG_PROFILER
@@ -1797,6 +1815,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         goto buffer_overflow;
     }
     tb->tc.size = gen_code_size;
+    tb_cache_store(cpu, tb, search_size);
 
 #ifdef CONFIG_PROFILER
     atomic_set(&prof->code_time, prof->code_time + profile_getclock() - ti);
@@ -1864,6 +1883,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     }
 #endif
 
+ code_ready:
     atomic_set(&tcg_ctx->code_gen_ptr, (void *)
         ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
                  CODE_GEN_ALIGN));
@@ -1908,6 +1928,25 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     return tb;
 }
 
+/* Called with mmap_lock held for user mode emulation.  */
+TranslationBlock *tb_gen_code(CPUState *cpu,
+                              target_ulong pc, target_ulong cs_base,
+                              uint32_t flags, int cflags)
+{
+    return do_tb_gen_code(cpu, pc, cs_base, flags, cflags, true);
+}
+
+/*
+ * Called with mmap_lock held for user mode emulation, possibly outside
+ * the thread of @cpu.
+ */
+TranslationBlock *tb_try_gen_code(CPUState *cpu,
+                                  target_ulong pc, target_ulong cs_base,
+                                  uint32_t flags, int cflags)
+{
+    return do_tb_gen_code(cpu, pc, cs_base, flags, cflags, false);
+}
+
 /*
  * @p must be non-NULL.
  * user-mode: call with mmap_lock held.
@@ -2268,6 +2307,7 @@ static void tb_jmp_cache_clear_page(CPUState *cpu, target_ulong page_addr)
     unsigned int i, i0 = tb_jmp_cache_hash_page(page_addr);
 
     for (i = 0; i < TB_JMP_PAGE_SIZE; i++) {
+        tb_l2_cache_evict(cpu, atomic_read(&cpu->tb_jmp_cache[i0 + i]));
         atomic_set(&cpu->tb_jmp_cache[i0 + i], NULL);
     }
 }
@@ -2355,6 +2395,8 @@ void dump_exec_info(void)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t l2_lookups = 0, l2_hits = 0;
+    CPUState *cpu;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2392,6 +2434,13 @@ void dump_exec_info(void)
     qemu_printf("TB invalidate count %zu\n",
                 tcg_tb_phys_invalidate_count());
 
+    CPU_FOREACH(cpu) {
+        l2_lookups += atomic_read(&cpu->tb_l2_cache.lookups);
+        l2_hits += atomic_read(&cpu->tb_l2_cache.hits);
+    }
+    qemu_printf("TB L2 cache hits    %zu/%zu (%zu%%)\n", l2_hits, l2_lookups,
+                l2_lookups ? (l2_hits * 100) / l2_lookups : 0);
+
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     qemu_printf("TLB full flushes    %zu\n", flush_full);
     qemu_printf("TLB partial flushes %zu\n", flush_part);
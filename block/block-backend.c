@@ -1432,6 +1432,13 @@ static BlockAIOCB *blk_aio_prwv(BlockBackend *blk, int64_t offset, int bytes,
     acb->bytes = bytes;
     acb->has_returned = false;
 
+    /*
+     * The caller may run in a different AioContext than the BlockBackend,
+     * e.g. a virtio-blk virtqueue mapped to another IOThread.  In that case
+     * the coroutine is scheduled in the BlockBackend's AioContext rather
+     * than entered here; since the caller holds that AioContext's lock,
+     * it cannot start before has_returned is set.
+     */
     co = qemu_coroutine_create(co_entry, acb);
     bdrv_coroutine_enter(blk_bs(blk), co);
 
@@ -2402,6 +2409,45 @@ int coroutine_fn blk_co_copy_range(BlockBackend *blk_in, int64_t off_in,
                               bytes, read_flags, write_flags);
 }
 
+/*
+ * Send @bytes at @offset to the socket @out_fd, after @hdr, without copying
+ * them through a buffer.  The request is queued while the BlockBackend is
+ * drained and throttled like any other read.  See bdrv_co_sendfile() for
+ * the return value.
+ */
+int coroutine_fn blk_co_sendfile(BlockBackend *blk, int64_t offset,
+                                 unsigned int bytes, int out_fd,
+                                 QEMUIOVector *hdr)
+{
+    BlockDriverState *bs;
+    int ret;
+
+    blk_inc_in_flight(blk);
+    blk_wait_while_drained(blk);
+
+    /* Call blk_bs() only after waiting, the graph may have changed */
+    bs = blk_bs(blk);
+    ret = blk_check_byte_request(blk, offset, bytes);
+    if (ret < 0) {
+        goto out;
+    }
+
+    bdrv_inc_in_flight(bs);
+
+    /* throttling disk I/O */
+    if (blk->public.throttle_group_member.throttle_state) {
+        throttle_group_co_io_limits_intercept(&blk->public.throttle_group_member,
+                bytes, false);
+    }
+
+    ret = bdrv_co_sendfile(blk->root, offset, bytes, out_fd, hdr);
+    bdrv_dec_in_flight(bs);
+
+out:
+    blk_dec_in_flight(blk);
+    return ret;
+}
+
 const BdrvChild *blk_root(BlockBackend *blk)
 {
     return blk->root;
@@ -61,6 +61,7 @@
 #include <sys/ioctl.h>
 #include <sys/param.h>
 #include <sys/syscall.h>
+#include <sys/sendfile.h>
 #include <linux/cdrom.h>
 #include <linux/fd.h>
 #include <linux/fs.h>
@@ -206,6 +207,10 @@ typedef struct RawPosixAIOData {
             PreallocMode prealloc;
             Error **errp;
         } truncate;
+        struct {
+            int out_fd;
+            QEMUIOVector *hdr;
+        } sendfile;
     };
 } RawPosixAIOData;
 
@@ -1047,6 +1052,22 @@ out:
     return ret;
 }
 
+/*
+ * Called before @fd stops being used for I/O in @ctx, so that io_uring can
+ * drop it from its registered file table.
+ */
+static void raw_aio_unregister_fd(BlockDriverState *bs, AioContext *ctx,
+                                  int fd)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_linux_io_uring) {
+        luring_unregister_fd(aio_get_linux_io_uring(ctx), fd);
+    }
+#endif
+}
+
 static void raw_reopen_commit(BDRVReopenState *state)
 {
     BDRVRawReopenState *rs = state->opaque;
@@ -1056,6 +1077,7 @@ static void raw_reopen_commit(BDRVReopenState *state)
     s->check_cache_dropped = rs->check_cache_dropped;
     s->open_flags = rs->open_flags;
 
+    raw_aio_unregister_fd(state->bs, bdrv_get_aio_context(state->bs), s->fd);
     qemu_close(s->fd);
     s->fd = rs->fd;
 
@@ -1681,6 +1703,55 @@ static int handle_aiocb_copy_range(void *opaque)
     return 0;
 }
 
+#ifdef CONFIG_LINUX
+static int handle_aiocb_sendfile(void *opaque)
+{
+    RawPosixAIOData *aiocb = opaque;
+    QEMUIOVector *hdr = aiocb->sendfile.hdr;
+    uint64_t bytes = aiocb->aio_nbytes;
+    off_t in_off = aiocb->aio_offset;
+    int total = 0;
+    ssize_t ret;
+
+    if (hdr && hdr->size) {
+        ret = iov_send(aiocb->sendfile.out_fd, hdr->iov, hdr->niov,
+                       0, hdr->size);
+        if (ret < 0) {
+            return -errno;
+        }
+        total = ret;
+        if (ret < hdr->size) {
+            return total;
+        }
+    }
+
+    /*
+     * The socket is usually non-blocking: stop as soon as it is full and
+     * let the caller wait for it in its AioContext.
+     */
+    while (bytes) {
+        ret = sendfile(aiocb->sendfile.out_fd, aiocb->aio_fildes, &in_off,
+                       bytes);
+        if (ret == 0) {
+            /* Beyond EOF, let the caller read the rest */
+            break;
+        }
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (total) {
+                break;
+            }
+            return errno == EINVAL || errno == ENOSYS ? -ENOTSUP : -errno;
+        }
+        total += ret;
+        bytes -= ret;
+    }
+    return total;
+}
+#endif
+
 static int handle_aiocb_discard(void *opaque)
 {
     RawPosixAIOData *aiocb = opaque;
@@ -2018,6 +2089,15 @@ static int raw_co_flush_to_disk(BlockDriverState *bs)
     return raw_thread_pool_submit(bs, handle_aiocb_flush, &acb);
 }
 
+static void raw_aio_detach_aio_context(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->fd >= 0) {
+        raw_aio_unregister_fd(bs, bdrv_get_aio_context(bs), s->fd);
+    }
+}
+
 static void raw_aio_attach_aio_context(BlockDriverState *bs,
                                        AioContext *new_context)
 {
@@ -2049,6 +2129,7 @@ static void raw_close(BlockDriverState *bs)
     BDRVRawState *s = bs->opaque;
 
     if (s->fd >= 0) {
+        raw_aio_unregister_fd(bs, bdrv_get_aio_context(bs), s->fd);
         qemu_close(s->fd);
         s->fd = -1;
     }
@@ -3013,6 +3094,7 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+        raw_aio_unregister_fd(bs, bdrv_get_aio_context(bs), s->fd);
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
@@ -3085,6 +3167,40 @@ static int coroutine_fn raw_co_copy_range_to(BlockDriverState *bs,
     return raw_thread_pool_submit(bs, handle_aiocb_copy_range, &acb);
 }
 
+static int coroutine_fn raw_co_sendfile(BlockDriverState *bs,
+                                        uint64_t offset, uint64_t bytes,
+                                        int out_fd, QEMUIOVector *hdr)
+{
+#ifdef CONFIG_LINUX
+    BDRVRawState *s = bs->opaque;
+    RawPosixAIOData acb;
+
+    /* O_DIRECT users do not want their reads to go through the page cache */
+    if (s->type != FTYPE_FILE || (s->open_flags & O_DIRECT)) {
+        return -ENOTSUP;
+    }
+    if (fd_open(bs) < 0) {
+        return -EIO;
+    }
+
+    acb = (RawPosixAIOData) {
+        .bs             = bs,
+        .aio_type       = QEMU_AIO_SENDFILE,
+        .aio_fildes     = s->fd,
+        .aio_offset     = offset,
+        .aio_nbytes     = bytes,
+        .sendfile       = {
+            .out_fd         = out_fd,
+            .hdr            = hdr,
+        },
+    };
+
+    return raw_thread_pool_submit(bs, handle_aiocb_sendfile, &acb);
+#else
+    return -ENOTSUP;
+#endif
+}
+
 BlockDriver bdrv_file = {
     .format_name = "file",
     .protocol_name = "file",
@@ -3111,9 +3227,11 @@ BlockDriver bdrv_file = {
     .bdrv_co_pdiscard       = raw_co_pdiscard,
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
+    .bdrv_co_sendfile       = raw_co_sendfile,
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate = raw_co_truncate,
@@ -3532,6 +3650,7 @@ static BlockDriver bdrv_host_device = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate       = raw_co_truncate,
@@ -3656,6 +3775,7 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate    = raw_co_truncate,
@@ -3788,6 +3908,7 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate    = raw_co_truncate,
@@ -3285,6 +3285,43 @@ int coroutine_fn bdrv_co_copy_range(BdrvChild *src, uint64_t src_offset,
                                    bytes, read_flags, write_flags);
 }
 
+int coroutine_fn bdrv_co_sendfile(BdrvChild *child, int64_t offset,
+                                  unsigned int bytes, int out_fd,
+                                  QEMUIOVector *hdr)
+{
+    BlockDriverState *bs = child->bs;
+    BlockDriver *drv = bs->drv;
+    BdrvTrackedRequest req;
+    int ret;
+
+    trace_bdrv_co_sendfile(bs, offset, bytes, out_fd);
+
+    if (!drv) {
+        return -ENOMEDIUM;
+    }
+    ret = bdrv_check_byte_request(bs, offset, bytes);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* Copy-on-read needs the data in a buffer to write it back */
+    if (!drv->bdrv_co_sendfile || bs->encrypted ||
+        atomic_read(&bs->copy_on_read)) {
+        return -ENOTSUP;
+    }
+
+    bdrv_inc_in_flight(bs);
+    tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_READ);
+    bdrv_wait_serialising_requests(&req);
+
+    ret = drv->bdrv_co_sendfile(bs, offset, bytes, out_fd, hdr);
+
+    tracked_request_end(&req);
+    bdrv_dec_in_flight(bs);
+
+    return ret;
+}
+
 static void bdrv_parent_cb_resize(BlockDriverState *bs)
 {
     BdrvChild *c;
@@ -22,6 +22,9 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Number of slots in the registered file table */
+#define MAX_FIXED_FILES 64
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -56,6 +59,14 @@ typedef struct LuringState {
 
     /* I/O completion processing.  Only runs in I/O thread.  */
     QEMUBH *completion_bh;
+
+    /*
+     * Registered file table.  Submitting with IOSQE_FIXED_FILE saves the
+     * kernel an fd table lookup and file reference per request.  Unused
+     * slots hold -1.  Protected by AioContext lock.
+     */
+    bool fixed_files;
+    int fixed_fds[MAX_FIXED_FILES];
 } LuringState;
 
 /**
@@ -312,6 +323,67 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
     }
 }
 
+/**
+ * luring_fixed_file:
+ * @s: AIO state
+ * @fd: file descriptor for I/O
+ *
+ * Returns the index of @fd in the registered file table, registering it in
+ * a free slot if needed, or -1 if @fd cannot be used as a fixed file.
+ */
+static int luring_fixed_file(LuringState *s, int fd)
+{
+    int i, free_slot = -1;
+
+    if (!s->fixed_files) {
+        return -1;
+    }
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_fds[i] == fd) {
+            return i;
+        }
+        if (free_slot < 0 && s->fixed_fds[i] == -1) {
+            free_slot = i;
+        }
+    }
+
+    if (free_slot < 0 ||
+        io_uring_register_files_update(&s->ring, free_slot, &fd, 1) != 1) {
+        return -1;
+    }
+
+    trace_luring_register_fd(s, fd, free_slot);
+    s->fixed_fds[free_slot] = fd;
+    return free_slot;
+}
+
+/**
+ * luring_unregister_fd:
+ * @s: AIO state
+ * @fd: file descriptor
+ *
+ * Drop @fd from the registered file table.  This must be called before @fd
+ * is closed or stops being used with @s, otherwise the slot would keep
+ * referring to the old file even after the descriptor number is reused.
+ * The caller must ensure that no requests on @fd are pending.
+ */
+void luring_unregister_fd(LuringState *s, int fd)
+{
+    int i;
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_fds[i] == fd) {
+            int unused = -1;
+
+            trace_luring_unregister_fd(s, fd, i);
+            io_uring_register_files_update(&s->ring, i, &unused, 1);
+            s->fixed_fds[i] = -1;
+            return;
+        }
+    }
+}
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
@@ -328,6 +400,11 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
+    int fixed_idx = luring_fixed_file(s, fd);
+
+    if (fixed_idx >= 0) {
+        fd = fixed_idx;
+    }
 
     switch (type) {
     case QEMU_AIO_WRITE:
@@ -346,6 +423,9 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+    if (fixed_idx >= 0) {
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -402,7 +482,7 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_completion_cb, NULL, qemu_luring_poll_cb, s);
 }
 
-LuringState *luring_init(Error **errp)
+LuringState *luring_init(AioContext *ctx, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
@@ -410,14 +490,22 @@ LuringState *luring_init(Error **errp)
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    rc = aio_io_uring_queue_init(ctx, MAX_ENTRIES, ring);
     if (rc < 0) {
-        error_setg_errno(errp, errno, "failed to init linux io_uring ring");
+        error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
         g_free(s);
         return NULL;
     }
 
     ioq_init(&s->io_q);
+
+    /*
+     * Start with an empty (sparse) file table that luring_fixed_file() fills
+     * in on demand.  Kernels that do not support this just use plain fds.
+     */
+    memset(s->fixed_fds, -1, sizeof(s->fixed_fds));
+    s->fixed_files = io_uring_register_files(ring, s->fixed_fds,
+                                             MAX_FIXED_FILES) == 0;
     return s;
 
 }
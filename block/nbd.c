@@ -45,6 +45,7 @@
 
 #define EN_OPTSTR ":exportname="
 #define MAX_NBD_REQUESTS    16
+#define MAX_NBD_CONNECTIONS 16
 
 #define HANDLE_TO_INDEX(bs, handle) ((handle) ^ (uint64_t)(intptr_t)(bs))
 #define INDEX_TO_HANDLE(bs, index)  ((index)  ^ (uint64_t)(intptr_t)(bs))
@@ -91,9 +92,34 @@ typedef struct BDRVNBDState {
     QCryptoTLSCreds *tlscreds;
     const char *hostname;
     char *x_dirty_bitmap;
+
+    /*
+     * With multi-conn, bs->opaque is the primary connection, which owns the
+     * connection parameters above.  Its conns[] array lists all connections
+     * (including itself at index 0); the other connections borrow the
+     * parameters and have conns == NULL.
+     */
+    uint32_t connections;
+    struct BDRVNBDState **conns;
+    int num_conns;
+    unsigned int next_conn;
 } BDRVNBDState;
 
-static int nbd_client_connect(BlockDriverState *bs, Error **errp);
+static int nbd_client_connect(BDRVNBDState *s, Error **errp);
+
+#define NBD_FOREACH_CONN(c, s, i) \
+    for (i = 0; i < (s)->num_conns && ((c) = (s)->conns[i]); i++)
+
+/* Pick the connection for the next request, spreading them round-robin */
+static BDRVNBDState *nbd_get_conn(BlockDriverState *bs)
+{
+    BDRVNBDState *s = bs->opaque;
+
+    if (s->num_conns <= 1) {
+        return s;
+    }
+    return s->conns[s->next_conn++ % s->num_conns];
+}
 
 static void nbd_clear_bdrvstate(BDRVNBDState *s)
 {
@@ -106,6 +132,9 @@ static void nbd_clear_bdrvstate(BDRVNBDState *s)
     s->tlscredsid = NULL;
     g_free(s->x_dirty_bitmap);
     s->x_dirty_bitmap = NULL;
+    g_free(s->conns);
+    s->conns = NULL;
+    s->num_conns = 0;
 }
 
 static void nbd_channel_error(BDRVNBDState *s, int ret)
@@ -136,17 +165,26 @@ static void nbd_recv_coroutines_wake_all(BDRVNBDState *s)
     }
 }
 
+static void nbd_conn_detach_aio_context(BDRVNBDState *s)
+{
+    qio_channel_detach_aio_context(QIO_CHANNEL(s->ioc));
+}
+
 static void nbd_client_detach_aio_context(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *c;
+    int i;
 
-    qio_channel_detach_aio_context(QIO_CHANNEL(s->ioc));
+    NBD_FOREACH_CONN(c, s, i) {
+        nbd_conn_detach_aio_context(c);
+    }
 }
 
 static void nbd_client_attach_aio_context_bh(void *opaque)
 {
-    BlockDriverState *bs = opaque;
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = opaque;
+    BlockDriverState *bs = s->bs;
 
     /*
      * The node is still drained, so we know the coroutine has yielded in
@@ -158,10 +196,10 @@ static void nbd_client_attach_aio_context_bh(void *opaque)
     bdrv_dec_in_flight(bs);
 }
 
-static void nbd_client_attach_aio_context(BlockDriverState *bs,
-                                          AioContext *new_context)
+static void nbd_conn_attach_aio_context(BDRVNBDState *s,
+                                        AioContext *new_context)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BlockDriverState *bs = s->bs;
 
     /*
      * s->connection_co is either yielded from nbd_receive_reply or from
@@ -177,34 +215,54 @@ static void nbd_client_attach_aio_context(BlockDriverState *bs,
      * Need to wait here for the BH to run because the BH must run while the
      * node is still drained.
      */
-    aio_wait_bh_oneshot(new_context, nbd_client_attach_aio_context_bh, bs);
+    aio_wait_bh_oneshot(new_context, nbd_client_attach_aio_context_bh, s);
+}
+
+static void nbd_client_attach_aio_context(BlockDriverState *bs,
+                                          AioContext *new_context)
+{
+    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *c;
+    int i;
+
+    NBD_FOREACH_CONN(c, s, i) {
+        nbd_conn_attach_aio_context(c, new_context);
+    }
 }
 
 static void coroutine_fn nbd_client_co_drain_begin(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *c;
+    int i;
 
-    s->drained = true;
-    if (s->connection_co_sleep_ns_state) {
-        qemu_co_sleep_wake(s->connection_co_sleep_ns_state);
+    NBD_FOREACH_CONN(c, s, i) {
+        c->drained = true;
+        if (c->connection_co_sleep_ns_state) {
+            qemu_co_sleep_wake(c->connection_co_sleep_ns_state);
+        }
     }
 }
 
 static void coroutine_fn nbd_client_co_drain_end(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *c;
+    int i;
 
-    s->drained = false;
-    if (s->wait_drained_end) {
-        s->wait_drained_end = false;
-        aio_co_wake(s->connection_co);
+    NBD_FOREACH_CONN(c, s, i) {
+        c->drained = false;
+        if (c->wait_drained_end) {
+            c->wait_drained_end = false;
+            aio_co_wake(c->connection_co);
+        }
     }
 }
 
 
-static void nbd_teardown_connection(BlockDriverState *bs)
+static void nbd_teardown_connection(BDRVNBDState *s)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BlockDriverState *bs = s->bs;
 
     if (s->state == NBD_CLIENT_CONNECTED) {
         /* finish any pending coroutines */
@@ -273,14 +331,14 @@ static coroutine_fn void nbd_reconnect_attempt(BDRVNBDState *s)
 
     /* Finalize previous connection if any */
     if (s->ioc) {
-        nbd_client_detach_aio_context(s->bs);
+        nbd_conn_detach_aio_context(s);
         object_unref(OBJECT(s->sioc));
         s->sioc = NULL;
         object_unref(OBJECT(s->ioc));
         s->ioc = NULL;
     }
 
-    s->connect_status = nbd_client_connect(s->bs, &local_err);
+    s->connect_status = nbd_client_connect(s, &local_err);
     error_free(s->connect_err);
     s->connect_err = NULL;
     error_propagate(&s->connect_err, local_err);
@@ -410,7 +468,7 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
 
     s->connection_co = NULL;
     if (s->ioc) {
-        nbd_client_detach_aio_context(s->bs);
+        nbd_conn_detach_aio_context(s);
         object_unref(OBJECT(s->sioc));
         s->sioc = NULL;
         object_unref(OBJECT(s->ioc));
@@ -423,11 +481,10 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
     aio_wait_kick();
 }
 
-static int nbd_co_send_request(BlockDriverState *bs,
+static int nbd_co_send_request(BDRVNBDState *s,
                                NBDRequest *request,
                                QEMUIOVector *qiov)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     int rc, i = -1;
 
     qemu_co_mutex_lock(&s->send_mutex);
@@ -1123,12 +1180,11 @@ static int nbd_co_receive_blockstatus_reply(BDRVNBDState *s,
     return iter.ret;
 }
 
-static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
+static int nbd_co_request(BDRVNBDState *s, NBDRequest *request,
                           QEMUIOVector *write_qiov)
 {
     int ret, request_ret;
     Error *local_err = NULL;
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
 
     assert(request->type != NBD_CMD_READ);
     if (write_qiov) {
@@ -1139,7 +1195,7 @@ static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
     }
 
     do {
-        ret = nbd_co_send_request(bs, request, write_qiov);
+        ret = nbd_co_send_request(s, request, write_qiov);
         if (ret < 0) {
             continue;
         }
@@ -1165,7 +1221,7 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
 {
     int ret, request_ret;
     Error *local_err = NULL;
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = nbd_get_conn(bs);
     NBDRequest request = {
         .type = NBD_CMD_READ,
         .from = offset,
@@ -1198,7 +1254,7 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
     }
 
     do {
-        ret = nbd_co_send_request(bs, &request, NULL);
+        ret = nbd_co_send_request(s, &request, NULL);
         if (ret < 0) {
             continue;
         }
@@ -1221,7 +1277,7 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
 static int nbd_client_co_pwritev(BlockDriverState *bs, uint64_t offset,
                                  uint64_t bytes, QEMUIOVector *qiov, int flags)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = nbd_get_conn(bs);
     NBDRequest request = {
         .type = NBD_CMD_WRITE,
         .from = offset,
@@ -1239,13 +1295,13 @@ static int nbd_client_co_pwritev(BlockDriverState *bs, uint64_t offset,
     if (!bytes) {
         return 0;
     }
-    return nbd_co_request(bs, &request, qiov);
+    return nbd_co_request(s, &request, qiov);
 }
 
 static int nbd_client_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
                                        int bytes, BdrvRequestFlags flags)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = nbd_get_conn(bs);
     NBDRequest request = {
         .type = NBD_CMD_WRITE_ZEROES,
         .from = offset,
@@ -1272,28 +1328,39 @@ static int nbd_client_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
     if (!bytes) {
         return 0;
     }
-    return nbd_co_request(bs, &request, NULL);
+    return nbd_co_request(s, &request, NULL);
 }
 
 static int nbd_client_co_flush(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
-    NBDRequest request = { .type = NBD_CMD_FLUSH };
+    BDRVNBDState *c;
+    int i, ret = 0;
 
     if (!(s->info.flags & NBD_FLAG_SEND_FLUSH)) {
         return 0;
     }
 
-    request.from = 0;
-    request.len = 0;
+    /*
+     * Flush every connection, so that writes completed on any of them are
+     * stable no matter how the server implements multi-conn consistency.
+     */
+    NBD_FOREACH_CONN(c, s, i) {
+        NBDRequest request = { .type = NBD_CMD_FLUSH };
+        int r = nbd_co_request(c, &request, NULL);
 
-    return nbd_co_request(bs, &request, NULL);
+        if (r < 0 && ret == 0) {
+            ret = r;
+        }
+    }
+
+    return ret;
 }
 
 static int nbd_client_co_pdiscard(BlockDriverState *bs, int64_t offset,
                                   int bytes)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = nbd_get_conn(bs);
     NBDRequest request = {
         .type = NBD_CMD_TRIM,
         .from = offset,
@@ -1305,7 +1372,7 @@ static int nbd_client_co_pdiscard(BlockDriverState *bs, int64_t offset,
         return 0;
     }
 
-    return nbd_co_request(bs, &request, NULL);
+    return nbd_co_request(s, &request, NULL);
 }
 
 static int coroutine_fn nbd_client_co_block_status(
@@ -1314,7 +1381,7 @@ static int coroutine_fn nbd_client_co_block_status(
 {
     int ret, request_ret;
     NBDExtent extent = { 0 };
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = nbd_get_conn(bs);
     Error *local_err = NULL;
 
     NBDRequest request = {
@@ -1350,7 +1417,7 @@ static int coroutine_fn nbd_client_co_block_status(
         assert(QEMU_IS_ALIGNED(request.len, s->info.min_block));
     }
     do {
-        ret = nbd_co_send_request(bs, &request, NULL);
+        ret = nbd_co_send_request(s, &request, NULL);
         if (ret < 0) {
             continue;
         }
@@ -1393,16 +1460,31 @@ static int nbd_client_reopen_prepare(BDRVReopenState *state,
     return 0;
 }
 
-static void nbd_client_close(BlockDriverState *bs)
+static void nbd_conn_close(BDRVNBDState *s)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     NBDRequest request = { .type = NBD_CMD_DISC };
 
     if (s->ioc) {
         nbd_send_request(s->ioc, &request);
     }
 
-    nbd_teardown_connection(bs);
+    nbd_teardown_connection(s);
+}
+
+static void nbd_client_close(BlockDriverState *bs)
+{
+    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
+
+    /* Secondary connections first, they borrow the primary's parameters */
+    for (i = s->num_conns - 1; i > 0; i--) {
+        nbd_conn_close(s->conns[i]);
+        error_free(s->conns[i]->connect_err);
+        g_free(s->conns[i]);
+    }
+    s->num_conns = MIN(s->num_conns, 1);
+
+    nbd_conn_close(s);
 }
 
 static QIOChannelSocket *nbd_establish_connection(SocketAddress *saddr,
@@ -1426,9 +1508,9 @@ static QIOChannelSocket *nbd_establish_connection(SocketAddress *saddr,
     return sioc;
 }
 
-static int nbd_client_connect(BlockDriverState *bs, Error **errp)
+static int nbd_client_connect(BDRVNBDState *s, Error **errp)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BlockDriverState *bs = s->bs;
     AioContext *aio_context = bdrv_get_aio_context(bs);
     int ret;
 
@@ -1466,6 +1548,22 @@ static int nbd_client_connect(BlockDriverState *bs, Error **errp)
         ret = -EINVAL;
         goto fail;
     }
+    if (s != bs->opaque) {
+        /*
+         * Secondary connections, whether new or reconnecting, must see the
+         * same export as the primary or requests spread over them would
+         * not be consistent.
+         */
+        BDRVNBDState *primary = bs->opaque;
+
+        if (s->info.size != primary->info.size ||
+            s->info.flags != primary->info.flags ||
+            s->info.base_allocation != primary->info.base_allocation) {
+            error_setg(errp, "Server export changed between connections");
+            ret = -EINVAL;
+            goto fail;
+        }
+    }
     if (s->info.flags & NBD_FLAG_READ_ONLY) {
         ret = bdrv_apply_auto_read_only(bs, "NBD export is read-only", errp);
         if (ret < 0) {
@@ -1816,6 +1914,12 @@ static QemuOptsList nbd_runtime_opts = {
             .help = "experimental: expose named dirty bitmap in place of "
                     "block status",
         },
+        {
+            .name = "connections",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of connections to open to the server if it "
+                    "supports multi-conn. Default 1",
+        },
         {
             .name = "reconnect-delay",
             .type = QEMU_OPT_NUMBER,
@@ -1837,6 +1941,7 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
     BDRVNBDState *s = bs->opaque;
     QemuOpts *opts;
     Error *local_err = NULL;
+    uint64_t connections;
     int ret = -EINVAL;
 
     opts = qemu_opts_create(&nbd_runtime_opts, NULL, 0, &error_abort);
@@ -1886,6 +1991,14 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
 
     s->reconnect_delay = qemu_opt_get_number(opts, "reconnect-delay", 0);
 
+    connections = qemu_opt_get_number(opts, "connections", 1);
+    if (connections < 1 || connections > MAX_NBD_CONNECTIONS) {
+        error_setg(errp, "connections must be between 1 and %d",
+                   MAX_NBD_CONNECTIONS);
+        goto error;
+    }
+    s->connections = connections;
+
     ret = 0;
 
  error:
@@ -1896,6 +2009,56 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
     return ret;
 }
 
+static void nbd_conn_start(BDRVNBDState *s)
+{
+    /* successfully connected */
+    s->state = NBD_CLIENT_CONNECTED;
+
+    s->connection_co = qemu_coroutine_create(nbd_connection_entry, s);
+    bdrv_inc_in_flight(s->bs);
+    aio_co_schedule(bdrv_get_aio_context(s->bs), s->connection_co);
+}
+
+/*
+ * Open the additional connections requested with the connections option.
+ * They are only used if the server guarantees consistency between
+ * connections, i.e. advertises NBD_FLAG_CAN_MULTI_CONN.
+ */
+static int nbd_open_secondary_connections(BDRVNBDState *s, Error **errp)
+{
+    int ret;
+
+    if (s->connections > 1 && !(s->info.flags & NBD_FLAG_CAN_MULTI_CONN)) {
+        trace_nbd_client_no_multi_conn(s->export, s->connections);
+        return 0;
+    }
+
+    while (s->num_conns < s->connections) {
+        BDRVNBDState *c = g_new0(BDRVNBDState, 1);
+
+        c->bs = s->bs;
+        c->reconnect_delay = s->reconnect_delay;
+        c->saddr = s->saddr;
+        c->export = s->export;
+        c->tlscreds = s->tlscreds;
+        c->hostname = s->hostname;
+        c->x_dirty_bitmap = s->x_dirty_bitmap;
+        qemu_co_mutex_init(&c->send_mutex);
+        qemu_co_queue_init(&c->free_sema);
+
+        ret = nbd_client_connect(c, errp);
+        if (ret < 0) {
+            g_free(c);
+            return ret;
+        }
+
+        s->conns[s->num_conns++] = c;
+        nbd_conn_start(c);
+    }
+
+    return 0;
+}
+
 static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
                     Error **errp)
 {
@@ -1911,17 +2074,23 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
     qemu_co_mutex_init(&s->send_mutex);
     qemu_co_queue_init(&s->free_sema);
 
-    ret = nbd_client_connect(bs, errp);
+    s->conns = g_new0(BDRVNBDState *, s->connections);
+    s->conns[0] = s;
+    s->num_conns = 1;
+
+    ret = nbd_client_connect(s, errp);
     if (ret < 0) {
         nbd_clear_bdrvstate(s);
         return ret;
     }
-    /* successfully connected */
-    s->state = NBD_CLIENT_CONNECTED;
+    nbd_conn_start(s);
 
-    s->connection_co = qemu_coroutine_create(nbd_connection_entry, s);
-    bdrv_inc_in_flight(bs);
-    aio_co_schedule(bdrv_get_aio_context(bs), s->connection_co);
+    ret = nbd_open_secondary_connections(s, errp);
+    if (ret < 0) {
+        nbd_client_close(bs);
+        nbd_clear_bdrvstate(s);
+        return ret;
+    }
 
     return 0;
 }
@@ -2032,6 +2201,7 @@ static const char *const nbd_strong_runtime_opts[] = {
     "export",
     "tls-creds",
     "server.",
+    "connections",
 
     NULL
 };
@@ -31,6 +31,10 @@
 #define NVME_SQ_ENTRY_BYTES 64
 #define NVME_CQ_ENTRY_BYTES 16
 #define NVME_QUEUE_SIZE 128
+/* Command identifiers are 16 bits wide and 0 is not used */
+#define NVME_MAX_QUEUE_SIZE 0xFFFF
+/* Queue identifiers are 16 bits wide and 0 is the admin queue */
+#define NVME_MAX_IO_QUEUES 0xFFFF
 #define NVME_BAR_SIZE 8192
 
 typedef struct {
@@ -44,6 +48,8 @@ typedef struct {
 typedef struct {
     BlockCompletionFunc *cb;
     void *opaque;
+    /* Where to store DW0 of the completion queue entry, or NULL */
+    uint32_t *result;
     int cid;
     void *prp_list_page;
     uint64_t prp_list_iova;
@@ -56,12 +62,13 @@ typedef struct {
 
     /* Fields protected by BQL */
     int         index;
+    int         size;
     uint8_t     *prp_list_pages;
 
     /* Fields protected by @lock */
     NVMeQueue   sq, cq;
     int         cq_phase;
-    NVMeRequest reqs[NVME_QUEUE_SIZE];
+    NVMeRequest *reqs;
     bool        busy;
     int         need_kick;
     int         inflight;
@@ -99,9 +106,13 @@ typedef struct {
      */
     NVMeQueuePair **queues;
     int nr_queues;
+    /* I/O queue that was handed the last request, see nvme_get_io_queue() */
+    int last_io_queue;
     size_t page_size;
     /* How many uint32_t elements does each doorbell entry take. */
     size_t doorbell_scale;
+    /* Size of the mapping of BAR0, which must cover all doorbells */
+    size_t bar_size;
     bool write_cache_supported;
     EventNotifier irq_notifier;
 
@@ -127,6 +138,8 @@ typedef struct {
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_NUM_QUEUES "num-queues"
+#define NVME_BLOCK_OPT_QUEUE_SIZE "queue-size"
 
 static QemuOptsList runtime_opts = {
     .name = "nvme",
@@ -142,6 +155,16 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "NVMe namespace",
         },
+        {
+            .name = NVME_BLOCK_OPT_NUM_QUEUES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of I/O queue pairs (default: 1)",
+        },
+        {
+            .name = NVME_BLOCK_OPT_QUEUE_SIZE,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of entries in each I/O queue (default: 128)",
+        },
         { /* end of list */ }
     },
 };
@@ -173,6 +196,7 @@ static void nvme_free_queue_pair(BlockDriverState *bs, NVMeQueuePair *q)
     qemu_vfree(q->sq.queue);
     qemu_vfree(q->cq.queue);
     qemu_mutex_destroy(&q->lock);
+    g_free(q->reqs);
     g_free(q);
 }
 
@@ -199,15 +223,17 @@ static NVMeQueuePair *nvme_create_queue_pair(BlockDriverState *bs,
 
     qemu_mutex_init(&q->lock);
     q->index = idx;
+    q->size = size;
+    q->reqs = g_new0(NVMeRequest, size);
     qemu_co_queue_init(&q->free_req_queue);
-    q->prp_list_pages = qemu_blockalign0(bs, s->page_size * NVME_QUEUE_SIZE);
+    q->prp_list_pages = qemu_blockalign0(bs, s->page_size * size);
     r = qemu_vfio_dma_map(s->vfio, q->prp_list_pages,
-                          s->page_size * NVME_QUEUE_SIZE,
+                          s->page_size * size,
                           false, &prp_list_iova);
     if (r) {
         goto fail;
     }
-    for (i = 0; i < NVME_QUEUE_SIZE; i++) {
+    for (i = 0; i < size; i++) {
         NVMeRequest *req = &q->reqs[i];
         req->cid = i + 1;
         req->prp_list_page = q->prp_list_pages + i * s->page_size;
@@ -240,7 +266,7 @@ static void nvme_kick(BDRVNVMeState *s, NVMeQueuePair *q)
         return;
     }
     trace_nvme_kick(s, q->index);
-    assert(!(q->sq.tail & 0xFF00));
+    assert(q->sq.tail < q->size);
     /* Fence the write to submission queue entry before notifying the device. */
     smp_wmb();
     *q->sq.doorbell = cpu_to_le32(q->sq.tail);
@@ -258,7 +284,7 @@ static NVMeRequest *nvme_get_free_req(NVMeQueuePair *q)
     NVMeRequest *req = NULL;
 
     qemu_mutex_lock(&q->lock);
-    while (q->inflight + q->need_kick > NVME_QUEUE_SIZE - 2) {
+    while (q->inflight + q->need_kick > q->size - 2) {
         /* We have to leave one slot empty as that is the full queue case (head
          * == tail + 1). */
         if (qemu_in_coroutine()) {
@@ -269,7 +295,7 @@ static NVMeRequest *nvme_get_free_req(NVMeQueuePair *q)
             return NULL;
         }
     }
-    for (i = 0; i < NVME_QUEUE_SIZE; i++) {
+    for (i = 0; i < q->size; i++) {
         if (!q->reqs[i].busy) {
             q->reqs[i].busy = true;
             req = &q->reqs[i];
@@ -321,29 +347,33 @@ static bool nvme_process_completion(BDRVNVMeState *s, NVMeQueuePair *q)
     q->busy = true;
     assert(q->inflight >= 0);
     while (q->inflight) {
-        int16_t cid;
+        uint16_t cid;
         c = (NvmeCqe *)&q->cq.queue[q->cq.head * NVME_CQ_ENTRY_BYTES];
         if ((le16_to_cpu(c->status) & 0x1) == q->cq_phase) {
             break;
         }
-        q->cq.head = (q->cq.head + 1) % NVME_QUEUE_SIZE;
+        q->cq.head = (q->cq.head + 1) % q->size;
         if (!q->cq.head) {
             q->cq_phase = !q->cq_phase;
         }
         cid = le16_to_cpu(c->cid);
-        if (cid == 0 || cid > NVME_QUEUE_SIZE) {
+        if (cid == 0 || cid > q->size) {
             fprintf(stderr, "Unexpected CID in completion queue: %" PRIu32 "\n",
                     cid);
             continue;
         }
-        assert(cid <= NVME_QUEUE_SIZE);
+        assert(cid <= q->size);
         trace_nvme_complete_command(s, q->index, cid);
         preq = &q->reqs[cid - 1];
         req = *preq;
         assert(req.cid == cid);
         assert(req.cb);
+        if (req.result) {
+            *req.result = le32_to_cpu(c->result);
+        }
         preq->busy = false;
         preq->cb = preq->opaque = NULL;
+        preq->result = NULL;
         qemu_mutex_unlock(&q->lock);
         req.cb(req.opaque, nvme_translate_error(c));
         qemu_mutex_lock(&q->lock);
@@ -389,7 +419,7 @@ static void nvme_submit_command(BDRVNVMeState *s, NVMeQueuePair *q,
     qemu_mutex_lock(&q->lock);
     memcpy((uint8_t *)q->sq.queue +
            q->sq.tail * NVME_SQ_ENTRY_BYTES, cmd, sizeof(*cmd));
-    q->sq.tail = (q->sq.tail + 1) % NVME_QUEUE_SIZE;
+    q->sq.tail = (q->sq.tail + 1) % q->size;
     q->need_kick++;
     nvme_kick(s, q);
     nvme_process_completion(s, q);
@@ -403,8 +433,9 @@ static void nvme_cmd_sync_cb(void *opaque, int ret)
     aio_wait_kick();
 }
 
+/* If @result is not NULL, DW0 of the completion is stored there. */
 static int nvme_cmd_sync(BlockDriverState *bs, NVMeQueuePair *q,
-                         NvmeCmd *cmd)
+                         NvmeCmd *cmd, uint32_t *result)
 {
     NVMeRequest *req;
     BDRVNVMeState *s = bs->opaque;
@@ -413,6 +444,7 @@ static int nvme_cmd_sync(BlockDriverState *bs, NVMeQueuePair *q,
     if (!req) {
         return -EBUSY;
     }
+    req->result = result;
     nvme_submit_command(s, q, req, cmd, nvme_cmd_sync_cb, &ret);
 
     BDRV_POLL_WHILE(bs, ret == -EINPROGRESS);
@@ -448,7 +480,7 @@ static void nvme_identify(BlockDriverState *bs, int namespace, Error **errp)
     }
     cmd.prp1 = cpu_to_le64(iova);
 
-    if (nvme_cmd_sync(bs, s->queues[0], &cmd)) {
+    if (nvme_cmd_sync(bs, s->queues[0], &cmd, NULL)) {
         error_setg(errp, "Failed to identify controller");
         goto out;
     }
@@ -472,7 +504,7 @@ static void nvme_identify(BlockDriverState *bs, int namespace, Error **errp)
 
     cmd.cdw10 = 0;
     cmd.nsid = cpu_to_le32(namespace);
-    if (nvme_cmd_sync(bs, s->queues[0], &cmd)) {
+    if (nvme_cmd_sync(bs, s->queues[0], &cmd, NULL)) {
         error_setg(errp, "Failed to identify namespace");
         goto out;
     }
@@ -531,13 +563,13 @@ static void nvme_handle_event(EventNotifier *n)
     nvme_poll_queues(s);
 }
 
-static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
+static bool nvme_add_io_queue(BlockDriverState *bs, int queue_size,
+                              Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     int n = s->nr_queues;
     NVMeQueuePair *q;
     NvmeCmd cmd;
-    int queue_size = NVME_QUEUE_SIZE;
 
     q = nvme_create_queue_pair(bs, n, queue_size, errp);
     if (!q) {
@@ -549,7 +581,7 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
         .cdw10 = cpu_to_le32(((queue_size - 1) << 16) | (n & 0xFFFF)),
         .cdw11 = cpu_to_le32(0x3),
     };
-    if (nvme_cmd_sync(bs, s->queues[0], &cmd)) {
+    if (nvme_cmd_sync(bs, s->queues[0], &cmd, NULL)) {
         error_setg(errp, "Failed to create io queue [%d]", n);
         nvme_free_queue_pair(bs, q);
         return false;
@@ -560,7 +592,7 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
         .cdw10 = cpu_to_le32(((queue_size - 1) << 16) | (n & 0xFFFF)),
         .cdw11 = cpu_to_le32(0x1 | (n << 16)),
     };
-    if (nvme_cmd_sync(bs, s->queues[0], &cmd)) {
+    if (nvme_cmd_sync(bs, s->queues[0], &cmd, NULL)) {
         error_setg(errp, "Failed to create io queue [%d]", n);
         nvme_free_queue_pair(bs, q);
         return false;
@@ -571,6 +603,48 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
     return true;
 }
 
+/*
+ * Request @num_queues I/O queue pairs from the controller.  Returns the
+ * number of queue pairs it granted, which may be less, or 0 on error.
+ */
+static int nvme_set_num_queues(BlockDriverState *bs, int num_queues,
+                               Error **errp)
+{
+    BDRVNVMeState *s = bs->opaque;
+    uint32_t result;
+    int granted;
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(NVME_NUMBER_OF_QUEUES),
+        .cdw11 = cpu_to_le32(((num_queues - 1) << 16) | (num_queues - 1)),
+    };
+
+    if (nvme_cmd_sync(bs, s->queues[0], &cmd, &result)) {
+        error_setg(errp, "Failed to allocate %d io queues", num_queues);
+        return 0;
+    }
+
+    /* NSQA and NCQA are 0's based, and may exceed the request */
+    granted = MIN(result & 0xFFFF, result >> 16) + 1;
+    granted = MIN(granted, num_queues);
+    trace_nvme_set_num_queues(s, num_queues, granted);
+    return granted;
+}
+
+/*
+ * Pick the I/O queue pair for a new request.  Requests are spread
+ * round-robin so that each queue pair, with its own lock, doorbell and
+ * request slots, carries an even share of the load.
+ */
+static NVMeQueuePair *nvme_get_io_queue(BDRVNVMeState *s)
+{
+    int nr_io_queues = s->nr_queues - 1;
+
+    assert(nr_io_queues > 0);
+    s->last_io_queue = (s->last_io_queue + 1) % nr_io_queues;
+    return s->queues[1 + s->last_io_queue];
+}
+
 static bool nvme_poll_cb(void *opaque)
 {
     EventNotifier *e = opaque;
@@ -581,12 +655,14 @@ static bool nvme_poll_cb(void *opaque)
 }
 
 static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
-                     Error **errp)
+                     int num_queues, int queue_size, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     int ret;
+    int i;
     uint64_t cap;
     uint64_t timeout_ms;
+    size_t bar_size;
     uint64_t deadline, now;
     Error *local_err = NULL;
 
@@ -607,7 +683,8 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
         goto out;
     }
 
-    s->regs = qemu_vfio_pci_map_bar(s->vfio, 0, 0, NVME_BAR_SIZE, errp);
+    s->bar_size = NVME_BAR_SIZE;
+    s->regs = qemu_vfio_pci_map_bar(s->vfio, 0, 0, s->bar_size, errp);
     if (!s->regs) {
         ret = -EINVAL;
         goto out;
@@ -623,8 +700,35 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
         goto out;
     }
 
+    /* CAP.MQES is 0's based */
+    if (queue_size > (cap & 0xFFFF) + 1) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_QUEUE_SIZE "' is too large, "
+                   "the device supports at most %" PRIu64 " entries",
+                   (cap & 0xFFFF) + 1);
+        ret = -EINVAL;
+        goto out;
+    }
+
     s->page_size = MAX(4096, 1 << (12 + ((cap >> 48) & 0xF)));
     s->doorbell_scale = (4 << (((cap >> 32) & 0xF))) / sizeof(uint32_t);
+
+    /* Each queue pair, the admin queue included, has two doorbells.  */
+    bar_size = ROUND_UP(offsetof(NVMeRegs, doorbells) +
+                        (num_queues + 1) * 2 * s->doorbell_scale *
+                        sizeof(uint32_t), qemu_real_host_page_size);
+    if (bar_size > s->bar_size) {
+        qemu_vfio_pci_unmap_bar(s->vfio, 0, (void *)s->regs, 0, s->bar_size);
+        s->bar_size = bar_size;
+        s->regs = qemu_vfio_pci_map_bar(s->vfio, 0, 0, s->bar_size,
+                                        &local_err);
+        if (!s->regs) {
+            error_propagate_prepend(errp, local_err,
+                                    "Cannot map the doorbells of %d queues: ",
+                                    num_queues);
+            ret = -EINVAL;
+            goto out;
+        }
+    }
     bs->bl.opt_mem_alignment = s->page_size;
     timeout_ms = MIN(500 * ((cap >> 24) & 0xFF), 30000);
 
@@ -688,8 +792,16 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     }
 
     /* Set up command queues. */
-    if (!nvme_add_io_queue(bs, errp)) {
+    num_queues = nvme_set_num_queues(bs, num_queues, errp);
+    if (!num_queues) {
         ret = -EIO;
+        goto out;
+    }
+    for (i = 0; i < num_queues; i++) {
+        if (!nvme_add_io_queue(bs, queue_size, errp)) {
+            ret = -EIO;
+            goto out;
+        }
     }
 out:
     /* Cleaning up is done in nvme_file_open() upon error. */
@@ -744,7 +856,7 @@ static int nvme_enable_disable_write_cache(BlockDriverState *bs, bool enable,
         .cdw11 = cpu_to_le32(enable ? 0x01 : 0x00),
     };
 
-    ret = nvme_cmd_sync(bs, s->queues[0], &cmd);
+    ret = nvme_cmd_sync(bs, s->queues[0], &cmd, NULL);
     if (ret) {
         error_setg(errp, "Failed to configure NVMe write cache");
     }
@@ -763,7 +875,7 @@ static void nvme_close(BlockDriverState *bs)
     aio_set_event_notifier(bdrv_get_aio_context(bs), &s->irq_notifier,
                            false, NULL, NULL);
     event_notifier_cleanup(&s->irq_notifier);
-    qemu_vfio_pci_unmap_bar(s->vfio, 0, (void *)s->regs, 0, NVME_BAR_SIZE);
+    qemu_vfio_pci_unmap_bar(s->vfio, 0, (void *)s->regs, 0, s->bar_size);
     qemu_vfio_close(s->vfio);
 
     g_free(s->device);
@@ -775,6 +887,7 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     const char *device;
     QemuOpts *opts;
     int namespace;
+    uint64_t num_queues, queue_size;
     int ret;
     BDRVNVMeState *s = bs->opaque;
 
@@ -790,7 +903,25 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
-    ret = nvme_init(bs, device, namespace, errp);
+
+    num_queues = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NUM_QUEUES, 1);
+    if (num_queues < 1 || num_queues > NVME_MAX_IO_QUEUES) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_NUM_QUEUES "' must be between "
+                   "1 and %d", NVME_MAX_IO_QUEUES);
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+
+    queue_size = qemu_opt_get_number(opts, NVME_BLOCK_OPT_QUEUE_SIZE,
+                                     NVME_QUEUE_SIZE);
+    if (queue_size < 2 || queue_size > NVME_MAX_QUEUE_SIZE) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_QUEUE_SIZE "' must be between "
+                   "2 and %d", NVME_MAX_QUEUE_SIZE);
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+
+    ret = nvme_init(bs, device, namespace, num_queues, queue_size, errp);
     qemu_opts_del(opts);
     if (ret) {
         goto fail;
@@ -961,7 +1092,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[1];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
 
     uint32_t cdw12 = (((bytes >> s->blkshift) - 1) & 0xFFFF) |
@@ -1076,7 +1207,7 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[1];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
@@ -1107,7 +1238,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
                                               BdrvRequestFlags flags)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[1];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
 
     uint32_t cdw12 = ((bytes >> s->blkshift) - 1) & 0xFFFF;
@@ -1160,7 +1291,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
                                          int bytes)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[1];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     NvmeDsmRange *buf;
     QEMUIOVector local_qiov;
@@ -1322,6 +1453,8 @@ static void nvme_unregister_buf(BlockDriverState *bs, void *host)
 static const char *const nvme_strong_runtime_opts[] = {
     NVME_BLOCK_OPT_DEVICE,
     NVME_BLOCK_OPT_NAMESPACE,
+    NVME_BLOCK_OPT_NUM_QUEUES,
+    NVME_BLOCK_OPT_QUEUE_SIZE,
 
     NULL
 };
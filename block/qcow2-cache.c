@@ -23,6 +23,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/xxhash.h"
 #include "qcow2.h"
 #include "trace.h"
 
@@ -42,6 +43,17 @@ struct Qcow2Cache {
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+
+    /*
+     * Hash index from table offset to entry, so that lookups do not need
+     * to scan the whole cache.  hash_head has hash_mask + 1 buckets, each
+     * holding the index of the first entry in the chain (or -1), and
+     * hash_next links the entries of a chain together.  Only entries with
+     * a non-zero offset are in the index.
+     */
+    int                    *hash_head;
+    int                    *hash_next;
+    uint32_t                hash_mask;
 };
 
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
@@ -57,6 +69,58 @@ static inline int qcow2_cache_get_table_idx(Qcow2Cache *c, void *table)
     return idx;
 }
 
+static inline uint32_t qcow2_cache_hash(Qcow2Cache *c, uint64_t offset)
+{
+    return qemu_xxhash2(offset) & c->hash_mask;
+}
+
+static int qcow2_cache_hash_lookup(Qcow2Cache *c, uint64_t offset)
+{
+    int i;
+
+    for (i = c->hash_head[qcow2_cache_hash(c, offset)]; i >= 0;
+         i = c->hash_next[i]) {
+        if (c->entries[i].offset == offset) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Set the offset of entry @i, keeping the hash index up to date */
+static void qcow2_cache_set_offset(Qcow2Cache *c, int i, uint64_t offset)
+{
+    int *p;
+
+    if (c->entries[i].offset == offset) {
+        return;
+    }
+
+    if (c->entries[i].offset) {
+        p = &c->hash_head[qcow2_cache_hash(c, c->entries[i].offset)];
+        while (*p != i) {
+            assert(*p >= 0);
+            p = &c->hash_next[*p];
+        }
+        *p = c->hash_next[i];
+        c->hash_next[i] = -1;
+    }
+
+    c->entries[i].offset = offset;
+
+    if (offset) {
+        p = &c->hash_head[qcow2_cache_hash(c, offset)];
+        c->hash_next[i] = *p;
+        *p = i;
+    }
+}
+
+static void qcow2_cache_hash_reset(Qcow2Cache *c)
+{
+    memset(c->hash_head, -1, sizeof(int) * (c->hash_mask + 1));
+    memset(c->hash_next, -1, sizeof(int) * c->size);
+}
+
 static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
 {
     if (c == s->refcount_block_cache) {
@@ -104,7 +168,7 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
+            qcow2_cache_set_offset(c, i, 0);
             c->entries[i].lru_counter = 0;
             i++;
             to_clean++;
@@ -135,14 +199,21 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
     c->entries = g_try_new0(Qcow2CachedTable, num_tables);
     c->table_array = qemu_try_blockalign(bs->file->bs,
                                          (size_t) num_tables * c->table_size);
+    c->hash_mask = pow2ceil(num_tables) - 1;
+    c->hash_head = g_try_new(int, c->hash_mask + 1);
+    c->hash_next = g_try_new(int, num_tables);
 
-    if (!c->entries || !c->table_array) {
+    if (!c->entries || !c->table_array || !c->hash_head || !c->hash_next) {
         qemu_vfree(c->table_array);
         g_free(c->entries);
+        g_free(c->hash_head);
+        g_free(c->hash_next);
         g_free(c);
-        c = NULL;
+        return NULL;
     }
 
+    qcow2_cache_hash_reset(c);
+
     return c;
 }
 
@@ -156,6 +227,8 @@ int qcow2_cache_destroy(Qcow2Cache *c)
 
     qemu_vfree(c->table_array);
     g_free(c->entries);
+    g_free(c->hash_head);
+    g_free(c->hash_next);
     g_free(c);
 
     return 0;
@@ -309,6 +382,7 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
         c->entries[i].lru_counter = 0;
     }
 
+    qcow2_cache_hash_reset(c);
     qcow2_cache_table_release(c, 0, c->size);
 
     c->lru_counter = 0;
@@ -322,7 +396,6 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     BDRVQcow2State *s = bs->opaque;
     int i;
     int ret;
-    int lookup_index;
     uint64_t min_lru_counter = UINT64_MAX;
     int min_lru_index = -1;
 
@@ -339,20 +412,19 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     }
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / c->table_size * 4) % c->size;
-    do {
+    i = qcow2_cache_hash_lookup(c, offset);
+    if (i >= 0) {
+        goto found;
+    }
+
+    /* Cache miss: find the least recently used entry to evict */
+    for (i = 0; i < c->size; i++) {
         const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
         if (t->ref == 0 && t->lru_counter < min_lru_counter) {
             min_lru_counter = t->lru_counter;
             min_lru_index = i;
         }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+    }
 
     if (min_lru_index == -1) {
         /* This can't happen in current synchronous code, but leave the check
@@ -372,7 +444,7 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    qcow2_cache_set_offset(c, i, 0);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -386,7 +458,7 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
         }
     }
 
-    c->entries[i].offset = offset;
+    qcow2_cache_set_offset(c, i, offset);
 
     /* And return the right table */
 found:
@@ -434,14 +506,9 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
 
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
-    int i;
+    int i = offset ? qcow2_cache_hash_lookup(c, offset) : -1;
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(c, i);
-        }
-    }
-    return NULL;
+    return i >= 0 ? qcow2_cache_get_table_addr(c, i) : NULL;
 }
 
 void qcow2_cache_discard(Qcow2Cache *c, void *table)
@@ -450,7 +517,7 @@ void qcow2_cache_discard(Qcow2Cache *c, void *table)
 
     assert(c->entries[i].ref == 0);
 
-    c->entries[i].offset = 0;
+    qcow2_cache_set_offset(c, i, 0);
     c->entries[i].lru_counter = 0;
     c->entries[i].dirty = false;
 
@@ -941,6 +941,42 @@ fail:
     return ret;
 }
 
+/*
+ * Drops a reference to each of the @n (big endian) L2 entries in @entries.
+ * Runs of host-contiguous standard clusters are freed with a single refcount
+ * update, so that the refcount block is only looked up once per run.
+ */
+static void free_old_clusters(BlockDriverState *bs, uint64_t *entries, int n)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int i, run;
+
+    for (i = 0; i < n; i += run) {
+        uint64_t entry = be64_to_cpu(entries[i]);
+        QCow2ClusterType type = qcow2_get_cluster_type(bs, entry);
+
+        run = 1;
+        if (type == QCOW2_CLUSTER_NORMAL || type == QCOW2_CLUSTER_ZERO_ALLOC) {
+            uint64_t next = (entry & L2E_OFFSET_MASK) + s->cluster_size;
+
+            while (i + run < n) {
+                uint64_t e = be64_to_cpu(entries[i + run]);
+                QCow2ClusterType t = qcow2_get_cluster_type(bs, e);
+
+                if ((t != QCOW2_CLUSTER_NORMAL &&
+                     t != QCOW2_CLUSTER_ZERO_ALLOC) ||
+                    (e & L2E_OFFSET_MASK) != next) {
+                    break;
+                }
+                next += s->cluster_size;
+                run++;
+            }
+        }
+
+        qcow2_free_any_clusters(bs, entry, run, QCOW2_DISCARD_NEVER);
+    }
+}
+
 int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -1007,10 +1043,7 @@ int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
      * clusters), the next write will reuse them anyway.
      */
     if (!m->keep_old_clusters && j != 0) {
-        for (i = 0; i < j; i++) {
-            qcow2_free_any_clusters(bs, be64_to_cpu(old_cluster[i]), 1,
-                                    QCOW2_DISCARD_NEVER);
-        }
+        free_old_clusters(bs, old_cluster, j);
     }
 
     ret = 0;
@@ -961,12 +961,75 @@ int qcow2_update_cluster_refcount(BlockDriverState *bs,
 
 
 
+/*
+ * Counts how many of the @nb_clusters clusters starting at @cluster_index
+ * are free, up to the first one that is in use, and stores the result in
+ * *@nb_free.  Unlike calling qcow2_get_refcount() for each cluster, this
+ * looks up each refcount block only once.
+ */
+static int count_free_clusters(BlockDriverState *bs, uint64_t cluster_index,
+                               uint64_t nb_clusters, uint64_t *nb_free)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t n = 0;
+
+    while (n < nb_clusters) {
+        uint64_t index = cluster_index + n;
+        uint64_t refcount_table_index = index >> s->refcount_block_bits;
+        uint64_t block_index = index & (s->refcount_block_size - 1);
+        uint64_t count = MIN(nb_clusters - n,
+                             s->refcount_block_size - block_index);
+        int64_t refcount_block_offset = 0;
+        void *refcount_block;
+        uint64_t i;
+        int ret;
+
+        if (refcount_table_index < s->refcount_table_size) {
+            refcount_block_offset =
+                s->refcount_table[refcount_table_index] & REFT_OFFSET_MASK;
+        }
+        if (!refcount_block_offset) {
+            /* All clusters of a missing refcount block are free */
+            n += count;
+            continue;
+        }
+
+        if (offset_into_cluster(s, refcount_block_offset)) {
+            qcow2_signal_corruption(bs, true, -1, -1, "Refblock offset %#"
+                                    PRIx64 " unaligned (reftable index: %#"
+                                    PRIx64 ")", refcount_block_offset,
+                                    refcount_table_index);
+            return -EIO;
+        }
+
+        ret = qcow2_cache_get(bs, s->refcount_block_cache,
+                              refcount_block_offset, &refcount_block);
+        if (ret < 0) {
+            return ret;
+        }
+        for (i = 0; i < count; i++) {
+            if (s->get_refcount(refcount_block, block_index + i) != 0) {
+                break;
+            }
+        }
+        qcow2_cache_put(s->refcount_block_cache, &refcount_block);
+
+        n += i;
+        if (i < count) {
+            break;
+        }
+    }
+
+    *nb_free = n;
+    return 0;
+}
+
 /* return < 0 if error */
 static int64_t alloc_clusters_noref(BlockDriverState *bs, uint64_t size,
                                     uint64_t max)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t i, nb_clusters, refcount;
+    uint64_t i, nb_clusters, nb_free;
     int ret;
 
     /* We can't allocate clusters if they may still be queued for discard. */
@@ -975,15 +1038,19 @@ static int64_t alloc_clusters_noref(BlockDriverState *bs, uint64_t size,
     }
 
     nb_clusters = size_to_clusters(s, size);
-retry:
-    for(i = 0; i < nb_clusters; i++) {
-        uint64_t next_cluster_index = s->free_cluster_index++;
-        ret = qcow2_get_refcount(bs, next_cluster_index, &refcount);
-
+    i = 0;
+    while (i < nb_clusters) {
+        ret = count_free_clusters(bs, s->free_cluster_index, nb_clusters - i,
+                                  &nb_free);
         if (ret < 0) {
             return ret;
-        } else if (refcount != 0) {
-            goto retry;
+        }
+        s->free_cluster_index += nb_free;
+        i += nb_free;
+        if (i < nb_clusters) {
+            /* Skip the cluster in use and look for a new run after it */
+            s->free_cluster_index++;
+            i = 0;
         }
     }
 
@@ -1029,7 +1096,6 @@ int64_t qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                                 int64_t nb_clusters)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t cluster_index, refcount;
     uint64_t i;
     int ret;
 
@@ -1040,14 +1106,10 @@ int64_t qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
 
     do {
         /* Check how many clusters there are free */
-        cluster_index = offset >> s->cluster_bits;
-        for(i = 0; i < nb_clusters; i++) {
-            ret = qcow2_get_refcount(bs, cluster_index++, &refcount);
-            if (ret < 0) {
-                return ret;
-            } else if (refcount != 0) {
-                break;
-            }
+        ret = count_free_clusters(bs, offset >> s->cluster_bits, nb_clusters,
+                                  &i);
+        if (ret < 0) {
+            return ret;
         }
 
         /* And then allocate them */
@@ -571,6 +571,19 @@ static int coroutine_fn raw_co_copy_range_to(BlockDriverState *bs,
                                  read_flags, write_flags);
 }
 
+static int coroutine_fn raw_co_sendfile(BlockDriverState *bs,
+                                        uint64_t offset, uint64_t bytes,
+                                        int out_fd, QEMUIOVector *hdr)
+{
+    int ret;
+
+    ret = raw_adjust_offset(bs, &offset, bytes, false);
+    if (ret) {
+        return ret;
+    }
+    return bdrv_co_sendfile(bs->file, offset, bytes, out_fd, hdr);
+}
+
 static const char *const raw_strong_runtime_opts[] = {
     "offset",
     "size",
@@ -595,6 +608,7 @@ BlockDriver bdrv_raw = {
     .bdrv_co_block_status = &raw_co_block_status,
     .bdrv_co_copy_range_from = &raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = &raw_co_copy_range_to,
+    .bdrv_co_sendfile     = &raw_co_sendfile,
     .bdrv_co_truncate     = &raw_co_truncate,
     .bdrv_getlength       = &raw_getlength,
     .is_format            = true,
@@ -0,0 +1,864 @@
+/*
+ * Read cache block filter
+ *
+ * Keeps copies of the clusters read from a (slow) image in a cache file on
+ * (fast) local storage, so that repeated reads are served from the cache.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qapi-types-block-core.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/util.h"
+#include "block/block_int.h"
+#include "qemu/bitmap.h"
+#include "qemu/coroutine.h"
+#include "qemu/cutils.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/units.h"
+#include "trace.h"
+
+/*
+ * On-disk layout of the cache file:
+ *
+ *   0                  header
+ *   RC_BITMAP_OFFSET   bitmap of valid clusters, one bit per cluster
+ *   data_offset        cached data, at the same offsets as in the image
+ *
+ * The data area is sparse; only clusters that have been cached take space.
+ * The bitmap on disk is only trusted if RC_FLAG_IN_USE is clear, i.e. the
+ * cache was closed cleanly, and if the image files have not changed since
+ * (see rc_get_image_id()).  All fields are little-endian.
+ */
+#define RC_MAGIC            0x3165686361636472ULL /* "rdcache1" */
+#define RC_VERSION          2
+#define RC_BITMAP_OFFSET    4096
+#define RC_IMAGE_ID_SIZE    32 /* SHA-256 */
+
+#define RC_FLAG_IN_USE      (1ULL << 0)
+
+#define RC_DEFAULT_CLUSTER_SIZE (64 * KiB)
+#define RC_MIN_CLUSTER_SIZE     (4 * KiB)
+#define RC_MAX_CLUSTER_SIZE     (2 * MiB)
+
+typedef struct ReadCacheHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t cluster_size;
+    uint64_t image_size;
+    uint64_t data_offset;
+    uint64_t flags;
+    uint8_t image_id[RC_IMAGE_ID_SIZE];
+} QEMU_PACKED ReadCacheHeader;
+
+typedef struct BDRVReadCacheState {
+    BdrvChild *cache;
+    ReadCacheWritePolicy write_policy;
+
+    uint32_t cluster_size;
+    int cluster_bits;
+    int64_t image_size;
+    uint64_t nb_clusters;
+    uint64_t bitmap_size;   /* bytes on disk */
+    uint64_t data_offset;
+
+    /* Clusters whose cached copy matches the image */
+    unsigned long *valid;
+    /*
+     * Clusters that are being filled or written.  Writes wait for the
+     * clusters they touch to become idle; fills skip busy clusters.  This
+     * keeps a fill that read old data from marking the cluster valid after
+     * a write has changed it.
+     */
+    unsigned long *busy;
+    CoQueue busy_queue;
+
+    /* Protects updates of the header on disk */
+    CoMutex header_lock;
+    bool in_use;
+    /* The header could not be marked in use, the cache is bypassed */
+    bool disabled;
+
+    BlockStatsSpecificReadCache stats;
+} BDRVReadCacheState;
+
+static QemuOptsList runtime_opts = {
+    .name = "read-cache",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = "cluster-size",
+            .type = QEMU_OPT_SIZE,
+            .help = "Granularity of the cache",
+        },
+        {
+            .name = "write-policy",
+            .type = QEMU_OPT_STRING,
+            .help = "How writes update the cache "
+                    "(write-through, write-around)",
+        },
+        { /* end of list */ }
+    },
+};
+
+static int rc_parse_options(QDict *options, uint32_t *cluster_size,
+                            ReadCacheWritePolicy *write_policy, Error **errp)
+{
+    QemuOpts *opts;
+    Error *local_err = NULL;
+    uint64_t size;
+    int ret = -EINVAL;
+
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    qemu_opts_absorb_qdict(opts, options, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        goto out;
+    }
+
+    size = qemu_opt_get_size(opts, "cluster-size", RC_DEFAULT_CLUSTER_SIZE);
+    if (size < RC_MIN_CLUSTER_SIZE || size > RC_MAX_CLUSTER_SIZE ||
+        !is_power_of_2(size)) {
+        error_setg(errp, "Cluster size must be a power of two between %d "
+                   "and %d", RC_MIN_CLUSTER_SIZE, RC_MAX_CLUSTER_SIZE);
+        goto out;
+    }
+    *cluster_size = size;
+
+    *write_policy = qapi_enum_parse(&ReadCacheWritePolicy_lookup,
+                                    qemu_opt_get(opts, "write-policy"),
+                                    READ_CACHE_WRITE_POLICY_WRITE_AROUND,
+                                    &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        goto out;
+    }
+
+    ret = 0;
+out:
+    qemu_opts_del(opts);
+    return ret;
+}
+
+static bool rc_add_image_id(BlockDriverState *bs, GChecksum *sum)
+{
+    BdrvChild *child;
+    struct stat st;
+    uint64_t fields[8] = { 0 };
+
+    if (QLIST_EMPTY(&bs->children)) {
+        if (!bs->drv || strcmp(bs->drv->format_name, "file") ||
+            stat(bs->filename, &st) < 0) {
+            return false;
+        }
+        fields[0] = cpu_to_le64(st.st_dev);
+        fields[1] = cpu_to_le64(st.st_ino);
+        fields[2] = cpu_to_le64(st.st_size);
+        fields[3] = cpu_to_le64(st.st_mtime);
+        fields[4] = cpu_to_le64(st.st_ctime);
+#ifdef CONFIG_LINUX
+        fields[5] = cpu_to_le64(st.st_mtim.tv_nsec);
+        fields[6] = cpu_to_le64(st.st_ctim.tv_nsec);
+#endif
+        g_checksum_update(sum, (guchar *)fields, sizeof(fields));
+        return true;
+    }
+
+    QLIST_FOREACH(child, &bs->children, next) {
+        if (!rc_add_image_id(child->bs, sum)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Compute an identity of the data of the image: a digest of the device,
+ * inode, size and modification times of all host files it is stored in.
+ * If some of it is not stored in a host file, there is no way to tell
+ * whether it changed while the cache was closed, and false is returned.
+ */
+static bool rc_get_image_id(BlockDriverState *bs, uint8_t *id)
+{
+    GChecksum *sum = g_checksum_new(G_CHECKSUM_SHA256);
+    gsize len = RC_IMAGE_ID_SIZE;
+    bool ret;
+
+    ret = rc_add_image_id(bs->file->bs, sum);
+    if (ret) {
+        g_checksum_get_digest(sum, id, &len);
+        assert(len == RC_IMAGE_ID_SIZE);
+    }
+    g_checksum_free(sum);
+    return ret;
+}
+
+static int rc_write_header(BlockDriverState *bs, uint64_t flags)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    ReadCacheHeader header = {
+        .magic          = cpu_to_le64(RC_MAGIC),
+        .version        = cpu_to_le32(RC_VERSION),
+        .cluster_size   = cpu_to_le32(s->cluster_size),
+        .image_size     = cpu_to_le64(s->image_size),
+        .data_offset    = cpu_to_le64(s->data_offset),
+        .flags          = cpu_to_le64(flags),
+    };
+    int ret;
+
+    /* The index is only valid for the image as it is now */
+    if (!(flags & RC_FLAG_IN_USE) && !rc_get_image_id(bs, header.image_id)) {
+        header.flags = cpu_to_le64(RC_FLAG_IN_USE);
+    }
+
+    ret = bdrv_pwrite(s->cache, 0, &header, sizeof(header));
+    if (ret < 0) {
+        return ret;
+    }
+    return bdrv_flush(s->cache->bs);
+}
+
+/*
+ * Load the bitmap of valid clusters if the cache file was written for the
+ * same, unchanged image and closed cleanly.  Otherwise the cache starts out
+ * empty.
+ */
+static int rc_load(BlockDriverState *bs, Error **errp)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    ReadCacheHeader header;
+    uint8_t image_id[RC_IMAGE_ID_SIZE];
+    unsigned long *buf;
+    const char *reason = NULL;
+    int64_t cache_size;
+    int ret;
+
+    cache_size = bdrv_getlength(s->cache->bs);
+    if (cache_size < 0) {
+        error_setg_errno(errp, -cache_size, "Could not get cache file size");
+        return cache_size;
+    }
+    if (cache_size < s->data_offset) {
+        trace_read_cache_reset(bs, "new cache file");
+        return 0;
+    }
+
+    ret = bdrv_pread(s->cache, 0, &header, sizeof(header));
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read cache header");
+        return ret;
+    }
+
+    if (le64_to_cpu(header.magic) != RC_MAGIC ||
+        le32_to_cpu(header.version) != RC_VERSION) {
+        reason = "invalid header";
+    } else if (le32_to_cpu(header.cluster_size) != s->cluster_size ||
+               le64_to_cpu(header.image_size) != s->image_size ||
+               le64_to_cpu(header.data_offset) != s->data_offset) {
+        reason = "geometry changed";
+    } else if (le64_to_cpu(header.flags) & RC_FLAG_IN_USE) {
+        reason = "not closed cleanly";
+    } else if (!rc_get_image_id(bs, image_id) ||
+               memcmp(header.image_id, image_id, RC_IMAGE_ID_SIZE)) {
+        reason = "image changed";
+    }
+    if (reason) {
+        trace_read_cache_reset(bs, reason);
+        return 0;
+    }
+
+    buf = g_malloc0(s->bitmap_size);
+    ret = bdrv_pread(s->cache, RC_BITMAP_OFFSET, buf, s->bitmap_size);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read cache bitmap");
+        g_free(buf);
+        return ret;
+    }
+    bitmap_from_le(s->valid, buf, s->nb_clusters);
+    g_free(buf);
+
+    return 0;
+}
+
+/*
+ * Mark the cache as in use on disk before it is first modified, so that
+ * after a crash the possibly stale bitmap is not trusted.
+ */
+static int coroutine_fn rc_co_mark_in_use(BlockDriverState *bs)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int ret = 0;
+
+    if (s->in_use) {
+        return 0;
+    }
+
+    qemu_co_mutex_lock(&s->header_lock);
+    if (!s->in_use) {
+        ret = rc_write_header(bs, RC_FLAG_IN_USE);
+        s->in_use = ret == 0;
+    }
+    qemu_co_mutex_unlock(&s->header_lock);
+
+    return ret;
+}
+
+/* Write the bitmap back to the cache file and mark it clean */
+static int rc_persist(BlockDriverState *bs)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    unsigned long *buf;
+    int ret;
+
+    if (s->disabled) {
+        /* The bitmap on disk may be stale, try again to discard it */
+        return rc_write_header(bs, RC_FLAG_IN_USE);
+    }
+    if (!s->in_use) {
+        return 0;
+    }
+
+    buf = g_malloc0(s->bitmap_size);
+    bitmap_to_le(buf, s->valid, s->nb_clusters);
+    ret = bdrv_pwrite(s->cache, RC_BITMAP_OFFSET, buf, s->bitmap_size);
+    g_free(buf);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* Flushes the cached data and the bitmap before the header */
+    ret = bdrv_flush(s->cache->bs);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = rc_write_header(bs, 0);
+    if (ret < 0) {
+        return ret;
+    }
+    s->in_use = false;
+    return 0;
+}
+
+static int rc_open(BlockDriverState *bs, QDict *options, int flags,
+                   Error **errp)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    Error *local_err = NULL;
+    int ret;
+
+    ret = rc_parse_options(options, &s->cluster_size, &s->write_policy, errp);
+    if (ret < 0) {
+        return ret;
+    }
+    s->cluster_bits = ctz32(s->cluster_size);
+
+    bs->file = bdrv_open_child(NULL, options, "file", bs, &child_of_bds,
+                               BDRV_CHILD_FILTERED | BDRV_CHILD_PRIMARY, false,
+                               &local_err);
+    if (local_err) {
+        ret = -EINVAL;
+        error_propagate(errp, local_err);
+        goto fail;
+    }
+
+    /*
+     * The cache is written even if the image is only read, so do not let an
+     * inline cache definition inherit read-only from us.
+     */
+    if (!qdict_haskey(options, "cache-file")) {
+        qdict_set_default_str(options, "cache-file." BDRV_OPT_READ_ONLY,
+                              "off");
+    }
+    s->cache = bdrv_open_child(NULL, options, "cache-file", bs,
+                               &child_of_bds, BDRV_CHILD_METADATA, false,
+                               &local_err);
+    if (local_err) {
+        ret = -EINVAL;
+        error_propagate(errp, local_err);
+        goto fail;
+    }
+
+    s->image_size = bdrv_getlength(bs->file->bs);
+    if (s->image_size < 0) {
+        ret = s->image_size;
+        error_setg_errno(errp, -ret, "Could not get image size");
+        goto fail;
+    }
+    s->nb_clusters = DIV_ROUND_UP(s->image_size, s->cluster_size);
+    s->bitmap_size = ROUND_UP(DIV_ROUND_UP(s->nb_clusters, BITS_PER_BYTE),
+                              sizeof(uint64_t));
+    s->data_offset = ROUND_UP(RC_BITMAP_OFFSET + s->bitmap_size,
+                              s->cluster_size);
+    s->valid = bitmap_new(s->nb_clusters);
+    s->busy = bitmap_new(s->nb_clusters);
+    qemu_co_queue_init(&s->busy_queue);
+    qemu_co_mutex_init(&s->header_lock);
+
+    ret = rc_load(bs, errp);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    bs->supported_write_flags = BDRV_REQ_WRITE_UNCHANGED |
+        (BDRV_REQ_FUA & bs->file->bs->supported_write_flags);
+
+    bs->supported_zero_flags = BDRV_REQ_WRITE_UNCHANGED |
+        ((BDRV_REQ_FUA | BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK) &
+            bs->file->bs->supported_zero_flags);
+
+    ret = 0;
+fail:
+    if (ret < 0) {
+        g_free(s->valid);
+        g_free(s->busy);
+        s->valid = s->busy = NULL;
+        bdrv_unref_child(bs, s->cache);
+        s->cache = NULL;
+        bdrv_unref_child(bs, bs->file);
+        bs->file = NULL;
+    }
+    return ret;
+}
+
+static void rc_close(BlockDriverState *bs)
+{
+    BDRVReadCacheState *s = bs->opaque;
+
+    rc_persist(bs);
+
+    g_free(s->valid);
+    g_free(s->busy);
+    bdrv_unref_child(bs, s->cache);
+    s->cache = NULL;
+}
+
+static int rc_inactivate(BlockDriverState *bs)
+{
+    return rc_persist(bs);
+}
+
+/*
+ * While the node was inactive, another process (e.g. the source of an
+ * incoming migration) may have used the image and the cache file, so
+ * forget what is cached and load the index again.
+ */
+static void coroutine_fn rc_co_invalidate_cache(BlockDriverState *bs,
+                                                Error **errp)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int64_t image_size;
+
+    image_size = bdrv_getlength(bs->file->bs);
+    if (image_size < 0) {
+        error_setg_errno(errp, -image_size, "Could not get image size");
+        return;
+    }
+    if (image_size != s->image_size) {
+        error_setg(errp, "The image was resized while the read cache was "
+                   "inactive");
+        return;
+    }
+
+    bitmap_zero(s->valid, s->nb_clusters);
+    s->in_use = false;
+    s->disabled = false;
+    rc_load(bs, errp);
+}
+
+static int rc_reopen_prepare(BDRVReopenState *reopen_state,
+                             BlockReopenQueue *queue, Error **errp)
+{
+    BDRVReadCacheState *s = reopen_state->bs->opaque;
+    ReadCacheWritePolicy *write_policy;
+    uint32_t cluster_size;
+    int ret;
+
+    write_policy = g_new(ReadCacheWritePolicy, 1);
+    ret = rc_parse_options(reopen_state->options, &cluster_size, write_policy,
+                           errp);
+    if (ret == 0 && cluster_size != s->cluster_size) {
+        /* The bitmap and the data area are laid out for the cluster size */
+        error_setg(errp, "Cannot change the cluster size of a read cache");
+        ret = -EINVAL;
+    }
+    if (ret < 0) {
+        g_free(write_policy);
+        return ret;
+    }
+
+    reopen_state->opaque = write_policy;
+    return 0;
+}
+
+static void rc_reopen_commit(BDRVReopenState *reopen_state)
+{
+    BDRVReadCacheState *s = reopen_state->bs->opaque;
+    ReadCacheWritePolicy *write_policy = reopen_state->opaque;
+
+    s->write_policy = *write_policy;
+    g_free(reopen_state->opaque);
+    reopen_state->opaque = NULL;
+}
+
+static void rc_reopen_abort(BDRVReopenState *reopen_state)
+{
+    g_free(reopen_state->opaque);
+    reopen_state->opaque = NULL;
+}
+
+static void rc_child_perm(BlockDriverState *bs, BdrvChild *c,
+                          BdrvChildRole role, BlockReopenQueue *reopen_queue,
+                          uint64_t perm, uint64_t shared,
+                          uint64_t *nperm, uint64_t *nshared)
+{
+    if (role & BDRV_CHILD_FILTERED) {
+        bdrv_default_perms(bs, c, role, reopen_queue, perm, shared,
+                           nperm, nshared);
+        /*
+         * The geometry of the cache follows the size of the image, and
+         * writes that bypass us would leave stale data in the cache
+         */
+        *nshared &= ~BLK_PERM_RESIZE;
+        if (!(bs->open_flags & BDRV_O_INACTIVE)) {
+            *nshared &= ~BLK_PERM_WRITE;
+        }
+        return;
+    }
+
+    /* The cache is private to us and written even for read-only images */
+    *nperm = BLK_PERM_CONSISTENT_READ;
+    *nshared = BLK_PERM_ALL & ~(BLK_PERM_WRITE | BLK_PERM_RESIZE);
+    if (!(bs->open_flags & BDRV_O_INACTIVE)) {
+        *nperm |= BLK_PERM_WRITE | BLK_PERM_RESIZE;
+    } else {
+        *nshared |= BLK_PERM_WRITE | BLK_PERM_RESIZE;
+    }
+}
+
+static int64_t rc_getlength(BlockDriverState *bs)
+{
+    return bdrv_getlength(bs->file->bs);
+}
+
+static bool rc_cache_usable(BlockDriverState *bs)
+{
+    BDRVReadCacheState *s = bs->opaque;
+
+    return !s->disabled && !(bs->open_flags & BDRV_O_INACTIVE);
+}
+
+/* Wait until no cluster in [@first, @end) is busy, then mark them busy */
+static void coroutine_fn rc_co_lock_clusters(BDRVReadCacheState *s,
+                                             uint64_t first, uint64_t end)
+{
+    while (find_next_bit(s->busy, end, first) < end) {
+        qemu_co_queue_wait(&s->busy_queue, NULL);
+    }
+    bitmap_set(s->busy, first, end - first);
+}
+
+static void coroutine_fn rc_co_unlock_clusters(BDRVReadCacheState *s,
+                                               uint64_t first, uint64_t end)
+{
+    bitmap_clear(s->busy, first, end - first);
+    qemu_co_queue_restart_all(&s->busy_queue);
+}
+
+/*
+ * Drop the locked clusters [@first, @end) from the cache before they are
+ * written.  The bitmap on disk still lists them as valid, so it must be
+ * marked untrusted first; if that fails, the whole cache is given up.
+ */
+static void coroutine_fn rc_co_invalidate(BlockDriverState *bs,
+                                          uint64_t first, uint64_t end)
+{
+    BDRVReadCacheState *s = bs->opaque;
+
+    if (find_next_bit(s->valid, end, first) >= end) {
+        return;
+    }
+
+    if (rc_co_mark_in_use(bs) < 0) {
+        trace_read_cache_reset(bs, "cannot mark cache in use");
+        s->stats.fill_errors++;
+        s->disabled = true;
+        bitmap_zero(s->valid, s->nb_clusters);
+        return;
+    }
+    bitmap_clear(s->valid, first, end - first);
+}
+
+/*
+ * Read a range that is not cached from the image and store the clusters
+ * it covers in the cache.  Failing to update the cache is not an error for
+ * the guest; the clusters simply stay uncached.
+ */
+static int coroutine_fn rc_co_fill(BlockDriverState *bs, int64_t offset,
+                                   int64_t bytes, QEMUIOVector *qiov,
+                                   size_t qiov_offset, int flags)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int64_t start = QEMU_ALIGN_DOWN(offset, s->cluster_size);
+    int64_t end = MIN(QEMU_ALIGN_UP(offset + bytes, s->cluster_size),
+                      s->image_size);
+    uint64_t first = start >> s->cluster_bits;
+    uint64_t last = DIV_ROUND_UP(end, s->cluster_size);
+    uint8_t *buf;
+    int ret;
+
+    s->stats.miss_bytes += bytes;
+
+    /* Leave clusters alone that somebody else is filling or writing */
+    if (end <= start || find_next_bit(s->busy, last, first) < last) {
+        return bdrv_co_preadv_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                   flags);
+    }
+
+    buf = qemu_try_blockalign(bs->file->bs, end - start);
+    if (!buf) {
+        return bdrv_co_preadv_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                   flags);
+    }
+
+    bitmap_set(s->busy, first, last - first);
+
+    ret = bdrv_co_pread(bs->file, start, end - start, buf, 0);
+    if (ret < 0) {
+        goto out;
+    }
+    qemu_iovec_from_buf(qiov, qiov_offset, buf + (offset - start), bytes);
+
+    ret = rc_co_mark_in_use(bs);
+    if (ret == 0) {
+        ret = bdrv_co_pwrite(s->cache, s->data_offset + start, end - start,
+                             buf, 0);
+    }
+    trace_read_cache_fill(bs, start, end - start, ret);
+    if (ret < 0) {
+        s->stats.fill_errors++;
+    } else {
+        s->stats.fill_bytes += end - start;
+        bitmap_set(s->valid, first, last - first);
+    }
+    ret = 0;
+
+out:
+    rc_co_unlock_clusters(s, first, last);
+    qemu_vfree(buf);
+    return ret;
+}
+
+static int coroutine_fn rc_co_preadv_part(BlockDriverState *bs,
+                                          uint64_t offset, uint64_t bytes,
+                                          QEMUIOVector *qiov,
+                                          size_t qiov_offset, int flags)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    uint64_t end_cluster = DIV_ROUND_UP(offset + bytes, s->cluster_size);
+    uint64_t done = 0;
+    int ret;
+
+    if (!rc_cache_usable(bs) || offset + bytes > s->image_size) {
+        return bdrv_co_preadv_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                   flags);
+    }
+
+    while (done < bytes) {
+        uint64_t cur = offset + done;
+        uint64_t cluster = cur >> s->cluster_bits;
+        bool cached = test_bit(cluster, s->valid);
+        uint64_t run_end, len;
+
+        /* Handle the longest run of clusters with the same state at once */
+        if (cached) {
+            run_end = find_next_zero_bit(s->valid, end_cluster, cluster);
+        } else {
+            run_end = find_next_bit(s->valid, end_cluster, cluster);
+        }
+        len = MIN(run_end << s->cluster_bits, offset + bytes) - cur;
+
+        if (cached) {
+            ret = bdrv_co_preadv_part(s->cache, s->data_offset + cur, len,
+                                      qiov, qiov_offset + done, 0);
+            if (ret < 0) {
+                /* The image is still there; drop the cached copy */
+                s->stats.fill_errors++;
+                bitmap_clear(s->valid, cluster, run_end - cluster);
+                ret = bdrv_co_preadv_part(bs->file, cur, len, qiov,
+                                          qiov_offset + done, flags);
+            } else {
+                s->stats.hit_bytes += len;
+            }
+        } else {
+            ret = rc_co_fill(bs, cur, len, qiov, qiov_offset + done, flags);
+        }
+        if (ret < 0) {
+            return ret;
+        }
+        done += len;
+    }
+
+    return 0;
+}
+
+static int coroutine_fn rc_co_pwritev_part(BlockDriverState *bs,
+                                           uint64_t offset, uint64_t bytes,
+                                           QEMUIOVector *qiov,
+                                           size_t qiov_offset, int flags)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    uint64_t first, last;
+    int64_t start, end;
+    int ret;
+
+    if (!rc_cache_usable(bs) || offset + bytes > s->image_size) {
+        return bdrv_co_pwritev_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                    flags);
+    }
+
+    first = offset >> s->cluster_bits;
+    last = DIV_ROUND_UP(offset + bytes, s->cluster_size);
+    rc_co_lock_clusters(s, first, last);
+    rc_co_invalidate(bs, first, last);
+
+    ret = bdrv_co_pwritev_part(bs->file, offset, bytes, qiov, qiov_offset,
+                               flags);
+    if (ret < 0 || s->disabled ||
+        s->write_policy != READ_CACHE_WRITE_POLICY_WRITE_THROUGH) {
+        goto out;
+    }
+
+    /* Only whole clusters can be stored without reading the rest */
+    start = QEMU_ALIGN_UP(offset, s->cluster_size);
+    end = offset + bytes == s->image_size ?
+          s->image_size : QEMU_ALIGN_DOWN(offset + bytes, s->cluster_size);
+    if (start < end && rc_co_mark_in_use(bs) == 0) {
+        int cache_ret;
+
+        cache_ret = bdrv_co_pwritev_part(s->cache, s->data_offset + start,
+                                         end - start, qiov,
+                                         qiov_offset + (start - offset), 0);
+        if (cache_ret < 0) {
+            s->stats.fill_errors++;
+        } else {
+            s->stats.fill_bytes += end - start;
+            bitmap_set(s->valid, start >> s->cluster_bits,
+                       DIV_ROUND_UP(end, s->cluster_size) -
+                       (start >> s->cluster_bits));
+        }
+    }
+
+out:
+    rc_co_unlock_clusters(s, first, last);
+    return ret;
+}
+
+static int coroutine_fn rc_co_pwrite_zeroes(BlockDriverState *bs,
+                                            int64_t offset, int bytes,
+                                            BdrvRequestFlags flags)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    uint64_t first, last;
+    int ret;
+
+    if (!rc_cache_usable(bs) || offset + bytes > s->image_size) {
+        return bdrv_co_pwrite_zeroes(bs->file, offset, bytes, flags);
+    }
+
+    first = offset >> s->cluster_bits;
+    last = DIV_ROUND_UP(offset + bytes, s->cluster_size);
+    rc_co_lock_clusters(s, first, last);
+    rc_co_invalidate(bs, first, last);
+    ret = bdrv_co_pwrite_zeroes(bs->file, offset, bytes, flags);
+    rc_co_unlock_clusters(s, first, last);
+
+    return ret;
+}
+
+static int coroutine_fn rc_co_pdiscard(BlockDriverState *bs,
+                                       int64_t offset, int bytes)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    uint64_t first, last;
+    int ret;
+
+    if (!rc_cache_usable(bs) || offset + bytes > s->image_size) {
+        return bdrv_co_pdiscard(bs->file, offset, bytes);
+    }
+
+    first = offset >> s->cluster_bits;
+    last = DIV_ROUND_UP(offset + bytes, s->cluster_size);
+    rc_co_lock_clusters(s, first, last);
+    rc_co_invalidate(bs, first, last);
+    ret = bdrv_co_pdiscard(bs->file, offset, bytes);
+    rc_co_unlock_clusters(s, first, last);
+
+    return ret;
+}
+
+static int coroutine_fn rc_co_truncate(BlockDriverState *bs, int64_t offset,
+                                       bool exact, PreallocMode prealloc,
+                                       BdrvRequestFlags flags, Error **errp)
+{
+    error_setg(errp, "Cannot resize an image with a read cache");
+    return -ENOTSUP;
+}
+
+static BlockStatsSpecific *rc_get_specific_stats(BlockDriverState *bs)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+
+    stats->driver = BLOCKDEV_DRIVER_READ_CACHE;
+    stats->u.read_cache = s->stats;
+    stats->u.read_cache.cached_bytes =
+        (uint64_t)bitmap_count_one(s->valid, s->nb_clusters) * s->cluster_size;
+
+    return stats;
+}
+
+static const char *const rc_strong_runtime_opts[] = {
+    "cluster-size",
+    "write-policy",
+
+    NULL
+};
+
+static BlockDriver bdrv_read_cache = {
+    .format_name            = "read-cache",
+    .instance_size          = sizeof(BDRVReadCacheState),
+
+    .bdrv_open              = rc_open,
+    .bdrv_close             = rc_close,
+    .bdrv_inactivate        = rc_inactivate,
+    .bdrv_co_invalidate_cache = rc_co_invalidate_cache,
+    .bdrv_reopen_prepare    = rc_reopen_prepare,
+    .bdrv_reopen_commit     = rc_reopen_commit,
+    .bdrv_reopen_abort      = rc_reopen_abort,
+    .bdrv_child_perm        = rc_child_perm,
+    .bdrv_getlength         = rc_getlength,
+
+    .bdrv_co_preadv_part    = rc_co_preadv_part,
+    .bdrv_co_pwritev_part   = rc_co_pwritev_part,
+    .bdrv_co_pwrite_zeroes  = rc_co_pwrite_zeroes,
+    .bdrv_co_pdiscard       = rc_co_pdiscard,
+    .bdrv_co_truncate       = rc_co_truncate,
+    .bdrv_co_block_status   = bdrv_co_block_status_from_file,
+
+    .bdrv_get_specific_stats = rc_get_specific_stats,
+
+    .is_filter              = true,
+    .strong_runtime_opts    = rc_strong_runtime_opts,
+};
+
+static void bdrv_read_cache_init(void)
+{
+    bdrv_register(&bdrv_read_cache);
+}
+
+block_init(bdrv_read_cache_init);
@@ -1367,6 +1367,96 @@ bool cpu_physical_memory_test_and_clear_dirty(ram_addr_t start,
     return dirty;
 }
 
+/*
+ * Whether @pages dirty bits starting at byte @offset of @rb can be merged
+ * with cpu_physical_memory_merge_dirty_lebitmap().  This is only possible
+ * inside memory_global_dirty_log_sync_direct(), once migration has set up
+ * the bitmap of @rb, and when the range starts at a word boundary of both
+ * the migration bitmap and the global dirty memory bitmaps.
+ */
+bool cpu_physical_memory_can_merge_dirty_lebitmap(RAMBlock *rb,
+                                                  ram_addr_t offset,
+                                                  ram_addr_t pages)
+{
+    unsigned long page = offset >> TARGET_PAGE_BITS;
+    unsigned long ram_page = (rb->offset + offset) >> TARGET_PAGE_BITS;
+
+    if (!global_dirty_log_direct || !rb->bmap ||
+        qemu_real_host_page_size != TARGET_PAGE_SIZE) {
+        return false;
+    }
+    if ((page % BITS_PER_LONG) || (ram_page % BITS_PER_LONG)) {
+        return false;
+    }
+    assert(offset + (pages << TARGET_PAGE_BITS) <= rb->max_length);
+    return true;
+}
+
+/*
+ * Merge the little-endian dirty @bitmap of @pages pages, starting at byte
+ * @offset of @rb, directly into the migration bitmap of @rb.  The other
+ * dirty memory clients that log @rb are updated as well, so that the bitmap
+ * only has to be walked once.  The caller must have checked the range with
+ * cpu_physical_memory_can_merge_dirty_lebitmap().
+ *
+ * Disjoint ranges of the same RAMBlock may be merged concurrently.
+ *
+ * Returns the number of pages that were not yet dirty in the migration
+ * bitmap; the total number of dirty pages is added to @real_dirty_pages.
+ */
+uint64_t cpu_physical_memory_merge_dirty_lebitmap(RAMBlock *rb,
+                                                  const unsigned long *bitmap,
+                                                  ram_addr_t offset,
+                                                  ram_addr_t pages,
+                                                  uint64_t *real_dirty_pages)
+{
+    unsigned long ram_page = (rb->offset + offset) >> TARGET_PAGE_BITS;
+    unsigned long *dest = rb->bmap + BIT_WORD(offset >> TARGET_PAGE_BITS);
+    unsigned long idx = ram_page / DIRTY_MEMORY_BLOCK_SIZE;
+    unsigned long word = BIT_WORD(ram_page % DIRTY_MEMORY_BLOCK_SIZE);
+    unsigned long nr = BITS_TO_LONGS(pages);
+    uint8_t clients = memory_region_get_dirty_log_mask(rb->mr);
+    unsigned long **blocks[DIRTY_MEMORY_NUM];
+    uint64_t num_dirty = 0;
+    unsigned long k;
+    int i;
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        for (i = 0; i < DIRTY_MEMORY_NUM; i++) {
+            blocks[i] = atomic_rcu_read(&ram_list.dirty_memory[i])->blocks;
+        }
+
+        for (k = 0; k < nr; k++) {
+            if (bitmap[k]) {
+                unsigned long bits = leul_to_cpu(bitmap[k]);
+                unsigned long old;
+
+                if (k == nr - 1) {
+                    bits &= BITMAP_LAST_WORD_MASK(pages);
+                }
+
+                old = atomic_fetch_or(&dest[k], bits);
+                *real_dirty_pages += ctpopl(bits);
+                num_dirty += ctpopl(bits & ~old);
+
+                if (unlikely(clients & (1 << DIRTY_MEMORY_VGA))) {
+                    atomic_or(&blocks[DIRTY_MEMORY_VGA][idx][word], bits);
+                }
+                if (unlikely(clients & (1 << DIRTY_MEMORY_CODE))) {
+                    atomic_or(&blocks[DIRTY_MEMORY_CODE][idx][word], bits);
+                }
+            }
+
+            if (++word >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
+                word = 0;
+                idx++;
+            }
+        }
+    }
+
+    return num_dirty;
+}
+
 DirtyBitmapSnapshot *cpu_physical_memory_snapshot_and_clear_dirty
     (MemoryRegion *mr, hwaddr offset, hwaddr length, unsigned client)
 {
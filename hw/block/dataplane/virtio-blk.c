@@ -41,15 +41,18 @@ struct VirtIOBlockDataPlane {
      * (because you don't own the file descriptor or handle; you just
      * use it).
      */
-    IOThread *iothread;
-    AioContext *ctx;
+    IOThread **iothreads;
+    unsigned num_iothreads;
+    AioContext *ctx;                /* BlockBackend's AioContext */
+    AioContext **vq_aio_context;    /* AioContext servicing each virtqueue */
 };
 
 /* Raise an interrupt to signal guest, if necessary */
 void virtio_blk_data_plane_notify(VirtIOBlockDataPlane *s, VirtQueue *vq)
 {
     if (s->batch_notifications) {
-        set_bit(virtio_get_queue_index(vq), s->batch_notify_vqs);
+        /* May be called from any virtqueue's IOThread */
+        set_bit_atomic(virtio_get_queue_index(vq), s->batch_notify_vqs);
         qemu_bh_schedule(s->bh);
     } else {
         virtio_notify_irqfd(s->vdev, vq);
@@ -60,14 +63,11 @@ static void notify_guest_bh(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
     unsigned nvqs = s->conf->num_queues;
-    unsigned long bitmap[BITS_TO_LONGS(nvqs)];
     unsigned j;
 
-    memcpy(bitmap, s->batch_notify_vqs, sizeof(bitmap));
-    memset(s->batch_notify_vqs, 0, sizeof(bitmap));
-
     for (j = 0; j < nvqs; j += BITS_PER_LONG) {
-        unsigned long bits = bitmap[j / BITS_PER_LONG];
+        unsigned long *word = &s->batch_notify_vqs[j / BITS_PER_LONG];
+        unsigned long bits = atomic_xchg(word, 0);
 
         while (bits != 0) {
             unsigned i = j + ctzl(bits);
@@ -88,10 +88,11 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     VirtIOBlockDataPlane *s;
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    unsigned i;
 
     *dataplane = NULL;
 
-    if (conf->iothread) {
+    if (conf->iothread || conf->num_vq_iothreads) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -119,14 +120,38 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s = g_new0(VirtIOBlockDataPlane, 1);
     s->vdev = vdev;
     s->conf = conf;
+    s->vq_aio_context = g_new(AioContext *, conf->num_queues);
+
+    if (conf->num_vq_iothreads) {
+        s->num_iothreads = conf->num_vq_iothreads;
+        s->iothreads = g_new(IOThread *, s->num_iothreads);
+        for (i = 0; i < s->num_iothreads; i++) {
+            s->iothreads[i] = conf->vq_iothreads[i];
+            object_ref(OBJECT(s->iothreads[i]));
+        }
+    } else if (conf->iothread) {
+        s->num_iothreads = 1;
+        s->iothreads = g_new(IOThread *, 1);
+        s->iothreads[0] = conf->iothread;
+        object_ref(OBJECT(s->iothreads[0]));
+    }
 
-    if (conf->iothread) {
-        s->iothread = conf->iothread;
-        object_ref(OBJECT(s->iothread));
-        s->ctx = iothread_get_aio_context(s->iothread);
-    } else {
-        s->ctx = qemu_get_aio_context();
+    /*
+     * Virtqueue i is serviced by entry i of the mapping, wrapping around
+     * when there are fewer entries than virtqueues.  The BlockBackend
+     * lives in the AioContext of virtqueue 0; requests popped in other
+     * IOThreads are submitted with its AioContext lock held.
+     */
+    for (i = 0; i < conf->num_queues; i++) {
+        if (s->num_iothreads) {
+            IOThread *iothread = s->iothreads[i % s->num_iothreads];
+
+            s->vq_aio_context[i] = iothread_get_aio_context(iothread);
+        } else {
+            s->vq_aio_context[i] = qemu_get_aio_context();
+        }
     }
+    s->ctx = s->vq_aio_context[0];
     s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
     s->batch_notify_vqs = bitmap_new(conf->num_queues);
 
@@ -139,6 +164,7 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
 void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 {
     VirtIOBlock *vblk;
+    unsigned i;
 
     if (!s) {
         return;
@@ -148,9 +174,11 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
     assert(!vblk->dataplane_started);
     g_free(s->batch_notify_vqs);
     qemu_bh_delete(s->bh);
-    if (s->iothread) {
-        object_unref(OBJECT(s->iothread));
+    for (i = 0; i < s->num_iothreads; i++) {
+        object_unref(OBJECT(s->iothreads[i]));
     }
+    g_free(s->iothreads);
+    g_free(s->vq_aio_context);
     g_free(s);
 }
 
@@ -231,14 +259,15 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     }
 
     /* Get this show started by hooking up our callbacks */
-    aio_context_acquire(s->ctx);
     for (i = 0; i < nvqs; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
+        AioContext *ctx = s->vq_aio_context[i];
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx,
+        aio_context_acquire(ctx);
+        virtio_queue_aio_set_host_notifier_handler(vq, ctx,
                 virtio_blk_data_plane_handle_output);
+        aio_context_release(ctx);
     }
-    aio_context_release(s->ctx);
     return 0;
 
   fail_guest_notifiers:
@@ -253,19 +282,24 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     return -ENOSYS;
 }
 
-/* Stop notifications for new requests from guest.
+/*
+ * Stop notifications for new requests from guest, for the virtqueues
+ * serviced by the current AioContext.
  *
  * Context: BH in IOThread
  */
 static void virtio_blk_data_plane_stop_bh(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
     unsigned i;
 
     for (i = 0; i < s->conf->num_queues; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx, NULL);
+        if (s->vq_aio_context[i] == ctx) {
+            virtio_queue_aio_set_host_notifier_handler(vq, ctx, NULL);
+        }
     }
 }
 
@@ -292,8 +326,26 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     s->stopping = true;
     trace_virtio_blk_data_plane_stop(s);
 
+    for (i = 0; i < nvqs; i++) {
+        AioContext *ctx = s->vq_aio_context[i];
+        unsigned j;
+
+        /* Visit each AioContext once */
+        for (j = 0; j < i; j++) {
+            if (s->vq_aio_context[j] == ctx) {
+                break;
+            }
+        }
+        if (j < i) {
+            continue;
+        }
+
+        aio_context_acquire(ctx);
+        aio_wait_bh_oneshot(ctx, virtio_blk_data_plane_stop_bh, s);
+        aio_context_release(ctx);
+    }
+
     aio_context_acquire(s->ctx);
-    aio_wait_bh_oneshot(s->ctx, virtio_blk_data_plane_stop_bh, s);
 
     /* Drain and try to switch bs back to the QEMU main loop. If other users
      * keep the BlockBackend in the iothread, that's ok */
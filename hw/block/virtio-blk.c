@@ -766,9 +766,20 @@ bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
     MultiReqBuffer mrb = {};
     bool suppress_notifications = virtio_queue_get_notification(vq);
     bool progress = false;
+    AioContext *ctx = blk_get_aio_context(s->blk);
+    /*
+     * With iothread-vq-mapping this virtqueue may be serviced by an
+     * IOThread other than the BlockBackend's.  Requests are then bounced
+     * into the BlockBackend's AioContext by aio_co_enter(), and plugging
+     * from here would touch that context's Linux AIO or io_uring queue
+     * from the wrong thread.
+     */
+    bool plug = qemu_get_current_aio_context() == ctx;
 
-    aio_context_acquire(blk_get_aio_context(s->blk));
-    blk_io_plug(s->blk);
+    aio_context_acquire(ctx);
+    if (plug) {
+        blk_io_plug(s->blk);
+    }
 
     do {
         if (suppress_notifications) {
@@ -793,8 +804,10 @@ bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
         virtio_blk_submit_multireq(s->blk, &mrb);
     }
 
-    blk_io_unplug(s->blk);
-    aio_context_release(blk_get_aio_context(s->blk));
+    if (plug) {
+        blk_io_unplug(s->blk);
+    }
+    aio_context_release(ctx);
     return progress;
 }
 
@@ -1131,6 +1144,42 @@ static const BlockDevOps virtio_block_ops = {
     .resize_cb = virtio_blk_resize,
 };
 
+/*
+ * Resolve the colon-separated list of IOThread ids in the
+ * iothread-vq-mapping property.  Entry i services virtqueue i, wrapping
+ * around when there are fewer entries than virtqueues.
+ */
+static bool virtio_blk_parse_vq_mapping(VirtIOBlkConf *conf, Error **errp)
+{
+    gchar **ids = g_strsplit(conf->iothread_vq_mapping, ":", -1);
+    unsigned n = g_strv_length(ids);
+    unsigned i;
+
+    if (n == 0 || n > conf->num_queues) {
+        error_setg(errp, "iothread-vq-mapping must name between 1 and "
+                   "num-queues (%" PRIu16 ") IOThreads", conf->num_queues);
+        g_strfreev(ids);
+        return false;
+    }
+
+    conf->vq_iothreads = g_new(IOThread *, n);
+    for (i = 0; i < n; i++) {
+        conf->vq_iothreads[i] = iothread_by_id(ids[i]);
+        if (!conf->vq_iothreads[i]) {
+            error_setg(errp, "iothread-vq-mapping: IOThread '%s' not found",
+                       ids[i]);
+            g_free(conf->vq_iothreads);
+            conf->vq_iothreads = NULL;
+            g_strfreev(ids);
+            return false;
+        }
+    }
+    conf->num_vq_iothreads = n;
+
+    g_strfreev(ids);
+    return true;
+}
+
 static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
@@ -1197,6 +1246,17 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    if (conf->iothread_vq_mapping) {
+        if (conf->iothread) {
+            error_setg(errp, "iothread and iothread-vq-mapping properties "
+                       "cannot be set at the same time");
+            return;
+        }
+        if (!virtio_blk_parse_vq_mapping(conf, errp)) {
+            return;
+        }
+    }
+
     virtio_blk_set_config_size(s, s->host_features);
 
     virtio_init(vdev, "virtio-blk", VIRTIO_ID_BLOCK, s->config_size);
@@ -1215,6 +1275,9 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
             virtio_del_queue(vdev, i);
         }
         virtio_cleanup(vdev);
+        g_free(conf->vq_iothreads);
+        conf->vq_iothreads = NULL;
+        conf->num_vq_iothreads = 0;
         return;
     }
 
@@ -1241,6 +1304,9 @@ static void virtio_blk_device_unrealize(DeviceState *dev)
     del_boot_device_lchs(dev, "/disk@0,0");
     virtio_blk_data_plane_destroy(s->dataplane);
     s->dataplane = NULL;
+    g_free(conf->vq_iothreads);
+    conf->vq_iothreads = NULL;
+    conf->num_vq_iothreads = 0;
     for (i = 0; i < conf->num_queues; i++) {
         virtio_del_queue(vdev, i);
     }
@@ -1286,6 +1352,8 @@ static Property virtio_blk_properties[] = {
     DEFINE_PROP_BOOL("seg-max-adjust", VirtIOBlock, conf.seg_max_adjust, true),
     DEFINE_PROP_LINK("iothread", VirtIOBlock, conf.iothread, TYPE_IOTHREAD,
                      IOThread *),
+    DEFINE_PROP_STRING("iothread-vq-mapping", VirtIOBlock,
+                       conf.iothread_vq_mapping),
     DEFINE_PROP_BIT64("discard", VirtIOBlock, host_features,
                       VIRTIO_BLK_F_DISCARD, true),
     DEFINE_PROP_BIT64("write-zeroes", VirtIOBlock, host_features,
@@ -213,6 +213,9 @@ struct AioContext {
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
+
+    /* Use kernel submission queue polling for io_uring rings */
+    bool io_uring_sqpoll;
 #endif
 
     /* TimerLists for calling timers - one per clock type.  Has its own
@@ -491,6 +494,23 @@ struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
 
 /* Return the LuringState bound to this AioContext */
 struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
+#ifdef CONFIG_LINUX_IO_URING
+/**
+ * aio_io_uring_queue_init:
+ * @ctx: the aio context
+ * @entries: number of sq ring entries
+ * @ring: the ring to initialize
+ *
+ * Initialize an io_uring ring that is used from @ctx, honouring the SQPOLL
+ * setting of @ctx.  Rings of the same AioContext share one kernel
+ * submission thread where the kernel supports it.
+ *
+ * Returns 0 on success, -errno on failure.
+ */
+int aio_io_uring_queue_init(AioContext *ctx, unsigned entries,
+                            struct io_uring *ring);
+#endif
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -717,4 +737,19 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+/**
+ * aio_context_set_io_uring_sqpoll:
+ * @ctx: the aio context
+ * @sqpoll: whether to use a kernel thread for io_uring submission
+ *
+ * With SQPOLL the kernel polls the io_uring submission queues of @ctx
+ * from a dedicated thread, so that submitting requests does not need a
+ * system call while that thread is busy.
+ *
+ * This must be called before the event loop of @ctx starts running and
+ * before any block I/O has been submitted through io_uring in @ctx.
+ */
+void aio_context_set_io_uring_sqpoll(AioContext *ctx, bool sqpoll,
+                                     Error **errp);
+
 #endif
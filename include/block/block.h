@@ -794,4 +794,28 @@ int coroutine_fn bdrv_co_copy_range(BdrvChild *src, uint64_t src_offset,
                                     BdrvChild *dst, uint64_t dst_offset,
                                     uint64_t bytes, BdrvRequestFlags read_flags,
                                     BdrvRequestFlags write_flags);
+
+/**
+ * bdrv_co_sendfile:
+ *
+ * Send data from @child directly to the socket @out_fd, without copying it
+ * through a buffer in QEMU (e.g. with sendfile(2)).  This is a normal read
+ * request as far as request tracking is concerned.  @out_fd may be
+ * non-blocking: the call then stops as soon as it would block, like
+ * write(2) does.
+ *
+ * @child: child to read data from
+ * @offset: offset in @child image to read data
+ * @bytes: number of bytes to send
+ * @out_fd: file descriptor of the socket to send the data to
+ * @hdr: if not NULL, data to send to @out_fd before the image data
+ *
+ * Returns: the number of bytes sent, including those of @hdr, which can be
+ * short; -EAGAIN if @out_fd would block before anything was sent; -ENOTSUP,
+ * before anything is sent, if the driver cannot send the data directly;
+ * other negative error codes if nothing could be sent.
+ **/
+int coroutine_fn bdrv_co_sendfile(BdrvChild *child, int64_t offset,
+                                  unsigned int bytes, int out_fd,
+                                  QEMUIOVector *hdr);
 #endif
@@ -289,6 +289,19 @@ struct BlockDriver {
                                               BdrvRequestFlags read_flags,
                                               BdrvRequestFlags write_flags);
 
+    /*
+     * Map [offset, offset + bytes) onto a child of @bs and invoke
+     * bdrv_co_sendfile() on it, or send the data to @out_fd if @bs is a
+     * leaf that stores it 1:1 in a host file.  Return -ENOTSUP, before
+     * anything is sent, if neither is possible.
+     *
+     * See the comment of bdrv_co_sendfile for the parameter and return value
+     * semantics.
+     */
+    int coroutine_fn (*bdrv_co_sendfile)(BlockDriverState *bs,
+                                         uint64_t offset, uint64_t bytes,
+                                         int out_fd, QEMUIOVector *hdr);
+
     /*
      * Building block for bdrv_block_status[_above] and
      * bdrv_is_allocated[_above].  The driver should answer only
@@ -70,6 +70,10 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
                               uint32_t flags,
                               int cflags);
+/* Like tb_gen_code(), but returns NULL if the code buffer is full */
+TranslationBlock *tb_try_gen_code(CPUState *cpu,
+                                  target_ulong pc, target_ulong cs_base,
+                                  uint32_t flags, int cflags);
 
 void QEMU_NORETURN cpu_loop_exit(CPUState *cpu);
 void QEMU_NORETURN cpu_loop_exit_restore(CPUState *cpu, uintptr_t pc);
@@ -251,6 +255,49 @@ void tlb_flush_by_mmuidx_all_cpus(CPUState *cpu, uint16_t idxmap);
  * depend on when the guests translation ends the TB.
  */
 void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *cpu, uint16_t idxmap);
+/**
+ * tlb_flush_range_by_mmuidx:
+ * @cpu: CPU whose TLB should be flushed
+ * @addr: virtual address of the start of the range to be flushed
+ * @len: length of the range to be flushed
+ * @idxmap: bitmap of MMU indexes to flush
+ *
+ * Flush every page overlapping [@addr, @addr + @len) from the TLB of
+ * the specified CPU, for the specified MMU indexes.  The fast TLB and
+ * the victim TLB are walked once for the whole range; if the range is
+ * larger than the TLB, or overlaps a large page, the TLB is flushed
+ * completely instead.
+ */
+void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                               target_ulong len, uint16_t idxmap);
+/**
+ * tlb_flush_range_by_mmuidx_all_cpus:
+ * @cpu: Originating CPU of the flush
+ * @addr: virtual address of the start of the range to be flushed
+ * @len: length of the range to be flushed
+ * @idxmap: bitmap of MMU indexes to flush
+ *
+ * Flush a range of pages from the TLB of all CPUs, for the specified
+ * MMU indexes.
+ */
+void tlb_flush_range_by_mmuidx_all_cpus(CPUState *cpu, target_ulong addr,
+                                        target_ulong len, uint16_t idxmap);
+/**
+ * tlb_flush_range_by_mmuidx_all_cpus_synced:
+ * @cpu: Originating CPU of the flush
+ * @addr: virtual address of the start of the range to be flushed
+ * @len: length of the range to be flushed
+ * @idxmap: bitmap of MMU indexes to flush
+ *
+ * Flush a range of pages from the TLB of all CPUs, for the specified
+ * MMU indexes like tlb_flush_range_by_mmuidx_all_cpus except the source
+ * vCPUs work is scheduled as safe work meaning all flushes will be
+ * complete once the source vCPUs safe work is complete.
+ */
+void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *cpu,
+                                               target_ulong addr,
+                                               target_ulong len,
+                                               uint16_t idxmap);
 /**
  * tlb_set_page_with_attrs:
  * @cpu: CPU to add this TLB entry for
@@ -337,6 +384,22 @@ static inline void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *cpu,
                                                        uint16_t idxmap)
 {
 }
+static inline void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                                             target_ulong len, uint16_t idxmap)
+{
+}
+static inline void tlb_flush_range_by_mmuidx_all_cpus(CPUState *cpu,
+                                                      target_ulong addr,
+                                                      target_ulong len,
+                                                      uint16_t idxmap)
+{
+}
+static inline void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *cpu,
+                                                             target_ulong addr,
+                                                             target_ulong len,
+                                                             uint16_t idxmap)
+{
+}
 #endif
 /**
  * probe_access:
@@ -430,6 +493,7 @@ struct TranslationBlock {
 #define CF_USE_ICOUNT  0x00020000
 #define CF_INVALID     0x00040000 /* TB is stale. Set with @jmp_lock held */
 #define CF_PARALLEL    0x00080000 /* Generate code for a parallel context */
+#define CF_SUPERBLOCK  0x00100000 /* Extend past forward branches */
 #define CF_CLUSTER_MASK 0xff000000 /* Top 8 bits are cluster ID */
 #define CF_CLUSTER_SHIFT 24
 /* cflags' mask for hashing/comparison */
@@ -439,6 +503,12 @@ struct TranslationBlock {
     /* Per-vCPU dynamic tracing state used to generate this TB */
     uint32_t trace_vcpu_dstate;
 
+    /*
+     * Executions left before the TB is translated again as a superblock;
+     * only decremented if tb_counts_hot().
+     */
+    int32_t hot_count;
+
     struct tb_tc tc;
 
     /* original tb when cflags has CF_NOCACHE */
@@ -512,6 +582,13 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
 TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
                                    target_ulong cs_base, uint32_t flags,
                                    uint32_t cf_mask);
+/*
+ * Keep @tb, which tb_jmp_cache is dropping, in the second level lookup
+ * cache of @cpu.  Must be called by the thread of @cpu.
+ */
+void tb_l2_cache_evict(CPUState *cpu, TranslationBlock *tb);
+/* Empty the tb_jmp_cache of @cpu into its second level cache.  */
+void tb_jmp_cache_evict(CPUState *cpu);
 void tb_set_jmp_target(TranslationBlock *tb, int n, uintptr_t addr);
 
 /* GETPC is the true target of the return instruction that we'll execute.  */
@@ -643,4 +720,19 @@ hwaddr memory_region_section_get_iotlb(CPUState *cpu,
 /* vl.c */
 extern int singlestep;
 
+/* Executions after which a TB is translated again as a superblock */
+extern uint32_t superblock_threshold;
+
+/* Whether a TB with @cflags counts its executions in hot_count */
+static inline bool tb_counts_hot(uint32_t cflags)
+{
+#ifdef TARGET_HAS_SUPERBLOCKS
+    return superblock_threshold && !singlestep &&
+           !(cflags & (CF_COUNT_MASK | CF_NOCACHE | CF_USE_ICOUNT |
+                       CF_SUPERBLOCK));
+#else
+    return false;
+#endif
+}
+
 #endif
@@ -69,6 +69,19 @@ static inline void gen_tb_start(TranslationBlock *tb)
     }
 
     tcg_temp_free_i32(count);
+
+    if (tb_counts_hot(tb_cflags(tb))) {
+        TCGv_ptr ptr = tcg_const_tb_ptr(&tb->hot_count);
+
+        count = tcg_temp_new_i32();
+        tcg_gen_ld_i32(count, ptr, 0);
+        tcg_gen_subi_i32(count, count, 1);
+        tcg_gen_st_i32(count, ptr, 0);
+        /* cpu-exec.c notices the negative count and retranslates.  */
+        tcg_gen_brcondi_i32(TCG_COND_LT, count, 0, tcg_ctx->exitreq_label);
+        tcg_temp_free_i32(count);
+        tcg_temp_free_ptr(ptr);
+    }
 }
 
 static inline void gen_tb_end(TranslationBlock *tb, int num_insns)
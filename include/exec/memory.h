@@ -48,6 +48,8 @@
                          TYPE_IOMMU_MEMORY_REGION)
 
 extern bool global_dirty_log;
+/* True while memory_global_dirty_log_sync_direct() runs */
+extern bool global_dirty_log_direct;
 
 typedef struct MemoryRegionOps MemoryRegionOps;
 
@@ -527,6 +529,18 @@ struct MemoryListener {
      */
     void (*log_sync)(MemoryListener *listener, MemoryRegionSection *section);
 
+    /**
+     * @log_sync_global:
+     *
+     * This is the global version of @log_sync when the listener does
+     * not have a way to synchronize the log with finer granularity.
+     * When the listener registers with @log_sync_global defined, then
+     * its @log_sync must be NULL.  Vice versa.
+     *
+     * @listener: The #MemoryListener.
+     */
+    void (*log_sync_global)(MemoryListener *listener);
+
     /**
      * @log_clear:
      *
@@ -1926,6 +1940,18 @@ MemoryRegionSection memory_region_find(MemoryRegion *mr,
  */
 void memory_global_dirty_log_sync(void);
 
+/**
+ * memory_global_dirty_log_sync_direct: synchronize the dirty log for all
+ * memory straight into the migration bitmaps
+ *
+ * Like memory_global_dirty_log_sync(), but listeners may merge the dirty
+ * pages of RAM regions directly into RAMBlock::bmap, see
+ * cpu_physical_memory_merge_dirty_lebitmap(), instead of going through the
+ * DIRTY_MEMORY_MIGRATION bitmap.  Must be called by the migration thread
+ * with the RAM bitmap mutex held.
+ */
+void memory_global_dirty_log_sync_direct(void);
+
 /**
  * memory_global_dirty_log_sync: synchronize the dirty log for all memory
  *
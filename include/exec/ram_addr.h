@@ -422,6 +422,16 @@ bool cpu_physical_memory_test_and_clear_dirty(ram_addr_t start,
                                               ram_addr_t length,
                                               unsigned client);
 
+bool cpu_physical_memory_can_merge_dirty_lebitmap(RAMBlock *rb,
+                                                  ram_addr_t offset,
+                                                  ram_addr_t pages);
+
+uint64_t cpu_physical_memory_merge_dirty_lebitmap(RAMBlock *rb,
+                                                  const unsigned long *bitmap,
+                                                  ram_addr_t offset,
+                                                  ram_addr_t pages,
+                                                  uint64_t *real_dirty_pages);
+
 DirtyBitmapSnapshot *cpu_physical_memory_snapshot_and_clear_dirty
     (MemoryRegion *mr, hwaddr offset, hwaddr length, unsigned client);
 
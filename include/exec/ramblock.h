@@ -59,6 +59,24 @@ struct RAMBlock {
      */
     unsigned long *clear_bmap;
     uint8_t clear_bmap_shift;
+
+    /*
+     * Pages merged straight into @bmap by the accelerator during
+     * memory_global_dirty_log_sync_direct() that migration has not
+     * accounted for yet: all dirty pages reported, and the subset that
+     * was not already set in @bmap.  Protected by the RAM bitmap mutex.
+     */
+    uint64_t merged_dirty_pages;
+    uint64_t merged_new_dirty_pages;
+
+    /*
+     * Mapped RAM (see migration/ram.c): bitmap of the pages that are
+     * stored in the file, and file offsets of that bitmap and of the
+     * pages of the block.
+     */
+    unsigned long *file_bmap;
+    uint64_t bitmap_offset;
+    uint64_t pages_offset;
 };
 #endif
 #endif
@@ -0,0 +1,55 @@
+/*
+ * Background translation of hot translation blocks
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef EXEC_TB_ASYNC_H
+#define EXEC_TB_ASYNC_H
+
+#include "exec/exec-all.h"
+
+#ifdef CONFIG_USER_ONLY
+/*
+ * tb_async_init:
+ * @threads: number of translator threads
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Start @threads threads that translate superblocks in the background.
+ * Must be called after tcg_region_init() and before any vCPU runs.
+ *
+ * Returns true on success.
+ */
+bool tb_async_init(unsigned int threads, Error **errp);
+
+/*
+ * tb_async_promote:
+ * @cpu: the vCPU that found @tb hot
+ * @tb: a TB whose hot_count has gone negative
+ *
+ * Queue the translation of a superblock replacing @tb.  Until it is
+ * ready, @tb keeps running without counting.  Returns false if there
+ * are no translator threads or too many requests are pending; the
+ * caller must then translate the superblock itself.
+ */
+bool tb_async_promote(CPUState *cpu, TranslationBlock *tb);
+
+/*
+ * tb_async_fork_start:
+ * tb_async_fork_end:
+ * @child: true in the child process
+ *
+ * Keep the request queue consistent across fork().  The child has no
+ * translator threads and translates superblocks synchronously.
+ */
+void tb_async_fork_start(void);
+void tb_async_fork_end(int child);
+#else
+static inline bool tb_async_promote(CPUState *cpu, TranslationBlock *tb)
+{
+    return false;
+}
+#endif
+
+#endif /* EXEC_TB_ASYNC_H */
@@ -0,0 +1,69 @@
+/*
+ * Persistent translation block cache
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef EXEC_TB_CACHE_H
+#define EXEC_TB_CACHE_H
+
+#include "exec/exec-all.h"
+
+/*
+ * tb_cache_init:
+ * @path: file holding the cache
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Prepare the TB cache: from now on, translations record what is needed
+ * to move them to another process.  Must be called after
+ * tcg_prologue_init() and before any vCPU thread is created.  The cache
+ * is only used once tb_cache_start() has been called.
+ *
+ * Returns true on success.
+ */
+bool tb_cache_init(const char *path, Error **errp);
+
+/*
+ * tb_cache_start:
+ * @cpu: a vCPU with the configuration of all the others
+ * @config: bytes identifying the rest of the guest configuration
+ * @config_len: length of @config
+ *
+ * Read the cache file given to tb_cache_init().  Code cached there is
+ * reused if it was generated by the same QEMU binary on the same host
+ * for the same CPU model, CPU properties and @config; anything else in
+ * the file is discarded by tb_cache_save().  Must be called before any
+ * vCPU runs.  Does nothing if tb_cache_init() failed or was not called.
+ */
+void tb_cache_start(CPUState *cpu, const void *config, size_t config_len);
+
+/*
+ * tb_cache_save:
+ *
+ * Write the cache back to its file if new code has been translated.
+ */
+void tb_cache_save(void);
+
+/*
+ * tb_cache_load:
+ * @cpu: the vCPU translating @tb
+ * @tb: a TB freshly allocated by tcg_tb_alloc(), with its lookup fields set
+ * @search_size: set to the size of the search data following the code
+ *
+ * Fill in @tb from the cache if the guest code it was translated from
+ * is unchanged.  Returns true on a hit.
+ */
+bool tb_cache_load(CPUState *cpu, TranslationBlock *tb, int *search_size);
+
+/*
+ * tb_cache_store:
+ * @cpu: the vCPU that translated @tb
+ * @tb: a TB just generated by tcg_gen_code()
+ * @search_size: the size of the search data following the code
+ *
+ * Add @tb to the cache if its code can be moved to another process.
+ */
+void tb_cache_store(CPUState *cpu, TranslationBlock *tb, int search_size);
+
+#endif /* EXEC_TB_CACHE_H */
@@ -22,7 +22,7 @@ tb_lookup__cpu_state(CPUState *cpu, target_ulong *pc, target_ulong *cs_base,
                      uint32_t *flags, uint32_t cf_mask)
 {
     CPUArchState *env = (CPUArchState *)cpu->env_ptr;
-    TranslationBlock *tb;
+    TranslationBlock *tb, *old;
     uint32_t hash;
 
     cpu_get_tb_cpu_state(env, pc, cs_base, flags);
@@ -40,7 +40,10 @@ tb_lookup__cpu_state(CPUState *cpu, target_ulong *pc, target_ulong *cs_base,
                (tb_cflags(tb) & (CF_HASH_MASK | CF_INVALID)) == cf_mask)) {
         return tb;
     }
+    old = tb;
     tb = tb_htable_lookup(cpu, *pc, *cs_base, *flags, cf_mask);
+    /* Whatever the entry holds is about to be replaced.  */
+    tb_l2_cache_evict(cpu, old);
     if (tb == NULL) {
         return NULL;
     }
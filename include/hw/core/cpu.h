@@ -261,12 +261,32 @@ struct CPUWatchpoint {
 
 struct KVMState;
 struct kvm_run;
+struct kvm_dirty_gfn;
 
 struct hax_vcpu_state;
 
 #define TB_JMP_CACHE_BITS 12
 #define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
 
+/*
+ * Second level TB lookup cache, consulted when tb_jmp_cache misses.  It
+ * holds the TBs that tb_jmp_cache evicts, whether to make room for
+ * another TB or because the TLB was flushed.  It is indexed by the TB
+ * hash, which includes the physical PC, so unlike tb_jmp_cache it need
+ * not be flushed together with the TLB.  With twice as many entries as
+ * tb_jmp_cache, it can hold all of tb_jmp_cache across a full TLB flush.
+ */
+#define TB_L2_CACHE_BITS 11
+#define TB_L2_CACHE_SETS (1 << TB_L2_CACHE_BITS)
+#define TB_L2_CACHE_WAYS 4
+
+typedef struct TBL2Cache {
+    /* Each set is kept in most recently used order */
+    struct TranslationBlock *tb[TB_L2_CACHE_SETS][TB_L2_CACHE_WAYS];
+    size_t lookups;
+    size_t hits;
+} TBL2Cache;
+
 /* work queue */
 
 /* The union type allows passing of 64 bit target pointers on 32 bit
@@ -331,6 +351,8 @@ struct qemu_work_item;
  * @opaque: User data.
  * @mem_io_pc: Host Program Counter at which the memory was accessed.
  * @kvm_fd: vCPU file descriptor for KVM.
+ * @kvm_dirty_gfns: KVM dirty ring of this vCPU, if enabled.
+ * @kvm_fetch_index: Next entry of @kvm_dirty_gfns to harvest.
  * @work_mutex: Lock to prevent multiple access to @work_list.
  * @work_list: List of pending asynchronous work.
  * @trace_dstate_delayed: Delayed changes to trace_dstate (includes all changes
@@ -389,6 +411,9 @@ struct CPUState {
     /* Accessed in parallel; all accesses must be atomic */
     struct TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
 
+    /* Private to the vCPU thread, except for tb_flush */
+    TBL2Cache tb_l2_cache;
+
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
     int gdb_num_g_regs;
@@ -410,6 +435,8 @@ struct CPUState {
     int kvm_fd;
     struct KVMState *kvm_state;
     struct kvm_run *kvm_run;
+    struct kvm_dirty_gfn *kvm_dirty_gfns;
+    uint32_t kvm_fetch_index;
 
     /* Used for events with 'vcpu' and *without* the 'disabled' properties */
     DECLARE_BITMAP(trace_dstate_delayed, CPU_TRACE_DSTATE_MAX_EVENTS);
@@ -464,6 +491,11 @@ static inline void cpu_tb_jmp_cache_clear(CPUState *cpu)
     }
 }
 
+static inline void cpu_tb_l2_cache_clear(CPUState *cpu)
+{
+    memset(cpu->tb_l2_cache.tb, 0, sizeof(cpu->tb_l2_cache.tb));
+}
+
 /**
  * qemu_tcg_mttcg_enabled:
  * Check whether we are running MultiThread TCG or not.
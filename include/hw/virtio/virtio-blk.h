@@ -34,6 +34,9 @@ struct VirtIOBlkConf
 {
     BlockConf conf;
     IOThread *iothread;
+    char *iothread_vq_mapping;
+    IOThread **vq_iothreads;
+    unsigned num_vq_iothreads;
     char *serial;
     uint32_t request_merging;
     uint16_t num_queues;
@@ -162,6 +162,9 @@ char *size_to_str(uint64_t val);
 #define STR_OR_NULL(str) ((str) ? (str) : "null")
 
 bool buffer_is_zero(const void *buf, size_t len);
+size_t buffer_find_nonzero_offset(const void *buf, size_t len);
+void buffer_zero_bitmap(const void *buf, size_t len, size_t granularity,
+                        unsigned long *bitmap);
 bool test_buffer_is_zero_next_accel(void);
 
 /*
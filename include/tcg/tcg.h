@@ -151,6 +151,9 @@ typedef uint64_t TCGRegSet;
 #ifndef TCG_TARGET_extract_i64_valid
 #define TCG_TARGET_extract_i64_valid(ofs, len) 1
 #endif
+#ifndef TCG_TARGET_HAS_tb_relocs
+#define TCG_TARGET_HAS_tb_relocs        0
+#endif
 
 /* Only one of DIV or DIV2 should be defined.  */
 #if defined(TCG_TARGET_HAS_div_i32)
@@ -278,6 +281,29 @@ typedef struct TCGPool {
 #define TCG_MAX_TEMPS 512
 #define TCG_MAX_INSNS 512
 
+/*
+ * Host addresses outside the TB that the generated code refers to,
+ * recorded so that tb-cache.c can move the code to another process.
+ */
+#define TCG_MAX_TB_RELOCS 256
+
+typedef enum TCGTBRelocBase {
+    TCG_TB_RELOC_PROLOGUE,      /* the prologue and epilogue */
+    TCG_TB_RELOC_TEXT,          /* functions in the QEMU binary */
+} TCGTBRelocBase;
+
+typedef enum TCGTBRelocKind {
+    TCG_TB_RELOC_PCREL32,       /* 32-bit pc-relative displacement */
+    TCG_TB_RELOC_ABS64,         /* 64-bit absolute address */
+} TCGTBRelocKind;
+
+typedef struct TCGTBReloc {
+    uint32_t offset;            /* of the field within the code */
+    uint16_t base;              /* TCGTBRelocBase */
+    uint16_t kind;              /* TCGTBRelocKind */
+    intptr_t addend;            /* target address minus the base */
+} TCGTBReloc;
+
 /* when the size of the arguments of a called function is smaller than
    this value, they are statically allocated in the TB stack frame */
 #define TCG_STATIC_CALL_ARGS_SIZE 128
@@ -598,6 +624,12 @@ struct TCGContext {
     uintptr_t *tb_jmp_insn_offset; /* tb->jmp_target_arg if direct_jump */
     uintptr_t *tb_jmp_target_addr; /* tb->jmp_target_arg if !direct_jump */
 
+    /* TB cache support */
+    bool tb_record_relocs;      /* generate code that can be moved */
+    bool tb_relocatable;        /* the current TB can be moved */
+    int nb_tb_relocs;
+    uintptr_t tb_start;         /* descriptor of the current TB */
+
     TCGRegSet reserved_regs;
     uint32_t tb_cflags; /* cflags of the current TB */
     intptr_t current_frame_offset;
@@ -675,6 +707,8 @@ struct TCGContext {
 
     uint16_t gen_insn_end_off[TCG_MAX_INSNS];
     target_ulong gen_insn_data[TCG_MAX_INSNS][TARGET_INSN_START_WORDS];
+
+    TCGTBReloc tb_relocs[TCG_MAX_TB_RELOCS];
 };
 
 extern TCGContext tcg_init_ctx;
@@ -857,6 +891,7 @@ void tcg_prologue_init(TCGContext *s);
 void tcg_func_start(TCGContext *s);
 
 int tcg_gen_code(TCGContext *s, TranslationBlock *tb);
+uintptr_t tcg_tb_reloc_base(TCGTBRelocBase base);
 
 void tcg_set_frame(TCGContext *s, TCGReg reg, intptr_t start, intptr_t size);
 
@@ -995,6 +1030,8 @@ enum {
     TCG_OPF_NOT_PRESENT  = 0x20,
     /* Instruction operands are vectors.  */
     TCG_OPF_VECTOR       = 0x40,
+    /* Instruction is a conditional branch. */
+    TCG_OPF_COND_BRANCH  = 0x80
 };
 
 typedef struct TCGOpDef {
@@ -1042,12 +1079,31 @@ TCGv_vec tcg_const_ones_vec(TCGType);
 TCGv_vec tcg_const_zeros_vec_matching(TCGv_vec);
 TCGv_vec tcg_const_ones_vec_matching(TCGv_vec);
 
+/*
+ * A host pointer in the opcode stream ties the TB to this process,
+ * so such TBs are kept out of the TB cache.
+ */
+static inline intptr_t tcg_host_ptr_arg(intptr_t ptr)
+{
+    if (ptr) {
+        tcg_ctx->tb_relocatable = false;
+    }
+    return ptr;
+}
+
+/* Pointers into the TB being generated move with it, though.  */
 #if UINTPTR_MAX == UINT32_MAX
-# define tcg_const_ptr(x)        ((TCGv_ptr)tcg_const_i32((intptr_t)(x)))
-# define tcg_const_local_ptr(x)  ((TCGv_ptr)tcg_const_local_i32((intptr_t)(x)))
+# define tcg_const_ptr(x)        \
+    ((TCGv_ptr)tcg_const_i32(tcg_host_ptr_arg((intptr_t)(x))))
+# define tcg_const_local_ptr(x)  \
+    ((TCGv_ptr)tcg_const_local_i32(tcg_host_ptr_arg((intptr_t)(x))))
+# define tcg_const_tb_ptr(x)     ((TCGv_ptr)tcg_const_i32((intptr_t)(x)))
 #else
-# define tcg_const_ptr(x)        ((TCGv_ptr)tcg_const_i64((intptr_t)(x)))
-# define tcg_const_local_ptr(x)  ((TCGv_ptr)tcg_const_local_i64((intptr_t)(x)))
+# define tcg_const_ptr(x)        \
+    ((TCGv_ptr)tcg_const_i64(tcg_host_ptr_arg((intptr_t)(x))))
+# define tcg_const_local_ptr(x)  \
+    ((TCGv_ptr)tcg_const_local_i64(tcg_host_ptr_arg((intptr_t)(x))))
+# define tcg_const_tb_ptr(x)     ((TCGv_ptr)tcg_const_i64((intptr_t)(x)))
 #endif
 
 TCGLabel *gen_new_label(void);
@@ -181,6 +181,15 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
      */
     iothread_init_gcontext(iothread);
 
+    aio_context_set_io_uring_sqpoll(iothread->ctx, iothread->io_uring_sqpoll,
+                                    &local_error);
+    if (local_error) {
+        error_propagate(errp, local_error);
+        aio_context_unref(iothread->ctx);
+        iothread->ctx = NULL;
+        return;
+    }
+
     aio_context_set_poll_params(iothread->ctx,
                                 iothread->poll_max_ns,
                                 iothread->poll_grow,
@@ -268,6 +277,26 @@ out:
     error_propagate(errp, local_err);
 }
 
+static bool iothread_get_io_uring_sqpoll(Object *obj, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    return iothread->io_uring_sqpoll;
+}
+
+static void iothread_set_io_uring_sqpoll(Object *obj, bool value,
+                                         Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    if (iothread->ctx) {
+        error_setg(errp, "io-uring-sqpoll cannot be changed at run-time");
+        return;
+    }
+
+    iothread->io_uring_sqpoll = value;
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     UserCreatableClass *ucc = USER_CREATABLE_CLASS(klass);
@@ -285,6 +314,9 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info);
+    object_class_property_add_bool(klass, "io-uring-sqpoll",
+                                   iothread_get_io_uring_sqpoll,
+                                   iothread_set_io_uring_sqpoll);
 }
 
 static const TypeInfo iothread_info = {
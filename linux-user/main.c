@@ -38,6 +38,8 @@
 #include "qemu/plugin.h"
 #include "cpu.h"
 #include "exec/exec-all.h"
+#include "exec/tb-async.h"
+#include "exec/tb-cache.h"
 #include "tcg/tcg.h"
 #include "qemu/timer.h"
 #include "qemu/envlist.h"
@@ -57,6 +59,8 @@ static envlist_t *envlist;
 static const char *cpu_model;
 static const char *cpu_type;
 static const char *seed_optarg;
+static const char *tb_cache_path;
+static unsigned int tb_async_threads;
 unsigned long mmap_min_addr;
 unsigned long guest_base;
 bool have_guest_base;
@@ -128,11 +132,13 @@ void fork_start(void)
 {
     start_exclusive();
     mmap_fork_start();
+    tb_async_fork_start();
     cpu_list_lock();
 }
 
 void fork_end(int child)
 {
+    tb_async_fork_end(child);
     mmap_fork_end(child);
     if (child) {
         CPUState *cpu, *next_cpu;
@@ -374,6 +380,30 @@ static void handle_arg_singlestep(const char *arg)
     singlestep = 1;
 }
 
+static void handle_arg_tb_cache(const char *arg)
+{
+    tb_cache_path = arg;
+}
+
+static void handle_arg_superblock_threshold(const char *arg)
+{
+    unsigned int value;
+
+    if (qemu_strtoui(arg, NULL, 0, &value) < 0 || value > INT32_MAX) {
+        fprintf(stderr, "Invalid superblock threshold '%s'\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    superblock_threshold = value;
+}
+
+static void handle_arg_tb_async_threads(const char *arg)
+{
+    if (qemu_strtoui(arg, NULL, 0, &tb_async_threads) < 0) {
+        fprintf(stderr, "Invalid number of translator threads '%s'\n", arg);
+        exit(EXIT_FAILURE);
+    }
+}
+
 static void handle_arg_strace(const char *arg)
 {
     enable_strace = true;
@@ -454,6 +484,15 @@ static const struct qemu_argument arg_table[] = {
      "pagesize",   "set the host page size to 'pagesize'"},
     {"singlestep", "QEMU_SINGLESTEP",  false, handle_arg_singlestep,
      "",           "run in singlestep mode"},
+    {"tb-cache",   "QEMU_TB_CACHE",    true,  handle_arg_tb_cache,
+     "file",       "keep translated code in 'file' between runs "
+                   "(host code: 'file' must be trusted)"},
+    {"superblock-threshold", "QEMU_SUPERBLOCK_THRESHOLD",
+     true, handle_arg_superblock_threshold,
+     "count",      "retranslate TBs run 'count' times as superblocks"},
+    {"tb-async-threads", "QEMU_TB_ASYNC_THREADS",
+     true, handle_arg_tb_async_threads,
+     "n",          "translate superblocks in 'n' background threads"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
     {"seed",       "QEMU_RAND_SEED",   true,  handle_arg_seed,
@@ -838,6 +877,26 @@ int main(int argc, char **argv, char **envp)
     tcg_prologue_init(tcg_ctx);
     tcg_region_init();
 
+    if (tb_cache_path) {
+        Error *err = NULL;
+
+        /* The CPU is configured; guest_base is folded into the code.  */
+        if (tb_cache_init(tb_cache_path, &err)) {
+            tb_cache_start(cpu, &guest_base, sizeof(guest_base));
+        } else {
+            warn_reportf_err(err, "TB cache disabled: ");
+        }
+    }
+
+    if (tb_async_threads) {
+        Error *err = NULL;
+
+        if (!tb_async_init(tb_async_threads, &err)) {
+            error_report_err(err);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     target_cpu_copy_regs(env, regs);
 
     if (gdbstub) {
@@ -41,6 +41,7 @@ static unsigned memory_region_transaction_depth;
 static bool memory_region_update_pending;
 static bool ioeventfd_update_pending;
 bool global_dirty_log;
+bool global_dirty_log_direct;
 
 static QTAILQ_HEAD(, MemoryListener) memory_listeners
     = QTAILQ_HEAD_INITIALIZER(memory_listeners);
@@ -2019,6 +2020,14 @@ static void memory_region_sync_dirty_bitmap(MemoryRegion *mr)
      * address space once.
      */
     QTAILQ_FOREACH(listener, &memory_listeners, link) {
+        if (listener->log_sync_global) {
+            /*
+             * The listener cannot sync a single region, so sync
+             * everything whether or not @mr was specified.
+             */
+            listener->log_sync_global(listener);
+            continue;
+        }
         if (!listener->log_sync) {
             continue;
         }
@@ -2598,6 +2607,13 @@ void memory_global_dirty_log_sync(void)
     memory_region_sync_dirty_bitmap(NULL);
 }
 
+void memory_global_dirty_log_sync_direct(void)
+{
+    global_dirty_log_direct = true;
+    memory_region_sync_dirty_bitmap(NULL);
+    global_dirty_log_direct = false;
+}
+
 void memory_global_after_dirty_log_sync(void)
 {
     MEMORY_LISTENER_CALL_GLOBAL(log_global_after_sync, Forward);
@@ -1082,6 +1082,20 @@ static bool migrate_caps_check(bool *cap_list,
         }
     }
 
+    if (cap_list[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE] &&
+        !cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+        error_setg(errp, "Multifd zero page detection requires multifd");
+        return false;
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MAPPED_RAM] &&
+        (cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM] ||
+         cap_list[MIGRATION_CAPABILITY_X_IGNORE_SHARED])) {
+        error_setg(errp, "Mapped RAM is not compatible with postcopy-ram "
+                   "and x-ignore-shared");
+        return false;
+    }
+
     return true;
 }
 
@@ -2278,6 +2292,24 @@ bool migrate_use_multifd(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+bool migrate_use_multifd_zero_page(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE];
+}
+
+bool migrate_mapped_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
+}
+
 bool migrate_pause_before_switchover(void)
 {
     MigrationState *s;
@@ -3174,7 +3206,7 @@ static MigThrError migration_detect_error(MigrationState *s)
 /* How many bytes have we transferred since the beginning of the migration */
 static uint64_t migration_total_bytes(MigrationState *s)
 {
-    return qemu_ftell(s->to_dst_file) + ram_counters.multifd_bytes;
+    return qemu_file_transferred(s->to_dst_file) + ram_counters.multifd_bytes;
 }
 
 static void migration_calculate_complete(MigrationState *s)
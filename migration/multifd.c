@@ -12,6 +12,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/rcu.h"
+#include "qemu/cutils.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
 #include "exec/ramblock.h"
@@ -258,6 +259,70 @@ static void multifd_pages_clear(MultiFDPages_t *pages)
     g_free(pages);
 }
 
+/**
+ * multifd_send_zero_page_detect: find the zero pages of a packet
+ *
+ * Zero pages only need their offset sent.  Reorder the pages so that
+ * the ones with data come first and the zero ones last, and record in
+ * p->zero_num how many zero pages there are.  Order does not matter to
+ * the destination, which places every page at its own offset.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void multifd_send_zero_page_detect(MultiFDSendParams *p)
+{
+    MultiFDPages_t *pages = p->pages;
+    size_t page_size = qemu_target_page_size();
+    uint32_t i = 0;
+    uint32_t j = pages->used;
+
+    if (!migrate_use_multifd_zero_page()) {
+        p->zero_num = 0;
+        return;
+    }
+
+    /* pages [0, i) have data, pages [j, used) are zero */
+    while (i < j) {
+        if (!buffer_is_zero(pages->iov[i].iov_base, page_size)) {
+            i++;
+        } else {
+            j--;
+            if (i != j) {
+                struct iovec iov = pages->iov[i];
+                ram_addr_t offset = pages->offset[i];
+
+                pages->iov[i] = pages->iov[j];
+                pages->offset[i] = pages->offset[j];
+                pages->iov[j] = iov;
+                pages->offset[j] = offset;
+            }
+        }
+    }
+    p->zero_num = pages->used - i;
+}
+
+/**
+ * multifd_send_account_zero_pages: fix up the counters for zero pages
+ *
+ * multifd_send_pages() accounts every queued page as a normal page, as
+ * only the channel thread knows which ones turned out to be zero.
+ * Called with p->mutex held.
+ *
+ * @f: QEMUFile where the migration is being sent
+ * @p: Params for the channel that we are using
+ */
+static void multifd_send_account_zero_pages(QEMUFile *f, MultiFDSendParams *p)
+{
+    uint64_t bytes = p->zero_pages * qemu_target_page_size();
+
+    ram_counters.normal -= p->zero_pages;
+    ram_counters.duplicate += p->zero_pages;
+    ram_counters.multifd_bytes -= bytes;
+    ram_counters.transferred -= bytes;
+    qemu_file_update_transfer(f, -(int64_t)bytes);
+    p->zero_pages = 0;
+}
+
 static void multifd_send_fill_packet(MultiFDSendParams *p)
 {
     MultiFDPacket_t *packet = p->packet;
@@ -265,7 +330,8 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
 
     packet->flags = cpu_to_be32(p->flags);
     packet->pages_alloc = cpu_to_be32(p->pages->allocated);
-    packet->pages_used = cpu_to_be32(p->pages->used);
+    packet->pages_used = cpu_to_be32(p->pages->used - p->zero_num);
+    packet->zero_pages = cpu_to_be32(p->zero_num);
     packet->next_packet_size = cpu_to_be32(p->next_packet_size);
     packet->packet_num = cpu_to_be64(p->packet_num);
 
@@ -327,17 +393,26 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
     }
 
     p->pages->used = be32_to_cpu(packet->pages_used);
-    if (p->pages->used > packet->pages_alloc) {
+    p->zero_num = be32_to_cpu(packet->zero_pages);
+    if (p->pages->used > packet->pages_alloc ||
+        p->zero_num > packet->pages_alloc - p->pages->used) {
         error_setg(errp, "multifd: received packet "
-                   "with %d pages and expected maximum pages are %d",
-                   p->pages->used, packet->pages_alloc) ;
+                   "with %d pages and %d zero pages and expected "
+                   "maximum pages are %d",
+                   p->pages->used, p->zero_num, packet->pages_alloc);
+        return -1;
+    }
+
+    if (p->zero_num && !migrate_use_multifd_zero_page()) {
+        error_setg(errp, "multifd: received zero pages but the "
+                   "multifd-zero-page capability is not enabled");
         return -1;
     }
 
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
 
-    if (p->pages->used == 0) {
+    if (p->pages->used + p->zero_num == 0) {
         return 0;
     }
 
@@ -350,7 +425,7 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
-    for (i = 0; i < p->pages->used; i++) {
+    for (i = 0; i < p->pages->used + p->zero_num; i++) {
         uint64_t offset = be64_to_cpu(packet->offset[i]);
 
         if (offset > (block->used_length - qemu_target_page_size())) {
@@ -448,6 +523,7 @@ static int multifd_send_pages(QEMUFile *f)
     qemu_file_update_transfer(f, transferred);
     ram_counters.multifd_bytes += transferred;
     ram_counters.transferred += transferred;;
+    multifd_send_account_zero_pages(f, p);
     qemu_mutex_unlock(&p->mutex);
     qemu_sem_post(&p->sem);
 
@@ -608,6 +684,10 @@ void multifd_send_sync_main(QEMUFile *f)
 
         trace_multifd_send_sync_main_wait(p->id);
         qemu_sem_wait(&p->sem_sync);
+
+        WITH_QEMU_LOCK_GUARD(&p->mutex) {
+            multifd_send_account_zero_pages(f, p);
+        }
     }
     trace_multifd_send_sync_main(multifd_send_state->packet_num);
 }
@@ -638,10 +718,13 @@ static void *multifd_send_thread(void *opaque)
         qemu_mutex_lock(&p->mutex);
 
         if (p->pending_job) {
-            uint32_t used = p->pages->used;
+            uint32_t used;
             uint64_t packet_num = p->packet_num;
             flags = p->flags;
 
+            multifd_send_zero_page_detect(p);
+            used = p->pages->used - p->zero_num;
+
             if (used) {
                 ret = multifd_send_state->ops->send_prepare(p, used,
                                                             &local_err);
@@ -654,11 +737,13 @@ static void *multifd_send_thread(void *opaque)
             p->flags = 0;
             p->num_packets++;
             p->num_pages += used;
+            p->num_zero_pages += p->zero_num;
+            p->zero_pages += p->zero_num;
             p->pages->used = 0;
             p->pages->block = NULL;
             qemu_mutex_unlock(&p->mutex);
 
-            trace_multifd_send(p->id, packet_num, used, flags,
+            trace_multifd_send(p->id, packet_num, used, p->zero_num, flags,
                                p->next_packet_size);
 
             ret = qio_channel_write_all(p->c, (void *)p->packet,
@@ -919,6 +1004,7 @@ static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
     Error *local_err = NULL;
+    uint32_t i;
     int ret;
 
     trace_multifd_recv_thread_start(p->id);
@@ -926,6 +1012,7 @@ static void *multifd_recv_thread(void *opaque)
 
     while (true) {
         uint32_t used;
+        uint32_t zero_num;
         uint32_t flags;
 
         if (p->quit) {
@@ -949,13 +1036,15 @@ static void *multifd_recv_thread(void *opaque)
         }
 
         used = p->pages->used;
+        zero_num = p->zero_num;
         flags = p->flags;
         /* recv methods don't know how to handle the SYNC flag */
         p->flags &= ~MULTIFD_FLAG_SYNC;
-        trace_multifd_recv(p->id, p->packet_num, used, flags,
+        trace_multifd_recv(p->id, p->packet_num, used, zero_num, flags,
                            p->next_packet_size);
         p->num_packets++;
         p->num_pages += used;
+        p->num_zero_pages += zero_num;
         qemu_mutex_unlock(&p->mutex);
 
         if (used) {
@@ -965,6 +1054,12 @@ static void *multifd_recv_thread(void *opaque)
             }
         }
 
+        /* zero pages follow the ones with data */
+        for (i = used; i < used + zero_num; i++) {
+            ram_handle_compressed(p->pages->iov[i].iov_base, 0,
+                                  p->pages->iov[i].iov_len);
+        }
+
         if (flags & MULTIFD_FLAG_SYNC) {
             qemu_sem_post(&multifd_recv_state->sem_sync);
             qemu_sem_wait(&p->sem_sync);
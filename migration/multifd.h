@@ -46,7 +46,13 @@ typedef struct {
     /* size of the next packet that contains pages */
     uint32_t next_packet_size;
     uint64_t packet_num;
-    uint64_t unused[4];    /* Reserved for future use */
+    /*
+     * number of zero pages; their offsets follow the ones of the
+     * pages_used pages that carry data
+     */
+    uint32_t zero_pages;
+    uint32_t unused32[1];    /* Reserved for future use */
+    uint64_t unused64[3];    /* Reserved for future use */
     char ramblock[256];
     uint64_t offset[];
 } __attribute__((packed)) MultiFDPacket_t;
@@ -97,11 +103,17 @@ typedef struct {
     uint32_t next_packet_size;
     /* global number of generated multifd packets */
     uint64_t packet_num;
+    /* zero pages found but not yet accounted by the migration thread */
+    uint64_t zero_pages;
     /* thread local variables */
+    /* number of zero pages in the packet being sent */
+    uint32_t zero_num;
     /* packets sent through this channel */
     uint64_t num_packets;
     /* pages sent through this channel */
     uint64_t num_pages;
+    /* zero pages sent through this channel */
+    uint64_t num_zero_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
     /* used for compression methods */
@@ -137,10 +149,14 @@ typedef struct {
     /* thread local variables */
     /* size of the next packet that contains pages */
     uint32_t next_packet_size;
+    /* number of zero pages in the packet being received */
+    uint32_t zero_num;
     /* packets sent through this channel */
     uint64_t num_packets;
     /* pages sent through this channel */
     uint64_t num_pages;
+    /* zero pages sent through this channel */
+    uint64_t num_zero_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
     /* used for de-compression methods */
@@ -26,7 +26,9 @@
 #include "qemu-file-channel.h"
 #include "qemu-file.h"
 #include "io/channel-socket.h"
+#include "io/channel-file.h"
 #include "qemu/iov.h"
+#include "qapi/error.h"
 
 
 static ssize_t channel_writev_buffer(void *opaque,
@@ -160,6 +162,115 @@ static QEMUFile *channel_get_output_return_path(void *opaque)
     return qemu_fopen_channel_input(ioc);
 }
 
+#ifndef _WIN32
+/*
+ * Positional I/O on a migration stream that goes to a regular file; see
+ * channel_is_seekable().  These may be called from several threads at
+ * once.
+ */
+static ssize_t channel_file_prw(void *opaque, struct iovec *iov, int iovcnt,
+                                int64_t pos, bool is_write, Error **errp)
+{
+    int fd = QIO_CHANNEL_FILE(opaque)->fd;
+    ssize_t done = 0;
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        size_t offset = 0;
+
+        while (offset < iov[i].iov_len) {
+            void *buf = iov[i].iov_base + offset;
+            size_t size = iov[i].iov_len - offset;
+            ssize_t len;
+
+            if (is_write) {
+                len = pwrite(fd, buf, size, pos + done);
+            } else {
+                len = pread(fd, buf, size, pos + done);
+            }
+            if (len < 0 && errno == EINTR) {
+                continue;
+            }
+            if (len < 0) {
+                int ret = -errno;
+
+                error_setg_errno(errp, errno, "Unable to %s migration file",
+                                 is_write ? "write" : "read");
+                return ret;
+            }
+            if (len == 0) {
+                error_setg(errp, "Unexpected end of migration file");
+                return -EIO;
+            }
+            offset += len;
+            done += len;
+        }
+    }
+
+    return done;
+}
+
+static ssize_t channel_file_pwritev(void *opaque, struct iovec *iov,
+                                    int iovcnt, int64_t pos, Error **errp)
+{
+    return channel_file_prw(opaque, iov, iovcnt, pos, true, errp);
+}
+
+static ssize_t channel_file_preadv(void *opaque, struct iovec *iov,
+                                   int iovcnt, int64_t pos, Error **errp)
+{
+    return channel_file_prw(opaque, iov, iovcnt, pos, false, errp);
+}
+
+static int channel_file_seek(void *opaque, int64_t pos, Error **errp)
+{
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+
+    if (qio_channel_io_seek(ioc, pos, SEEK_SET, errp) < 0) {
+        return -EIO;
+    }
+    return 0;
+}
+
+/*
+ * Stream positions are file offsets, so this only holds for a regular
+ * file whose stream starts at the beginning.
+ */
+static bool channel_is_seekable(QIOChannel *ioc)
+{
+    struct stat st;
+    int fd;
+
+    if (!object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_FILE)) {
+        return false;
+    }
+
+    fd = QIO_CHANNEL_FILE(ioc)->fd;
+    return fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+           lseek(fd, 0, SEEK_CUR) == 0;
+}
+
+static const QEMUFileOps channel_file_input_ops = {
+    .get_buffer = channel_get_buffer,
+    .close = channel_close,
+    .shut_down = channel_shutdown,
+    .set_blocking = channel_set_blocking,
+    .get_return_path = channel_get_input_return_path,
+    .preadv = channel_file_preadv,
+    .seek = channel_file_seek,
+};
+
+static const QEMUFileOps channel_file_output_ops = {
+    .writev_buffer = channel_writev_buffer,
+    .close = channel_close,
+    .shut_down = channel_shutdown,
+    .set_blocking = channel_set_blocking,
+    .get_return_path = channel_get_output_return_path,
+    .pwritev = channel_file_pwritev,
+    .seek = channel_file_seek,
+};
+#endif
+
 static const QEMUFileOps channel_input_ops = {
     .get_buffer = channel_get_buffer,
     .close = channel_close,
@@ -181,11 +292,21 @@ static const QEMUFileOps channel_output_ops = {
 QEMUFile *qemu_fopen_channel_input(QIOChannel *ioc)
 {
     object_ref(OBJECT(ioc));
+#ifndef _WIN32
+    if (channel_is_seekable(ioc)) {
+        return qemu_fopen_ops(ioc, &channel_file_input_ops);
+    }
+#endif
     return qemu_fopen_ops(ioc, &channel_input_ops);
 }
 
 QEMUFile *qemu_fopen_channel_output(QIOChannel *ioc)
 {
     object_ref(OBJECT(ioc));
+#ifndef _WIN32
+    if (channel_is_seekable(ioc)) {
+        return qemu_fopen_ops(ioc, &channel_file_output_ops);
+    }
+#endif
     return qemu_fopen_ops(ioc, &channel_output_ops);
 }
@@ -43,6 +43,8 @@ struct QEMUFile {
 
     int64_t pos; /* start of buffer when writing, end of buffer
                     when reading */
+    /* bytes written with qemu_file_pwritev() minus bytes skipped by seeks */
+    int64_t transfer_adjust;
     int buf_index;
     int buf_size; /* 0 when writing */
     uint8_t buf[IO_BUF_SIZE];
@@ -173,6 +175,101 @@ bool qemu_file_is_writable(QEMUFile *f)
     return f->ops->writev_buffer;
 }
 
+/*
+ * Whether data can be accessed at arbitrary offsets of the file, with
+ * qemu_file_seek(), qemu_file_pwritev() and qemu_file_preadv().
+ */
+bool qemu_file_is_seekable(QEMUFile *f)
+{
+    if (qemu_file_is_writable(f)) {
+        return f->ops->pwritev;
+    }
+    return f->ops->preadv;
+}
+
+/**
+ * Moves the stream position of a seekable file
+ *
+ * Pending output is flushed at the old position; buffered input is
+ * dropped and the next read starts at @pos.
+ */
+void qemu_file_seek(QEMUFile *f, int64_t pos)
+{
+    Error *local_error = NULL;
+
+    assert(qemu_file_is_seekable(f));
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+        f->transfer_adjust -= pos - f->pos;
+    } else {
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+    f->pos = pos;
+
+    if (f->ops->seek && f->ops->seek(f->opaque, pos, &local_error) < 0) {
+        qemu_file_set_error_obj(f, -EIO, local_error);
+    }
+}
+
+/**
+ * Writes @iov at offset @pos of a seekable file
+ *
+ * The stream buffer, position and transfer counters are not affected, so
+ * this can be called by several coroutines or threads at the same time;
+ * see qemu_file_credit_transfer().  Returns the number of bytes written or
+ * a negative errno value.
+ */
+ssize_t qemu_file_pwritev(QEMUFile *f, struct iovec *iov, int iovcnt,
+                          int64_t pos, Error **errp)
+{
+    assert(qemu_file_is_writable(f) && f->ops->pwritev);
+
+    return f->ops->pwritev(f->opaque, iov, iovcnt, pos, errp);
+}
+
+/**
+ * Reads @iov from offset @pos of a seekable file
+ *
+ * Like qemu_file_pwritev(), this bypasses the stream buffer.  Returns
+ * the number of bytes read or a negative errno value.
+ */
+ssize_t qemu_file_preadv(QEMUFile *f, struct iovec *iov, int iovcnt,
+                         int64_t pos, Error **errp)
+{
+    assert(!qemu_file_is_writable(f) && f->ops->preadv);
+
+    return f->ops->preadv(f->opaque, iov, iovcnt, pos, errp);
+}
+
+/*
+ * Accounts @len bytes written with qemu_file_pwritev(), for rate limiting
+ * and qemu_file_transferred().
+ */
+void qemu_file_credit_transfer(QEMUFile *f, int64_t len)
+{
+    f->transfer_adjust += len;
+    qemu_file_update_transfer(f, len);
+}
+
+/*
+ * Returns the number of bytes written to the file so far.  This differs
+ * from qemu_ftell() for seekable files.
+ */
+int64_t qemu_file_transferred(QEMUFile *f)
+{
+    return qemu_ftell(f) + f->transfer_adjust;
+}
+
+AioContext *qemu_file_get_aio_context(QEMUFile *f)
+{
+    if (!f->ops->get_aio_context) {
+        return NULL;
+    }
+    return f->ops->get_aio_context(f->opaque);
+}
+
 static void qemu_iovec_release_ram(QEMUFile *f)
 {
     struct iovec iov;
@@ -61,6 +61,15 @@ typedef ssize_t (QEMUFileWritevBufferFunc)(void *opaque, struct iovec *iov,
                                            int iovcnt, int64_t pos,
                                            Error **errp);
 
+/*
+ * This function reads an iovec from the given position of the file,
+ * bypassing the stream buffer.  The handler must fill all of the iovec
+ * or return a negative errno value.
+ */
+typedef ssize_t (QEMUFileReadvBufferFunc)(void *opaque, struct iovec *iov,
+                                          int iovcnt, int64_t pos,
+                                          Error **errp);
+
 /*
  * This function provides hooks around different
  * stages of RAM migration.
@@ -103,6 +112,18 @@ typedef QEMUFile *(QEMURetPathFunc)(void *opaque);
 typedef int (QEMUFileShutdownFunc)(void *opaque, bool rd, bool wr,
                                    Error **errp);
 
+/*
+ * Move the stream position of a seekable file to @pos, for the next
+ * get_buffer or writev_buffer call.
+ */
+typedef int (QEMUFileSeekFunc)(void *opaque, int64_t pos, Error **errp);
+
+/*
+ * Return the AioContext that the file performs I/O in, if any.  It must be
+ * released while waiting for positional requests to complete.
+ */
+typedef AioContext *(QEMUFileGetAioContextFunc)(void *opaque);
+
 typedef struct QEMUFileOps {
     QEMUFileGetBufferFunc *get_buffer;
     QEMUFileCloseFunc *close;
@@ -110,6 +131,11 @@ typedef struct QEMUFileOps {
     QEMUFileWritevBufferFunc *writev_buffer;
     QEMURetPathFunc *get_return_path;
     QEMUFileShutdownFunc *shut_down;
+    /* Positional I/O, only provided by files that support seeking */
+    QEMUFileWritevBufferFunc *pwritev;
+    QEMUFileReadvBufferFunc *preadv;
+    QEMUFileSeekFunc *seek;
+    QEMUFileGetAioContextFunc *get_aio_context;
 } QEMUFileOps;
 
 typedef struct QEMUFileHooks {
@@ -133,6 +159,15 @@ void qemu_put_buffer_async(QEMUFile *f, const uint8_t *buf, size_t size,
                            bool may_free);
 bool qemu_file_mode_is_not_valid(const char *mode);
 bool qemu_file_is_writable(QEMUFile *f);
+bool qemu_file_is_seekable(QEMUFile *f);
+void qemu_file_seek(QEMUFile *f, int64_t pos);
+ssize_t qemu_file_pwritev(QEMUFile *f, struct iovec *iov, int iovcnt,
+                          int64_t pos, Error **errp);
+ssize_t qemu_file_preadv(QEMUFile *f, struct iovec *iov, int iovcnt,
+                         int64_t pos, Error **errp);
+AioContext *qemu_file_get_aio_context(QEMUFile *f);
+void qemu_file_credit_transfer(QEMUFile *f, int64_t len);
+int64_t qemu_file_transferred(QEMUFile *f);
 
 #include "migration/qemu-file-types.h"
 
@@ -55,6 +55,9 @@
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
+#include "qemu/units.h"
+#include "qemu/coroutine.h"
+#include "block/aio-wait.h"
 
 /***********************************************************/
 /* ram save/restore */
@@ -74,6 +77,8 @@
 #define RAM_SAVE_FLAG_XBZRLE   0x40
 /* 0x80 is reserved in migration.h start with 0x100 next */
 #define RAM_SAVE_FLAG_COMPRESS_PAGE    0x100
+/* Only with RAM_SAVE_FLAG_MEM_SIZE: pages are stored as mapped RAM */
+#define RAM_SAVE_FLAG_MAPPED           0x200
 
 static inline bool is_zero_range(uint8_t *p, uint64_t size)
 {
@@ -353,6 +358,8 @@ struct RAMState {
     /* Queue of outstanding page requests from the destination */
     QemuMutex src_page_req_mutex;
     QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_page_requests;
+    /* Pages are written in place in a seekable file, see ram_mapped_run */
+    bool mapped;
 };
 typedef struct RAMState RAMState;
 
@@ -859,6 +866,12 @@ static inline bool migration_bitmap_clear_dirty(RAMState *rs,
 /* Called with RCU critical section */
 static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
 {
+    /* Pages merged into rb->bmap by memory_global_dirty_log_sync_direct() */
+    rs->migration_dirty_pages += rb->merged_new_dirty_pages;
+    rs->num_dirty_pages_period += rb->merged_dirty_pages;
+    rb->merged_new_dirty_pages = 0;
+    rb->merged_dirty_pages = 0;
+
     rs->migration_dirty_pages +=
         cpu_physical_memory_sync_dirty_bitmap(rb, 0, rb->used_length,
                                               &rs->num_dirty_pages_period);
@@ -984,9 +997,14 @@ static void migration_bitmap_sync(RAMState *rs)
     }
 
     trace_migration_bitmap_sync_start();
-    memory_global_dirty_log_sync();
 
     qemu_mutex_lock(&rs->bitmap_mutex);
+    /*
+     * Let the accelerator fill rb->bmap directly; what is left in the
+     * DIRTY_MEMORY_MIGRATION bitmap (e.g. pages dirtied by TCG or vhost)
+     * is picked up by ramblock_sync_dirty_bitmap() below.
+     */
+    memory_global_dirty_log_sync_direct();
     WITH_RCU_READ_LOCK_GUARD() {
         RAMBLOCK_FOREACH_NOT_IGNORED(block) {
             ramblock_sync_dirty_bitmap(rs, block);
@@ -1657,6 +1675,7 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
 {
     RAMBlock *block = pss->block;
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
+    bool use_multifd;
     int res;
 
     if (control_save_page(rs, block, offset, &res)) {
@@ -1667,28 +1686,33 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
         return 1;
     }
 
-    res = save_zero_page(rs, block, offset);
-    if (res > 0) {
-        /* Must let xbzrle know, otherwise a previous (now 0'd) cached
-         * page would be stale
-         */
-        if (!save_page_use_compression(rs)) {
-            XBZRLE_cache_lock();
-            xbzrle_cache_zero_page(rs, block->offset + offset);
-            XBZRLE_cache_unlock();
-        }
-        ram_release_pages(block->idstr, offset, res);
-        return res;
-    }
-
     /*
      * Do not use multifd for:
      * 1. Compression as the first page in the new block should be posted out
      *    before sending the compressed page
      * 2. In postcopy as one whole host page should be placed
      */
-    if (!save_page_use_compression(rs) && migrate_use_multifd()
-        && !migration_in_postcopy()) {
+    use_multifd = !save_page_use_compression(rs) && migrate_use_multifd()
+                  && !migration_in_postcopy();
+
+    /* With multifd-zero-page the channel threads look for zero pages */
+    if (!use_multifd || !migrate_use_multifd_zero_page()) {
+        res = save_zero_page(rs, block, offset);
+        if (res > 0) {
+            /* Must let xbzrle know, otherwise a previous (now 0'd) cached
+             * page would be stale
+             */
+            if (!save_page_use_compression(rs)) {
+                XBZRLE_cache_lock();
+                xbzrle_cache_zero_page(rs, block->offset + offset);
+                XBZRLE_cache_unlock();
+            }
+            ram_release_pages(block->idstr, offset, res);
+            return res;
+        }
+    }
+
+    if (use_multifd) {
         return ram_save_multifd_page(rs, block, offset);
     }
 
@@ -1894,6 +1918,8 @@ static void ram_save_cleanup(void *opaque)
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
     }
 
     xbzrle_cleanup();
@@ -2452,6 +2478,419 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
     }
 }
 
+/*
+ * Mapped RAM
+ *
+ * When the migration stream goes to a seekable file, i.e. the vmstate
+ * area of a qcow2 image during savevm with multifd enabled, or a regular
+ * file passed with "fd:" and the mapped-ram capability, each RAMBlock
+ * gets a fixed region of the file: a little-endian bitmap of the pages
+ * that are stored, followed by the pages themselves at their offset in
+ * the block.  The regions are reserved by the setup stage, right after
+ * the RAMBlock list; the stream then continues after them.
+ *
+ * Instead of going through the stream, dirty pages are written in place
+ * by migrate_multifd_channels() workers, each with one request in flight,
+ * and read back the same way.  Workers are coroutines in the AioContext
+ * of block device files, and threads otherwise.  A page that is written
+ * again simply overwrites its previous copy, so the file size does not
+ * depend on the number of iterations; zero pages only clear their bit.
+ */
+#define MAPPED_RAM_ALIGN        (1 * MiB)
+/* Pages transferred by each request */
+#define MAPPED_RAM_CHUNK_PAGES  256
+
+typedef struct MappedRAMIO {
+    QEMUFile *f;
+    RAMState *rs;           /* NULL when loading */
+    /* Protects the fields below and the file bitmaps when saving */
+    QemuMutex lock;
+    /* Cursor of the next run of pages to transfer */
+    RAMBlock *block;
+    unsigned long page;
+    /* Bytes written so far */
+    uint64_t bytes;
+    int ret;
+    /* Number of coroutines still running */
+    int in_flight;
+    /* Coroutine waiting for the others to finish, if any */
+    Coroutine *waiter;
+} MappedRAMIO;
+
+static bool ram_mapped_enabled(QEMUFile *f)
+{
+    return (migrate_mapped_ram() || migrate_use_multifd()) &&
+           qemu_file_is_seekable(f);
+}
+
+/* Size of the bitmap of @block in the file, independent of the host */
+static uint64_t ram_mapped_bitmap_size(RAMBlock *block)
+{
+    return DIV_ROUND_UP(block->used_length >> TARGET_PAGE_BITS,
+                        BITS_PER_BYTE);
+}
+
+/*
+ * Reserves the regions of @block, which start at @offset from the
+ * beginning of the mapped area, and returns the offset of the next
+ * block.  Offsets are written relative to the area.
+ */
+static uint64_t ram_mapped_reserve_block(QEMUFile *f, RAMBlock *block,
+                                         uint64_t offset)
+{
+    block->bitmap_offset = offset;
+    block->pages_offset = offset + ROUND_UP(ram_mapped_bitmap_size(block),
+                                            MAPPED_RAM_ALIGN);
+    qemu_put_be64(f, block->bitmap_offset);
+    qemu_put_be64(f, block->pages_offset);
+
+    return ROUND_UP(block->pages_offset + block->used_length,
+                    MAPPED_RAM_ALIGN);
+}
+
+/*
+ * Places the mapped area of @size bytes after the RAMBlock list and
+ * moves the stream past it.
+ *
+ * Called with RCU critical section
+ */
+static void ram_mapped_save_setup(QEMUFile *f, uint64_t size)
+{
+    RAMBlock *block;
+    /* Leave room for the two words below */
+    uint64_t start = ROUND_UP(qemu_ftell_fast(f) + 16, MAPPED_RAM_ALIGN);
+
+    qemu_put_be64(f, start);
+    qemu_put_be64(f, start + size);
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        block->bitmap_offset += start;
+        block->pages_offset += start;
+        block->file_bmap = bitmap_new(block->used_length >> TARGET_PAGE_BITS);
+    }
+    trace_ram_mapped_save_setup(start, size);
+
+    qemu_file_seek(f, start + size);
+}
+
+/*
+ * Clears the dirty bits of pages [@start, @start + @npages) of @rb,
+ * including the remote dirty bitmap; see migration_bitmap_clear_dirty.
+ */
+static void migration_bitmap_clear_dirty_range(RAMState *rs, RAMBlock *rb,
+                                               unsigned long start,
+                                               unsigned long npages)
+{
+    unsigned long page = start, end = start + npages;
+
+    qemu_mutex_lock(&rs->bitmap_mutex);
+
+    while (rb->clear_bmap && page < end) {
+        uint8_t shift = rb->clear_bmap_shift;
+        hwaddr size = 1ULL << (TARGET_PAGE_BITS + shift);
+
+        if (clear_bmap_test_and_clear(rb, page)) {
+            hwaddr addr = (((ram_addr_t)page) << TARGET_PAGE_BITS) & (-size);
+
+            trace_migration_bitmap_clear_dirty(rb->idstr, addr, size, page);
+            memory_region_clear_dirty_bitmap(rb->mr, addr, size);
+        }
+        page = ROUND_DOWN(page, 1UL << shift) + (1UL << shift);
+    }
+
+    rs->migration_dirty_pages -= bitmap_count_one_with_offset(rb->bmap,
+                                                              start, npages);
+    bitmap_clear(rb->bmap, start, npages);
+
+    qemu_mutex_unlock(&rs->bitmap_mutex);
+}
+
+static RAMBlock *ram_mapped_next_block(RAMBlock *block)
+{
+    for (block = block ? QLIST_NEXT_RCU(block, next)
+                       : QLIST_FIRST_RCU(&ram_list.blocks);
+         block; block = QLIST_NEXT_RCU(block, next)) {
+        if (!ramblock_is_ignored(block) && block->file_bmap) {
+            break;
+        }
+    }
+    return block;
+}
+
+/*
+ * Picks the next run of at most MAPPED_RAM_CHUNK_PAGES pages to
+ * transfer: dirty pages when saving, stored pages when loading.
+ */
+static bool ram_mapped_next_run(MappedRAMIO *io, RAMBlock **block,
+                                unsigned long *start, unsigned long *npages)
+{
+    while (io->block) {
+        RAMBlock *rb = io->block;
+        unsigned long *bitmap = io->rs ? rb->bmap : rb->file_bmap;
+        unsigned long pages = rb->used_length >> TARGET_PAGE_BITS;
+        unsigned long first = find_next_bit(bitmap, pages, io->page);
+
+        if (first < pages) {
+            unsigned long last = MIN(pages, first + MAPPED_RAM_CHUNK_PAGES);
+
+            io->page = find_next_zero_bit(bitmap, last, first);
+            *block = rb;
+            *start = first;
+            *npages = io->page - first;
+            return true;
+        }
+
+        io->block = ram_mapped_next_block(rb);
+        io->page = 0;
+    }
+    return false;
+}
+
+static int ram_mapped_save_run(MappedRAMIO *io, RAMBlock *block,
+                               unsigned long start, unsigned long npages)
+{
+    DECLARE_BITMAP(zero_map, MAPPED_RAM_CHUNK_PAGES);
+    uint8_t *host = block->host + ((ram_addr_t)start << TARGET_PAGE_BITS);
+    unsigned long i, j, zero_pages = 0;
+    Error *local_err = NULL;
+
+    migration_bitmap_clear_dirty_range(io->rs, block, start, npages);
+
+    buffer_zero_bitmap(host, npages << TARGET_PAGE_BITS, TARGET_PAGE_SIZE,
+                       zero_map);
+
+    qemu_mutex_lock(&io->lock);
+    for (i = 0; i < npages; i++) {
+        if (test_bit(i, zero_map)) {
+            clear_bit(start + i, block->file_bmap);
+            zero_pages++;
+        } else {
+            set_bit(start + i, block->file_bmap);
+        }
+    }
+    ram_counters.duplicate += zero_pages;
+    ram_counters.normal += npages - zero_pages;
+    ram_counters.transferred += (npages - zero_pages) << TARGET_PAGE_BITS;
+    io->bytes += (npages - zero_pages) << TARGET_PAGE_BITS;
+    io->rs->target_page_count += npages;
+    qemu_mutex_unlock(&io->lock);
+
+    for (i = find_first_zero_bit(zero_map, npages); i < npages;
+         i = find_next_zero_bit(zero_map, npages, j)) {
+        struct iovec iov;
+        ssize_t ret;
+
+        j = find_next_bit(zero_map, npages, i);
+        iov.iov_base = host + (i << TARGET_PAGE_BITS);
+        iov.iov_len = (j - i) << TARGET_PAGE_BITS;
+
+        ret = qemu_file_pwritev(io->f, &iov, 1, block->pages_offset +
+                                ((ram_addr_t)(start + i) << TARGET_PAGE_BITS),
+                                &local_err);
+        if (ret < 0) {
+            error_report_err(local_err);
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+static int ram_mapped_load_run(MappedRAMIO *io, RAMBlock *block,
+                               unsigned long start, unsigned long npages)
+{
+    ram_addr_t offset = (ram_addr_t)start << TARGET_PAGE_BITS;
+    struct iovec iov = {
+        .iov_base = block->host + offset,
+        .iov_len = npages << TARGET_PAGE_BITS,
+    };
+    Error *local_err = NULL;
+    ssize_t ret;
+
+    ret = qemu_file_preadv(io->f, &iov, 1, block->pages_offset + offset,
+                           &local_err);
+    if (ret < 0) {
+        error_report_err(local_err);
+        return ret;
+    }
+    ramblock_recv_bitmap_set_range(block, iov.iov_base, npages);
+
+    return 0;
+}
+
+/* Called with RCU critical section */
+static void ram_mapped_work(MappedRAMIO *io)
+{
+    RAMBlock *block;
+    unsigned long start, npages;
+
+    while (true) {
+        bool more;
+        int ret;
+
+        qemu_mutex_lock(&io->lock);
+        more = !io->ret && ram_mapped_next_run(io, &block, &start, &npages);
+        qemu_mutex_unlock(&io->lock);
+        if (!more) {
+            break;
+        }
+
+        if (io->rs) {
+            ret = ram_mapped_save_run(io, block, start, npages);
+        } else {
+            ret = ram_mapped_load_run(io, block, start, npages);
+        }
+        if (ret < 0) {
+            qemu_mutex_lock(&io->lock);
+            if (!io->ret) {
+                io->ret = ret;
+            }
+            qemu_mutex_unlock(&io->lock);
+        }
+    }
+}
+
+static void coroutine_fn ram_mapped_co(void *opaque)
+{
+    MappedRAMIO *io = opaque;
+
+    ram_mapped_work(io);
+
+    if (--io->in_flight == 0 && io->waiter) {
+        aio_co_wake(io->waiter);
+    }
+    aio_wait_kick();
+}
+
+static void *ram_mapped_thread(void *opaque)
+{
+    MappedRAMIO *io = opaque;
+
+    rcu_register_thread();
+    WITH_RCU_READ_LOCK_GUARD() {
+        ram_mapped_work(io);
+    }
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+/*
+ * Transfers all the dirty pages of @rs, or all the stored pages when
+ * @rs is NULL, with migrate_multifd_channels() requests in flight.
+ *
+ * Returns zero to indicate success and negative for error
+ *
+ * Called with RCU critical section
+ */
+static int ram_mapped_run(QEMUFile *f, RAMState *rs)
+{
+    MappedRAMIO io = {
+        .f = f,
+        .rs = rs,
+        .block = ram_mapped_next_block(NULL),
+    };
+    AioContext *ctx = qemu_file_get_aio_context(f);
+    int i, n = migrate_multifd_channels();
+
+    trace_ram_mapped_run(!rs, n);
+    qemu_mutex_init(&io.lock);
+
+    if (ctx) {
+        io.in_flight = n;
+        for (i = 0; i < n; i++) {
+            Coroutine *co = qemu_coroutine_create(ram_mapped_co, &io);
+
+            qemu_coroutine_enter(co);
+        }
+
+        if (qemu_in_coroutine()) {
+            io.waiter = qemu_coroutine_self();
+            while (io.in_flight > 0) {
+                qemu_coroutine_yield();
+            }
+        } else {
+            AIO_WAIT_WHILE(ctx, io.in_flight > 0);
+        }
+    } else {
+        QemuThread *threads = g_new(QemuThread, n);
+
+        for (i = 0; i < n; i++) {
+            qemu_thread_create(&threads[i], "mapped-ram", ram_mapped_thread,
+                               &io, QEMU_THREAD_JOINABLE);
+        }
+        for (i = 0; i < n; i++) {
+            qemu_thread_join(&threads[i]);
+        }
+        g_free(threads);
+    }
+
+    qemu_mutex_destroy(&io.lock);
+    if (io.ret < 0) {
+        qemu_file_set_error(f, io.ret);
+    } else if (rs) {
+        qemu_file_credit_transfer(f, io.bytes);
+    }
+    return io.ret;
+}
+
+/*
+ * Writes the bitmaps of stored pages once all the pages are in place.
+ *
+ * Called with RCU critical section
+ */
+static int ram_mapped_save_bitmaps(QEMUFile *f)
+{
+    RAMBlock *block;
+    Error *local_err = NULL;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+        unsigned long *le_bitmap = bitmap_new(pages);
+        struct iovec iov = {
+            .iov_base = le_bitmap,
+            .iov_len = ram_mapped_bitmap_size(block),
+        };
+        ssize_t ret;
+
+        bitmap_to_le(le_bitmap, block->file_bmap, pages);
+        ret = qemu_file_pwritev(f, &iov, 1, block->bitmap_offset, &local_err);
+        g_free(le_bitmap);
+        if (ret < 0) {
+            qemu_file_set_error_obj(f, ret, local_err);
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+/* Mapped RAM counterpart of ram_save_iterate */
+static int ram_mapped_save_iterate(QEMUFile *f, RAMState *rs)
+{
+    int ret = 0;
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        ram_control_before_iterate(f, RAM_CONTROL_ROUND);
+        ret = ram_mapped_run(f, rs);
+    }
+    ram_control_after_iterate(f, RAM_CONTROL_ROUND);
+
+    if (ret >= 0) {
+        qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
+        qemu_fflush(f);
+        ram_counters.transferred += 8;
+
+        ret = qemu_file_get_error(f);
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* Every dirty page has been written */
+    return 1;
+}
+
 /*
  * Each of ram_save_setup, ram_save_iterate and ram_save_complete has
  * long-running RCU critical section.  When rcu-reclaims in the code
@@ -2471,6 +2910,18 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
 {
     RAMState **rsp = opaque;
     RAMBlock *block;
+    bool mapped = ram_mapped_enabled(f);
+    uint64_t mapped_size = 0;
+
+    if (mapped && (migrate_postcopy_ram() || migrate_ignore_shared())) {
+        error_report("Mapped RAM is not compatible with postcopy-ram and "
+                     "x-ignore-shared");
+        return -1;
+    }
+    if (migrate_mapped_ram() && !mapped) {
+        error_report("mapped-ram needs a regular file as migration target");
+        return -1;
+    }
 
     if (compress_threads_save_setup()) {
         return -1;
@@ -2484,9 +2935,11 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
         }
     }
     (*rsp)->f = f;
+    (*rsp)->mapped = mapped;
 
     WITH_RCU_READ_LOCK_GUARD() {
-        qemu_put_be64(f, ram_bytes_total_common(true) | RAM_SAVE_FLAG_MEM_SIZE);
+        qemu_put_be64(f, ram_bytes_total_common(true) | RAM_SAVE_FLAG_MEM_SIZE |
+                         (mapped ? RAM_SAVE_FLAG_MAPPED : 0));
 
         RAMBLOCK_FOREACH_MIGRATABLE(block) {
             qemu_put_byte(f, strlen(block->idstr));
@@ -2499,13 +2952,21 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (mapped) {
+                mapped_size = ram_mapped_reserve_block(f, block, mapped_size);
+            }
+        }
+        if (mapped) {
+            ram_mapped_save_setup(f, mapped_size);
         }
     }
 
     ram_control_before_iterate(f, RAM_CONTROL_SETUP);
     ram_control_after_iterate(f, RAM_CONTROL_SETUP);
 
-    multifd_send_sync_main(f);
+    if (!mapped) {
+        multifd_send_sync_main(f);
+    }
     qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
     qemu_fflush(f);
 
@@ -2529,6 +2990,10 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
     int64_t t0;
     int done = 0;
 
+    if (rs->mapped) {
+        return ram_mapped_save_iterate(f, rs);
+    }
+
     if (blk_mig_bulk_active()) {
         /* Avoid transferring ram during bulk phase of block migration as
          * the bulk phase will usually take a long time and transferring
@@ -2645,17 +3110,25 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
         /* try transferring iterative blocks of memory */
 
         /* flush all remaining blocks regardless of rate limiting */
-        while (true) {
-            int pages;
-
-            pages = ram_find_and_save_block(rs, !migration_in_colo_state());
-            /* no more blocks to sent */
-            if (pages == 0) {
-                break;
+        if (rs->mapped) {
+            ret = ram_mapped_run(f, rs);
+            if (ret >= 0) {
+                ret = ram_mapped_save_bitmaps(f);
             }
-            if (pages < 0) {
-                ret = pages;
-                break;
+        } else {
+            while (true) {
+                int pages;
+
+                pages = ram_find_and_save_block(rs,
+                                                !migration_in_colo_state());
+                /* no more blocks to sent */
+                if (pages == 0) {
+                    break;
+                }
+                if (pages < 0) {
+                    ret = pages;
+                    break;
+                }
             }
         }
 
@@ -2663,8 +3136,10 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
         ram_control_after_iterate(f, RAM_CONTROL_FINISH);
     }
 
-    if (ret >= 0) {
+    if (ret >= 0 && !rs->mapped) {
         multifd_send_sync_main(rs->f);
+    }
+    if (ret >= 0) {
         qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
         qemu_fflush(f);
     }
@@ -3140,6 +3615,8 @@ static int ram_load_cleanup(void *opaque)
     RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
         g_free(rb->receivedmap);
         rb->receivedmap = NULL;
+        g_free(rb->file_bmap);
+        rb->file_bmap = NULL;
     }
 
     return 0;
@@ -3396,6 +3873,89 @@ void colo_flush_ram_cache(void)
     trace_colo_flush_ram_cache_end();
 }
 
+/*
+ * Loads the mapped area that follows the RAMBlock list: reads the
+ * bitmaps, zeroes the pages that are not stored and reads the others in
+ * place.  The stream then continues at the end of the area.
+ *
+ * Called with RCU critical section
+ */
+static int ram_mapped_load(QEMUFile *f)
+{
+    uint64_t start = qemu_get_be64(f);
+    uint64_t end = qemu_get_be64(f);
+    Error *local_err = NULL;
+    RAMBlock *block;
+    int ret;
+
+    ret = qemu_file_get_error(f);
+    if (ret) {
+        goto out;
+    }
+    if (!qemu_file_is_seekable(f) || migration_incoming_colo_enabled()) {
+        error_report("Mapped RAM needs a seekable file and no COLO");
+        ret = -EINVAL;
+        goto out;
+    }
+    trace_ram_mapped_load(start, end);
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+        unsigned long *le_bitmap, page;
+        struct iovec iov;
+        ssize_t len;
+
+        if (!block->file_bmap) {
+            continue;
+        }
+
+        block->bitmap_offset += start;
+        block->pages_offset += start;
+        if (block->bitmap_offset + ram_mapped_bitmap_size(block) > end ||
+            block->pages_offset + block->used_length > end) {
+            error_report("Mapped RAM of block %s exceeds its area",
+                         block->idstr);
+            ret = -EINVAL;
+            goto out;
+        }
+
+        le_bitmap = bitmap_new(pages);
+        iov.iov_base = le_bitmap;
+        iov.iov_len = ram_mapped_bitmap_size(block);
+        len = qemu_file_preadv(f, &iov, 1, block->bitmap_offset, &local_err);
+        if (len < 0) {
+            g_free(le_bitmap);
+            qemu_file_set_error_obj(f, len, local_err);
+            ret = len;
+            goto out;
+        }
+        bitmap_from_le(block->file_bmap, le_bitmap, pages);
+        g_free(le_bitmap);
+
+        /* Pages that are not stored are zero */
+        for (page = find_first_zero_bit(block->file_bmap, pages);
+             page < pages;
+             page = find_next_zero_bit(block->file_bmap, pages, page + 1)) {
+            void *host = block->host + ((ram_addr_t)page << TARGET_PAGE_BITS);
+
+            ram_handle_compressed(host, 0, TARGET_PAGE_SIZE);
+            ramblock_recv_bitmap_set(block, host);
+        }
+    }
+
+    ret = ram_mapped_run(f, NULL);
+    if (!ret) {
+        qemu_file_seek(f, end);
+    }
+
+out:
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
+    }
+    return ret;
+}
+
 /**
  * ram_load_precopy: load pages in precopy case
  *
@@ -3484,7 +4044,7 @@ static int ram_load_precopy(QEMUFile *f)
             trace_ram_load_loop(block->idstr, (uint64_t)addr, flags, host);
         }
 
-        switch (flags & ~RAM_SAVE_FLAG_CONTINUE) {
+        switch (flags & ~(RAM_SAVE_FLAG_CONTINUE | RAM_SAVE_FLAG_MAPPED)) {
         case RAM_SAVE_FLAG_MEM_SIZE:
             /* Synchronize RAM block list */
             total_ram_bytes = addr;
@@ -3535,6 +4095,12 @@ static int ram_load_precopy(QEMUFile *f)
                             ret = -EINVAL;
                         }
                     }
+                    if (flags & RAM_SAVE_FLAG_MAPPED) {
+                        block->bitmap_offset = qemu_get_be64(f);
+                        block->pages_offset = qemu_get_be64(f);
+                        block->file_bmap = bitmap_new(length >>
+                                                      TARGET_PAGE_BITS);
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
@@ -3545,6 +4111,9 @@ static int ram_load_precopy(QEMUFile *f)
 
                 total_ram_bytes -= length;
             }
+            if (!ret && (flags & RAM_SAVE_FLAG_MAPPED)) {
+                ret = ram_mapped_load(f);
+            }
             break;
 
         case RAM_SAVE_FLAG_ZERO:
@@ -3575,8 +4144,10 @@ static int ram_load_precopy(QEMUFile *f)
             }
             break;
         case RAM_SAVE_FLAG_EOS:
-            /* normal exit */
-            multifd_recv_sync_main();
+            /* normal exit, files never use multifd channels */
+            if (!qemu_file_is_seekable(f)) {
+                multifd_recv_sync_main();
+            }
             break;
         default:
             if (flags & RAM_SAVE_FLAG_HOOK) {
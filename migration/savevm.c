@@ -148,6 +148,26 @@ static ssize_t block_get_buffer(void *opaque, uint8_t *buf, int64_t pos,
     return bdrv_load_vmstate(opaque, buf, pos, size);
 }
 
+static ssize_t block_readv_buffer(void *opaque, struct iovec *iov, int iovcnt,
+                                  int64_t pos, Error **errp)
+{
+    int ret;
+    QEMUIOVector qiov;
+
+    qemu_iovec_init_external(&qiov, iov, iovcnt);
+    ret = bdrv_readv_vmstate(opaque, &qiov, pos);
+    if (ret < 0) {
+        return ret;
+    }
+
+    return qiov.size;
+}
+
+static AioContext *block_get_aio_context(void *opaque)
+{
+    return bdrv_get_aio_context(opaque);
+}
+
 static int bdrv_fclose(void *opaque, Error **errp)
 {
     return bdrv_flush(opaque);
@@ -155,12 +175,16 @@ static int bdrv_fclose(void *opaque, Error **errp)
 
 static const QEMUFileOps bdrv_read_ops = {
     .get_buffer = block_get_buffer,
-    .close =      bdrv_fclose
+    .close =      bdrv_fclose,
+    .preadv =     block_readv_buffer,
+    .get_aio_context = block_get_aio_context
 };
 
 static const QEMUFileOps bdrv_write_ops = {
     .writev_buffer  = block_writev_buffer,
-    .close          = bdrv_fclose
+    .close          = bdrv_fclose,
+    .pwritev        = block_writev_buffer,
+    .get_aio_context = block_get_aio_context
 };
 
 static QEMUFile *qemu_fopen_bdrv(BlockDriverState *bs, int is_writable)
@@ -1834,6 +1834,125 @@ static int coroutine_fn nbd_co_send_structured_read(NBDClient *client,
     return nbd_co_send_iov(client, iov, 2, errp);
 }
 
+/*
+ * Send the reply to a read of @size bytes at @offset, moving the payload
+ * straight from the image file to the socket with blk_co_sendfile() instead
+ * of copying it through @data.  This is only possible if the client talks to
+ * us over a plain socket (no TLS) and the export is backed 1:1 by a host file.
+ *
+ * Returns 1 if the reply was sent, 0 if the caller has to fall back to
+ * reading into @data, or -errno if sending fails.
+ */
+static int coroutine_fn nbd_co_send_read_zero_copy(NBDClient *client,
+                                                   uint64_t handle,
+                                                   uint64_t offset,
+                                                   uint8_t *data,
+                                                   size_t size,
+                                                   bool final,
+                                                   Error **errp)
+{
+    NBDExport *exp = client->exp;
+    QIOChannel *ioc = client->ioc;
+    NBDSimpleReply simple;
+    NBDStructuredReadData chunk;
+    QEMUIOVector hdr;
+    char *hdr_buf;
+    size_t hdr_len, hdr_left;
+    size_t done = 0;
+    int ret = 0;
+
+    assert(size);
+
+    /* TLS needs the payload in userspace to encrypt it */
+    if (!client->sioc || ioc != QIO_CHANNEL(client->sioc)) {
+        return 0;
+    }
+
+    if (client->structured_reply) {
+        set_be_chunk(&chunk.h, final ? NBD_REPLY_FLAG_DONE : 0,
+                     NBD_REPLY_TYPE_OFFSET_DATA, handle,
+                     sizeof(chunk) - sizeof(chunk.h) + size);
+        stq_be_p(&chunk.offset, offset);
+        hdr_buf = (char *)&chunk;
+        hdr_len = sizeof(chunk);
+    } else {
+        set_be_simple_reply(&simple, 0, handle);
+        hdr_buf = (char *)&simple;
+        hdr_len = sizeof(simple);
+    }
+    hdr_left = hdr_len;
+
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+    qio_channel_set_cork(ioc, true);
+
+    /*
+     * blk_co_sendfile() does the copy in a worker thread, as part of a
+     * normal read request.  It stops when the socket is full, so that the
+     * wait for the client happens here rather than in the worker.
+     */
+    while (done < size) {
+        qemu_iovec_init_buf(&hdr, hdr_buf + hdr_len - hdr_left, hdr_left);
+        ret = blk_co_sendfile(exp->blk, offset + done + exp->dev_offset,
+                              size - done, client->sioc->fd,
+                              hdr_left ? &hdr : NULL);
+        if (ret == -EAGAIN) {
+            qio_channel_yield(ioc, G_IO_OUT);
+            continue;
+        }
+        if (ret <= 0) {
+            break;
+        }
+        if (ret < hdr_left) {
+            hdr_left -= ret;
+        } else {
+            done += ret - hdr_left;
+            hdr_left = 0;
+        }
+    }
+
+    if (hdr_left == hdr_len) {
+        /* Nothing went out, the caller can still send a normal reply */
+        ret = 0;
+        goto out;
+    }
+    trace_nbd_co_send_read_zero_copy(handle, offset, size, done);
+
+    /*
+     * The header has already gone out, at least in part, so if sendfile()
+     * gave up early the rest of the reply must be sent the slow way.  A read
+     * error at this point can only be handled by dropping the connection.
+     */
+    if (hdr_left &&
+        qio_channel_write_all(ioc, hdr_buf + hdr_len - hdr_left, hdr_left,
+                              errp) < 0) {
+        ret = -EIO;
+        goto out;
+    }
+    if (done < size) {
+        ret = blk_pread(exp->blk, offset + done + exp->dev_offset,
+                        data + done, size - done);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "reading from file failed");
+            ret = -EIO;
+            goto out;
+        }
+        if (qio_channel_write_all(ioc, (char *)data + done, size - done,
+                                  errp) < 0) {
+            ret = -EIO;
+            goto out;
+        }
+    }
+    ret = 1;
+
+out:
+    qio_channel_set_cork(ioc, false);
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret;
+}
+
 static int coroutine_fn nbd_co_send_structured_error(NBDClient *client,
                                                      uint64_t handle,
                                                      uint32_t error,
@@ -1907,15 +2026,23 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
             stl_be_p(&chunk.length, pnum);
             ret = nbd_co_send_iov(client, iov, 1, errp);
         } else {
-            ret = blk_pread(exp->blk, offset + progress + exp->dev_offset,
-                            data + progress, pnum);
-            if (ret < 0) {
-                error_setg_errno(errp, -ret, "reading from file failed");
-                break;
+            ret = nbd_co_send_read_zero_copy(client, handle, offset + progress,
+                                             data + progress, pnum, final,
+                                             errp);
+            if (ret > 0) {
+                ret = 0;
+            } else if (ret == 0) {
+                ret = blk_pread(exp->blk, offset + progress + exp->dev_offset,
+                                data + progress, pnum);
+                if (ret < 0) {
+                    error_setg_errno(errp, -ret, "reading from file failed");
+                    break;
+                }
+                ret = nbd_co_send_structured_read(client, handle,
+                                                  offset + progress,
+                                                  data + progress, pnum, final,
+                                                  errp);
             }
-            ret = nbd_co_send_structured_read(client, handle, offset + progress,
-                                              data + progress, pnum, final,
-                                              errp);
         }
 
         if (ret < 0) {
@@ -2282,6 +2409,15 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
                                        data, request->len, errp);
     }
 
+    if (request->len) {
+        ret = nbd_co_send_read_zero_copy(client, request->handle,
+                                         request->from, data, request->len,
+                                         true, errp);
+        if (ret != 0) {
+            return ret < 0 ? ret : 0;
+        }
+    }
+
     ret = blk_pread(exp->blk, request->from + exp->dev_offset, data,
                     request->len);
     if (ret < 0) {
@@ -34,6 +34,7 @@
 #include "qapi/qmp/qjson.h"
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qstring.h"
+#include "qemu/bitmap.h"
 #include "qemu/cutils.h"
 #include "qemu/config-file.h"
 #include "qemu/option.h"
@@ -48,6 +49,7 @@
 #include "block/blockjob.h"
 #include "block/qapi.h"
 #include "crypto/init.h"
+#include "crypto/hash.h"
 #include "trace/control.h"
 
 #define QEMU_IMG_VERSION "qemu-img version " QEMU_FULL_VERSION \
@@ -208,6 +210,8 @@ static void QEMU_NORETURN help(void)
            "  '-f' first image format\n"
            "  '-F' second image format\n"
            "  '-s' run in Strict mode - fail on different image size or sector allocation\n"
+           "  '-m' specifies how many coroutines work in parallel during the compare\n"
+           "       process (defaults to 8)\n"
            "\n"
            "Parameters to dd subcommand:\n"
            "  'bs=BYTES' read and write up to BYTES bytes at a time "
@@ -1170,32 +1174,28 @@ done:
  */
 static int64_t find_nonzero(const uint8_t *buf, int64_t n)
 {
-    int64_t i;
-    int64_t end = QEMU_ALIGN_DOWN(n, BDRV_SECTOR_SIZE);
+    int64_t idx = buffer_find_nonzero_offset(buf, n);
 
-    for (i = 0; i < end; i += BDRV_SECTOR_SIZE) {
-        if (!buffer_is_zero(buf + i, BDRV_SECTOR_SIZE)) {
-            return i;
-        }
-    }
-    if (i < n && !buffer_is_zero(buf + i, n - end)) {
-        return i;
+    if (idx == n) {
+        return -1;
     }
-    return -1;
+    return QEMU_ALIGN_DOWN(idx, BDRV_SECTOR_SIZE);
 }
 
 /*
- * Returns true iff the first sector pointed to by 'buf' contains at least
- * a non-NUL byte.
+ * Returns true iff sector 'start' in 'zero_map' (a bitmap of all-zero
+ * sectors, see buffer_zero_bitmap()) contains at least a non-NUL byte.
  *
  * 'pnum' is set to the number of sectors (including and immediately following
- * the first one) that are known to be in the same allocated/unallocated state.
+ * the first one, and at most 'n') that are known to be in the same
+ * allocated/unallocated state.
  * The function will try to align the end offset to alignment boundaries so
  * that the request will at least end aligned and consequtive requests will
  * also start at an aligned offset.
  */
-static int is_allocated_sectors(const uint8_t *buf, int n, int *pnum,
-                                int64_t sector_num, int alignment)
+static int is_allocated_sectors(const unsigned long *zero_map, int start,
+                                int n, int *pnum, int64_t sector_num,
+                                int alignment)
 {
     bool is_zero;
     int i, tail;
@@ -1204,12 +1204,11 @@ static int is_allocated_sectors(const uint8_t *buf, int n, int *pnum,
         *pnum = 0;
         return 0;
     }
-    is_zero = buffer_is_zero(buf, 512);
-    for(i = 1; i < n; i++) {
-        buf += 512;
-        if (is_zero != buffer_is_zero(buf, 512)) {
-            break;
-        }
+    is_zero = test_bit(start, zero_map);
+    if (is_zero) {
+        i = find_next_zero_bit(zero_map, start + n, start) - start;
+    } else {
+        i = find_next_bit(zero_map, start + n, start) - start;
     }
 
     tail = (sector_num + i) & (alignment - 1);
@@ -1233,12 +1232,12 @@ static int is_allocated_sectors(const uint8_t *buf, int n, int *pnum,
 }
 
 /*
- * Like is_allocated_sectors, but if the buffer starts with a used sector,
+ * Like is_allocated_sectors, but if the range starts with a used sector,
  * up to 'min' consecutive sectors containing zeros are ignored. This avoids
  * breaking up write requests for only small sparse areas.
  */
-static int is_allocated_sectors_min(const uint8_t *buf, int n, int *pnum,
-    int min, int64_t sector_num, int alignment)
+static int is_allocated_sectors_min(const unsigned long *zero_map, int start,
+    int n, int *pnum, int min, int64_t sector_num, int alignment)
 {
     int ret;
     int num_checked, num_used;
@@ -1247,21 +1246,21 @@ static int is_allocated_sectors_min(const uint8_t *buf, int n, int *pnum,
         min = n;
     }
 
-    ret = is_allocated_sectors(buf, n, pnum, sector_num, alignment);
+    ret = is_allocated_sectors(zero_map, start, n, pnum, sector_num,
+                               alignment);
     if (!ret) {
         return ret;
     }
 
-    num_used = *pnum;
-    buf += BDRV_SECTOR_SIZE * *pnum;
+    num_used = start + *pnum;
+    num_checked = num_used;
     n -= *pnum;
     sector_num += *pnum;
-    num_checked = num_used;
 
     while (n > 0) {
-        ret = is_allocated_sectors(buf, n, pnum, sector_num, alignment);
+        ret = is_allocated_sectors(zero_map, num_checked, n, pnum, sector_num,
+                                   alignment);
 
-        buf += BDRV_SECTOR_SIZE * *pnum;
         n -= *pnum;
         sector_num += *pnum;
         num_checked += *pnum;
@@ -1272,10 +1271,64 @@ static int is_allocated_sectors_min(const uint8_t *buf, int n, int *pnum,
         }
     }
 
-    *pnum = num_used;
+    *pnum = num_used - start;
     return 1;
 }
 
+#define IO_BUF_SIZE (2 * MiB)
+
+#define MAX_COROUTINES 16
+
+typedef enum ImgCompareAction {
+    COMPARE_SKIP,       /* nothing to read, the range is known to match */
+    COMPARE_BOTH,       /* read both images and compare the contents */
+    COMPARE_EMPTY1,     /* only check that the range is zero in image 1 */
+    COMPARE_EMPTY2,     /* only check that the range is zero in image 2 */
+} ImgCompareAction;
+
+typedef struct ImgCompareState {
+    BlockBackend *blk1, *blk2;
+    const char *filename1, *filename2;
+    int64_t total_size1, total_size2;
+    int64_t total_size;
+    int64_t progress_base;
+    bool strict;
+    long num_coroutines;
+    int running_coroutines;
+    CoMutex lock;
+    int64_t offset;     /* next offset to be handed out to a worker */
+
+    /*
+     * The failure with the lowest offset seen so far.  Requests complete out
+     * of order, so it is only reported once all workers have stopped; this
+     * keeps the output identical to a sequential comparison.
+     */
+    int ret;
+    int64_t ret_offset;
+    bool ret_is_error;
+    char *ret_msg;
+} ImgCompareState;
+
+static void GCC_FMT_ATTR(5, 6)
+compare_set_result(ImgCompareState *s, int64_t offset, int ret,
+                   bool is_error, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (offset >= s->ret_offset) {
+        return;
+    }
+
+    g_free(s->ret_msg);
+    va_start(ap, fmt);
+    s->ret_msg = g_strdup_vprintf(fmt, ap);
+    va_end(ap);
+
+    s->ret = ret;
+    s->ret_offset = offset;
+    s->ret_is_error = is_error;
+}
+
 /*
  * Compares two buffers sector by sector. Returns 0 if the first
  * sector of each buffer matches, non-zero otherwise.
@@ -1305,46 +1358,208 @@ static int compare_buffers(const uint8_t *buf1, const uint8_t *buf2,
     return res;
 }
 
-#define IO_BUF_SIZE (2 * MiB)
-
 /*
  * Check if passed sectors are empty (not allocated or contain only 0 bytes)
  *
  * Intended for use by 'qemu-img compare': Returns 0 in case sectors are
  * filled with 0, 1 if sectors contain non-zero data (this is a comparison
- * failure), and 4 on error (the exit status for read errors), after emitting
- * an error message.
+ * failure), and 4 on error (the exit status for read errors), after
+ * recording the failure in @s.
  *
+ * @param s: State of the comparison
  * @param blk:  BlockBackend for the image
  * @param offset: Starting offset to check
  * @param bytes: Number of bytes to check
  * @param filename: Name of disk file we are checking (logging purpose)
  * @param buffer: Allocated buffer for storing read data
- * @param quiet: Flag for quiet mode
  */
-static int check_empty_sectors(BlockBackend *blk, int64_t offset,
-                               int64_t bytes, const char *filename,
-                               uint8_t *buffer, bool quiet)
+static int coroutine_fn check_empty_sectors(ImgCompareState *s,
+                                            BlockBackend *blk, int64_t offset,
+                                            int64_t bytes,
+                                            const char *filename,
+                                            uint8_t *buffer)
 {
     int ret = 0;
     int64_t idx;
 
-    ret = blk_pread(blk, offset, buffer, bytes);
+    ret = blk_co_pread(blk, offset, bytes, buffer, 0);
     if (ret < 0) {
-        error_report("Error while reading offset %" PRId64 " of %s: %s",
-                     offset, filename, strerror(-ret));
+        compare_set_result(s, offset, 4, true,
+                           "Error while reading offset %" PRId64 " of %s: %s",
+                           offset, filename, strerror(-ret));
         return 4;
     }
     idx = find_nonzero(buffer, bytes);
     if (idx >= 0) {
-        qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
-                offset + idx);
+        compare_set_result(s, offset + idx, 1, false,
+                           "Content mismatch at offset %" PRId64 "!",
+                           offset + idx);
         return 1;
     }
 
     return 0;
 }
 
+/*
+ * Decide how to handle the range starting at @offset, based on the block
+ * status of both images.  Returns the length of the range, or 0 if the
+ * comparison has failed.  Must be called with s->lock held so that ranges
+ * are handed out in order.
+ */
+static int64_t compare_iteration(ImgCompareState *s, int64_t offset,
+                                 ImgCompareAction *action)
+{
+    int64_t pnum1, pnum2, chunk;
+    int status1, status2;
+    bool allocated1, allocated2;
+
+    if (offset >= s->total_size) {
+        /* Only the larger image is left */
+        bool over1 = s->total_size1 > s->total_size2;
+        BlockBackend *blk_over = over1 ? s->blk1 : s->blk2;
+
+        status1 = bdrv_block_status_above(blk_bs(blk_over), NULL, offset,
+                                          s->progress_base - offset, &chunk,
+                                          NULL, NULL);
+        if (status1 < 0) {
+            compare_set_result(s, offset, 3, true,
+                               "Sector allocation test failed for %s",
+                               over1 ? s->filename1 : s->filename2);
+            return 0;
+        }
+        if (status1 & BDRV_BLOCK_ALLOCATED && !(status1 & BDRV_BLOCK_ZERO)) {
+            *action = over1 ? COMPARE_EMPTY1 : COMPARE_EMPTY2;
+            return MIN(chunk, IO_BUF_SIZE);
+        }
+        *action = COMPARE_SKIP;
+        return chunk;
+    }
+
+    status1 = bdrv_block_status_above(blk_bs(s->blk1), NULL, offset,
+                                      s->total_size1 - offset, &pnum1, NULL,
+                                      NULL);
+    if (status1 < 0) {
+        compare_set_result(s, offset, 3, true,
+                           "Sector allocation test failed for %s",
+                           s->filename1);
+        return 0;
+    }
+    allocated1 = status1 & BDRV_BLOCK_ALLOCATED;
+
+    status2 = bdrv_block_status_above(blk_bs(s->blk2), NULL, offset,
+                                      s->total_size2 - offset, &pnum2, NULL,
+                                      NULL);
+    if (status2 < 0) {
+        compare_set_result(s, offset, 3, true,
+                           "Sector allocation test failed for %s",
+                           s->filename2);
+        return 0;
+    }
+    allocated2 = status2 & BDRV_BLOCK_ALLOCATED;
+
+    assert(pnum1 && pnum2);
+    chunk = MIN(pnum1, pnum2);
+
+    if (s->strict && status1 != status2) {
+        compare_set_result(s, offset, 1, false,
+                           "Strict mode: Offset %" PRId64
+                           " block status mismatch!", offset);
+        return 0;
+    }
+
+    if ((status1 & BDRV_BLOCK_ZERO) && (status2 & BDRV_BLOCK_ZERO)) {
+        *action = COMPARE_SKIP;
+    } else if (allocated1 == allocated2) {
+        *action = allocated1 ? COMPARE_BOTH : COMPARE_SKIP;
+    } else {
+        *action = allocated1 ? COMPARE_EMPTY1 : COMPARE_EMPTY2;
+    }
+
+    if (*action != COMPARE_SKIP) {
+        chunk = MIN(chunk, IO_BUF_SIZE);
+    }
+    return chunk;
+}
+
+static void coroutine_fn compare_co_do_compare(void *opaque)
+{
+    ImgCompareState *s = opaque;
+    uint8_t *buf1, *buf2;
+    int ret;
+
+    s->running_coroutines++;
+    buf1 = blk_blockalign(s->blk1, IO_BUF_SIZE);
+    buf2 = blk_blockalign(s->blk2, IO_BUF_SIZE);
+
+    while (1) {
+        ImgCompareAction action = COMPARE_SKIP;
+        int64_t offset, chunk, pnum;
+
+        qemu_co_mutex_lock(&s->lock);
+        if (s->offset >= s->progress_base || s->offset >= s->ret_offset) {
+            qemu_co_mutex_unlock(&s->lock);
+            break;
+        }
+        offset = s->offset;
+        chunk = compare_iteration(s, offset, &action);
+        if (!chunk) {
+            qemu_co_mutex_unlock(&s->lock);
+            break;
+        }
+        s->offset += chunk;
+        qemu_co_mutex_unlock(&s->lock);
+
+        switch (action) {
+        case COMPARE_SKIP:
+            break;
+        case COMPARE_BOTH:
+            ret = blk_co_pread(s->blk1, offset, chunk, buf1, 0);
+            if (ret < 0) {
+                compare_set_result(s, offset, 4, true,
+                                   "Error while reading offset %" PRId64
+                                   " of %s: %s",
+                                   offset, s->filename1, strerror(-ret));
+                goto out;
+            }
+            ret = blk_co_pread(s->blk2, offset, chunk, buf2, 0);
+            if (ret < 0) {
+                compare_set_result(s, offset, 4, true,
+                                   "Error while reading offset %" PRId64
+                                   " of %s: %s",
+                                   offset, s->filename2, strerror(-ret));
+                goto out;
+            }
+            ret = compare_buffers(buf1, buf2, chunk, &pnum);
+            if (ret || pnum != chunk) {
+                compare_set_result(s, offset + (ret ? 0 : pnum), 1, false,
+                                   "Content mismatch at offset %" PRId64 "!",
+                                   offset + (ret ? 0 : pnum));
+                goto out;
+            }
+            break;
+        case COMPARE_EMPTY1:
+            if (check_empty_sectors(s, s->blk1, offset, chunk, s->filename1,
+                                    buf1)) {
+                goto out;
+            }
+            break;
+        case COMPARE_EMPTY2:
+            if (check_empty_sectors(s, s->blk2, offset, chunk, s->filename2,
+                                    buf1)) {
+                goto out;
+            }
+            break;
+        }
+
+        qemu_progress_print(((float) chunk / s->progress_base) * 100, 100);
+    }
+
+out:
+    qemu_vfree(buf1);
+    qemu_vfree(buf2);
+    s->running_coroutines--;
+}
+
 /*
  * Compares two images. Exit codes:
  *
@@ -1356,22 +1571,16 @@ static int img_compare(int argc, char **argv)
 {
     const char *fmt1 = NULL, *fmt2 = NULL, *cache, *filename1, *filename2;
     BlockBackend *blk1, *blk2;
-    BlockDriverState *bs1, *bs2;
     int64_t total_size1, total_size2;
-    uint8_t *buf1 = NULL, *buf2 = NULL;
-    int64_t pnum1, pnum2;
-    int allocated1, allocated2;
     int ret = 0; /* return value - 0 Ident, 1 Different, >1 Error */
     bool progress = false, quiet = false, strict = false;
     int flags;
     bool writethrough;
-    int64_t total_size;
-    int64_t offset = 0;
-    int64_t chunk;
-    int c;
-    uint64_t progress_base;
+    int c, i;
+    long num_coroutines = 8;
     bool image_opts = false;
     bool force_share = false;
+    ImgCompareState s;
 
     cache = BDRV_DEFAULT_CACHE;
     for (;;) {
@@ -1382,7 +1591,7 @@ static int img_compare(int argc, char **argv)
             {"force-share", no_argument, 0, 'U'},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":hf:F:T:pqsU",
+        c = getopt_long(argc, argv, ":hf:F:T:m:pqsU",
                         long_options, NULL);
         if (c == -1) {
             break;
@@ -1406,6 +1615,15 @@ static int img_compare(int argc, char **argv)
         case 'T':
             cache = optarg;
             break;
+        case 'm':
+            if (qemu_strtol(optarg, NULL, 0, &num_coroutines) ||
+                num_coroutines < 1 || num_coroutines > MAX_COROUTINES) {
+                error_report("Invalid number of coroutines. Allowed number of"
+                             " coroutines is between 1 and %d", MAX_COROUTINES);
+                ret = 2;
+                goto out4;
+            }
+            break;
         case 'p':
             progress = true;
             break;
@@ -1476,11 +1694,7 @@ static int img_compare(int argc, char **argv)
         ret = 2;
         goto out2;
     }
-    bs1 = blk_bs(blk1);
-    bs2 = blk_bs(blk2);
 
-    buf1 = blk_blockalign(blk1, IO_BUF_SIZE);
-    buf2 = blk_blockalign(blk2, IO_BUF_SIZE);
     total_size1 = blk_getlength(blk1);
     if (total_size1 < 0) {
         error_report("Can't get size of %s: %s",
@@ -1495,8 +1709,6 @@ static int img_compare(int argc, char **argv)
         ret = 4;
         goto out;
     }
-    total_size = MIN(total_size1, total_size2);
-    progress_base = MAX(total_size1, total_size2);
 
     qemu_progress_print(0, 100);
 
@@ -1506,131 +1718,49 @@ static int img_compare(int argc, char **argv)
         goto out;
     }
 
-    while (offset < total_size) {
-        int status1, status2;
-
-        status1 = bdrv_block_status_above(bs1, NULL, offset,
-                                          total_size1 - offset, &pnum1, NULL,
-                                          NULL);
-        if (status1 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename1);
-            goto out;
-        }
-        allocated1 = status1 & BDRV_BLOCK_ALLOCATED;
-
-        status2 = bdrv_block_status_above(bs2, NULL, offset,
-                                          total_size2 - offset, &pnum2, NULL,
-                                          NULL);
-        if (status2 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename2);
-            goto out;
-        }
-        allocated2 = status2 & BDRV_BLOCK_ALLOCATED;
-
-        assert(pnum1 && pnum2);
-        chunk = MIN(pnum1, pnum2);
-
-        if (strict) {
-            if (status1 != status2) {
-                ret = 1;
-                qprintf(quiet, "Strict mode: Offset %" PRId64
-                        " block status mismatch!\n", offset);
-                goto out;
-            }
-        }
-        if ((status1 & BDRV_BLOCK_ZERO) && (status2 & BDRV_BLOCK_ZERO)) {
-            /* nothing to do */
-        } else if (allocated1 == allocated2) {
-            if (allocated1) {
-                int64_t pnum;
+    s = (ImgCompareState) {
+        .blk1           = blk1,
+        .blk2           = blk2,
+        .filename1      = filename1,
+        .filename2      = filename2,
+        .total_size1    = total_size1,
+        .total_size2    = total_size2,
+        .total_size     = MIN(total_size1, total_size2),
+        .progress_base  = MAX(total_size1, total_size2),
+        .strict         = strict,
+        .num_coroutines = num_coroutines,
+        .ret_offset     = INT64_MAX,
+    };
+    qemu_co_mutex_init(&s.lock);
 
-                chunk = MIN(chunk, IO_BUF_SIZE);
-                ret = blk_pread(blk1, offset, buf1, chunk);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename1, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = blk_pread(blk2, offset, buf2, chunk);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename2, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = compare_buffers(buf1, buf2, chunk, &pnum);
-                if (ret || pnum != chunk) {
-                    qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
-                            offset + (ret ? 0 : pnum));
-                    ret = 1;
-                    goto out;
-                }
-            }
-        } else {
-            chunk = MIN(chunk, IO_BUF_SIZE);
-            if (allocated1) {
-                ret = check_empty_sectors(blk1, offset, chunk,
-                                          filename1, buf1, quiet);
-            } else {
-                ret = check_empty_sectors(blk2, offset, chunk,
-                                          filename2, buf1, quiet);
-            }
-            if (ret) {
-                goto out;
-            }
-        }
-        offset += chunk;
-        qemu_progress_print(((float) chunk / progress_base) * 100, 100);
+    for (i = 0; i < s.num_coroutines; i++) {
+        Coroutine *co = qemu_coroutine_create(compare_co_do_compare, &s);
+        qemu_coroutine_enter(co);
     }
 
-    if (total_size1 != total_size2) {
-        BlockBackend *blk_over;
-        const char *filename_over;
+    while (s.running_coroutines) {
+        main_loop_wait(false);
+    }
 
+    if (total_size1 != total_size2 && s.ret_offset >= s.total_size) {
         qprintf(quiet, "Warning: Image size mismatch!\n");
-        if (total_size1 > total_size2) {
-            blk_over = blk1;
-            filename_over = filename1;
-        } else {
-            blk_over = blk2;
-            filename_over = filename2;
-        }
-
-        while (offset < progress_base) {
-            ret = bdrv_block_status_above(blk_bs(blk_over), NULL, offset,
-                                          progress_base - offset, &chunk,
-                                          NULL, NULL);
-            if (ret < 0) {
-                ret = 3;
-                error_report("Sector allocation test failed for %s",
-                             filename_over);
-                goto out;
+    }
 
-            }
-            if (ret & BDRV_BLOCK_ALLOCATED && !(ret & BDRV_BLOCK_ZERO)) {
-                chunk = MIN(chunk, IO_BUF_SIZE);
-                ret = check_empty_sectors(blk_over, offset, chunk,
-                                          filename_over, buf1, quiet);
-                if (ret) {
-                    goto out;
-                }
-            }
-            offset += chunk;
-            qemu_progress_print(((float) chunk / progress_base) * 100, 100);
+    if (s.ret_msg) {
+        if (s.ret_is_error) {
+            error_report("%s", s.ret_msg);
+        } else {
+            qprintf(quiet, "%s\n", s.ret_msg);
         }
+        ret = s.ret;
+        g_free(s.ret_msg);
+        goto out;
     }
 
     qprintf(quiet, "Images are identical.\n");
     ret = 0;
 
 out:
-    qemu_vfree(buf1);
-    qemu_vfree(buf2);
     blk_unref(blk2);
 out2:
     blk_unref(blk1);
@@ -1664,8 +1794,6 @@ enum ImgConvertBlockStatus {
     BLK_BACKING_FILE,
 };
 
-#define MAX_COROUTINES 16
-
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1863,8 +1991,18 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
                                          int nb_sectors, uint8_t *buf,
                                          enum ImgConvertBlockStatus status)
 {
+    g_autofree unsigned long *zero_map = NULL;
+    int start = 0;
     int ret;
 
+    if (status == BLK_DATA && s->min_sparse && !s->compressed &&
+        nb_sectors > 0) {
+        /* Check all sectors at once instead of every time they are looked at */
+        zero_map = bitmap_new(nb_sectors);
+        buffer_zero_bitmap(buf, (size_t)nb_sectors * BDRV_SECTOR_SIZE,
+                           BDRV_SECTOR_SIZE, zero_map);
+    }
+
     while (nb_sectors > 0) {
         int n = nb_sectors;
         BdrvRequestFlags flags = s->compressed ? BDRV_REQ_WRITE_COMPRESSED : 0;
@@ -1886,8 +2024,9 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
              * zeroed. */
             if (!s->min_sparse ||
                 (!s->compressed &&
-                 is_allocated_sectors_min(buf, n, &n, s->min_sparse,
-                                          sector_num, s->alignment)) ||
+                 is_allocated_sectors_min(zero_map, start, n, &n,
+                                          s->min_sparse, sector_num,
+                                          s->alignment)) ||
                 (s->compressed &&
                  !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
             {
@@ -1918,6 +2057,7 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
         sector_num += n;
         nb_sectors -= n;
         buf += n * BDRV_SECTOR_SIZE;
+        start += n;
     }
 
     return 0;
@@ -3103,6 +3243,101 @@ static inline bool entry_mergeable(const MapEntry *curr, const MapEntry *next)
     return true;
 }
 
+/* Each worker queries the block status of up to 1 GiB at a time */
+#define MAP_WINDOW_SIZE (1 * GiB)
+
+typedef struct ImgMapWindow {
+    GArray *entries;
+    int ret;
+    bool done;
+} ImgMapWindow;
+
+typedef struct ImgMapState {
+    BlockDriverState *bs;
+    OutputFormat output_format;
+    int64_t start;
+    int64_t length;
+    ImgMapWindow *windows;
+    int64_t num_windows;
+    int64_t next_window;    /* next window to be handed out to a worker */
+    int64_t next_dump;      /* next window to be printed */
+    MapEntry curr;
+    int running_coroutines;
+    int ret;
+} ImgMapState;
+
+static int map_add_entry(ImgMapState *s, MapEntry *next)
+{
+    int ret;
+
+    if (entry_mergeable(&s->curr, next)) {
+        s->curr.length += next->length;
+        return 0;
+    }
+
+    if (s->curr.length > 0) {
+        ret = dump_map_entry(s->output_format, &s->curr, next);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    s->curr = *next;
+    return 0;
+}
+
+/*
+ * Windows are completed out of order; print all windows that are done and
+ * follow the already printed ones, so that the output stays sequential.
+ */
+static void map_dump_windows(ImgMapState *s)
+{
+    while (s->ret == 0 && s->next_dump < s->num_windows &&
+           s->windows[s->next_dump].done) {
+        ImgMapWindow *w = &s->windows[s->next_dump++];
+        guint i;
+
+        if (w->ret < 0) {
+            error_report("Could not read file metadata: %s", strerror(-w->ret));
+            s->ret = w->ret;
+        }
+        for (i = 0; s->ret == 0 && i < w->entries->len; i++) {
+            s->ret = map_add_entry(s, &g_array_index(w->entries, MapEntry, i));
+        }
+        g_array_free(w->entries, true);
+        w->entries = NULL;
+    }
+}
+
+static void coroutine_fn map_co_do_map(void *opaque)
+{
+    ImgMapState *s = opaque;
+
+    s->running_coroutines++;
+
+    while (s->ret == 0 && s->next_window < s->num_windows) {
+        ImgMapWindow *w = &s->windows[s->next_window];
+        int64_t offset = s->start + s->next_window * MAP_WINDOW_SIZE;
+        int64_t end = MIN(offset + MAP_WINDOW_SIZE, s->length);
+
+        s->next_window++;
+        w->entries = g_array_new(false, false, sizeof(MapEntry));
+        while (offset < end) {
+            MapEntry e;
+
+            w->ret = get_block_status(s->bs, offset, end - offset, &e);
+            if (w->ret < 0) {
+                break;
+            }
+            g_array_append_val(w->entries, e);
+            offset += e.length;
+        }
+        w->done = true;
+        map_dump_windows(s);
+    }
+
+    s->running_coroutines--;
+}
+
 static int img_map(int argc, char **argv)
 {
     int c;
@@ -3111,12 +3346,14 @@ static int img_map(int argc, char **argv)
     BlockDriverState *bs;
     const char *filename, *fmt, *output;
     int64_t length;
-    MapEntry curr = { .length = 0 }, next;
     int ret = 0;
     bool image_opts = false;
     bool force_share = false;
     int64_t start_offset = 0;
     int64_t max_length = -1;
+    long num_coroutines = 8;
+    ImgMapState s;
+    int64_t i;
 
     fmt = NULL;
     output = NULL;
@@ -3133,7 +3370,7 @@ static int img_map(int argc, char **argv)
             {"max-length", required_argument, 0, 'l'},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":f:s:l:hU",
+        c = getopt_long(argc, argv, ":f:s:l:m:hU",
                         long_options, &option_index);
         if (c == -1) {
             break;
@@ -3169,6 +3406,14 @@ static int img_map(int argc, char **argv)
                 return 1;
             }
             break;
+        case 'm':
+            if (qemu_strtol(optarg, NULL, 0, &num_coroutines) ||
+                num_coroutines < 1 || num_coroutines > MAX_COROUTINES) {
+                error_report("Invalid number of coroutines. Allowed number of"
+                             " coroutines is between 1 and %d", MAX_COROUTINES);
+                return 1;
+            }
+            break;
         case OPTION_OBJECT: {
             QemuOpts *opts;
             opts = qemu_opts_parse_noisily(&qemu_object_opts,
@@ -3223,35 +3468,40 @@ static int img_map(int argc, char **argv)
         length = MIN(start_offset + max_length, length);
     }
 
-    curr.start = start_offset;
-    while (curr.start + curr.length < length) {
-        int64_t offset = curr.start + curr.length;
-        int64_t n;
+    s = (ImgMapState) {
+        .bs             = bs,
+        .output_format  = output_format,
+        .start          = start_offset,
+        .length         = length,
+        .curr           = { .start = start_offset, .length = 0 },
+    };
+    if (length > start_offset) {
+        s.num_windows = DIV_ROUND_UP(length - start_offset, MAP_WINDOW_SIZE);
+    }
+    s.windows = g_new0(ImgMapWindow, s.num_windows);
 
-        /* Probe up to 1 GiB at a time.  */
-        n = MIN(1 * GiB, length - offset);
-        ret = get_block_status(bs, offset, n, &next);
+    for (i = 0; i < num_coroutines; i++) {
+        Coroutine *co = qemu_coroutine_create(map_co_do_map, &s);
+        qemu_coroutine_enter(co);
+    }
 
-        if (ret < 0) {
-            error_report("Could not read file metadata: %s", strerror(-ret));
-            goto out;
-        }
+    while (s.running_coroutines) {
+        main_loop_wait(false);
+    }
 
-        if (entry_mergeable(&curr, &next)) {
-            curr.length += next.length;
-            continue;
+    for (i = 0; i < s.num_windows; i++) {
+        if (s.windows[i].entries) {
+            g_array_free(s.windows[i].entries, true);
         }
+    }
+    g_free(s.windows);
 
-        if (curr.length > 0) {
-            ret = dump_map_entry(output_format, &curr, &next);
-            if (ret < 0) {
-                goto out;
-            }
-        }
-        curr = next;
+    ret = s.ret;
+    if (ret < 0) {
+        goto out;
     }
 
-    ret = dump_map_entry(output_format, &curr, NULL);
+    ret = dump_map_entry(output_format, &s.curr, NULL);
     if (output_format == OFORMAT_JSON) {
         puts("]");
     }
@@ -5175,6 +5425,248 @@ out:
     return 0;
 }
 
+#define DEDUP_DIGEST_LEN 32 /* SHA-256 */
+#define DEDUP_DEFAULT_GRANULARITY (64 * KiB)
+
+typedef struct ImgDedupState {
+    GHashTable *chunks;         /* digests of the distinct data chunks */
+    int64_t granularity;
+    uint64_t data_chunks;
+    uint64_t zero_chunks;
+} ImgDedupState;
+
+static guint dedup_digest_hash(gconstpointer key)
+{
+    guint hash;
+
+    memcpy(&hash, key, sizeof(hash));
+    return hash;
+}
+
+static gboolean dedup_digest_equal(gconstpointer a, gconstpointer b)
+{
+    return !memcmp(a, b, DEDUP_DIGEST_LEN);
+}
+
+static int img_dedup_add_chunk(ImgDedupState *s, const uint8_t *buf,
+                               size_t len)
+{
+    uint8_t *digest = NULL;
+    size_t digest_len;
+    Error *local_err = NULL;
+
+    s->data_chunks++;
+    if (buffer_is_zero(buf, len)) {
+        s->zero_chunks++;
+        return 0;
+    }
+
+    if (qcrypto_hash_bytes(QCRYPTO_HASH_ALG_SHA256, (const char *)buf, len,
+                           &digest, &digest_len, &local_err) < 0) {
+        error_report_err(local_err);
+        return -1;
+    }
+    assert(digest_len == DEDUP_DIGEST_LEN);
+
+    /* If the digest is already known, this frees the duplicate key */
+    g_hash_table_add(s->chunks, digest);
+    return 0;
+}
+
+/*
+ * Hash all data chunks that are allocated in the top layer of @blk.  Zero
+ * and unallocated ranges take no space in the image and are skipped.
+ */
+static int img_dedup_scan(ImgDedupState *s, BlockBackend *blk,
+                          const char *filename, uint8_t *buf)
+{
+    BlockDriverState *bs = blk_bs(blk);
+    int64_t size, offset, next_chunk = 0;
+    int ret;
+
+    size = blk_getlength(blk);
+    if (size < 0) {
+        error_report("Can't get size of %s: %s", filename, strerror(-size));
+        return -1;
+    }
+
+    for (offset = 0; offset < size; ) {
+        int64_t pnum, start, end;
+
+        ret = bdrv_block_status(bs, offset, size - offset, &pnum, NULL, NULL);
+        if (ret < 0) {
+            error_report("Could not read file metadata of %s: %s",
+                         filename, strerror(-ret));
+            return -1;
+        }
+        assert(pnum);
+
+        if ((ret & BDRV_BLOCK_DATA) && !(ret & BDRV_BLOCK_ZERO)) {
+            /* Hash whole chunks, but count each of them only once */
+            start = MAX(QEMU_ALIGN_DOWN(offset, s->granularity), next_chunk);
+            end = MIN(QEMU_ALIGN_UP(offset + pnum, s->granularity), size);
+
+            while (start < end) {
+                int64_t len = MIN(end - start, IO_BUF_SIZE);
+                int64_t i;
+
+                ret = blk_pread(blk, start, buf, len);
+                if (ret < 0) {
+                    error_report("Error while reading offset %" PRId64
+                                 " of %s: %s", start, filename, strerror(-ret));
+                    return -1;
+                }
+                for (i = 0; i < len; i += s->granularity) {
+                    if (img_dedup_add_chunk(s, buf + i,
+                                            MIN(s->granularity, len - i)) < 0) {
+                        return -1;
+                    }
+                }
+                start += len;
+            }
+            next_chunk = end;
+        }
+        offset += pnum;
+    }
+
+    return 0;
+}
+
+/*
+ * Estimate how much space sharing identical chunks would save.  This only
+ * reads the images: no image format can store such shared data yet.
+ */
+static int img_dedup(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"object", required_argument, 0, OPTION_OBJECT},
+        {"image-opts", no_argument, 0, OPTION_IMAGE_OPTS},
+        {"force-share", no_argument, 0, 'U'},
+        {0, 0, 0, 0}
+    };
+    ImgDedupState s = { .granularity = 0 };
+    const char *fmt = NULL;
+    bool image_opts = false;
+    bool force_share = false;
+    uint8_t *buf = NULL;
+    uint64_t unique, saved;
+    int ret = 1;
+    int c, i;
+
+    for (;;) {
+        c = getopt_long(argc, argv, ":hf:g:U", long_options, NULL);
+        if (c == -1) {
+            break;
+        }
+        switch (c) {
+        case ':':
+            missing_argument(argv[optind - 1]);
+            break;
+        case '?':
+            unrecognized_option(argv[optind - 1]);
+            break;
+        case 'h':
+            help();
+            break;
+        case 'f':
+            fmt = optarg;
+            break;
+        case 'g':
+            s.granularity = cvtnum("granularity", optarg);
+            if (s.granularity < 0) {
+                return 1;
+            }
+            if (s.granularity < BDRV_SECTOR_SIZE ||
+                s.granularity > IO_BUF_SIZE || !is_power_of_2(s.granularity)) {
+                error_report("Granularity must be a power of two between %d "
+                             "and %d", BDRV_SECTOR_SIZE, IO_BUF_SIZE);
+                return 1;
+            }
+            break;
+        case 'U':
+            force_share = true;
+            break;
+        case OPTION_OBJECT: {
+            QemuOpts *opts;
+            opts = qemu_opts_parse_noisily(&qemu_object_opts,
+                                           optarg, true);
+            if (!opts) {
+                return 1;
+            }
+        }   break;
+        case OPTION_IMAGE_OPTS:
+            image_opts = true;
+            break;
+        }
+    }
+
+    if (optind >= argc) {
+        error_exit("Expecting at least one image file name");
+    }
+
+    if (qemu_opts_foreach(&qemu_object_opts,
+                          user_creatable_add_opts_foreach,
+                          qemu_img_object_print_help, &error_fatal)) {
+        return 1;
+    }
+
+    s.chunks = g_hash_table_new_full(dedup_digest_hash, dedup_digest_equal,
+                                     g_free, NULL);
+
+    for (i = optind; i < argc; i++) {
+        BlockBackend *blk;
+
+        blk = img_open(image_opts, argv[i], fmt, 0, false, false,
+                       force_share);
+        if (!blk) {
+            goto out;
+        }
+
+        if (!s.granularity) {
+            /* Default to the cluster size of the first image */
+            BlockDriverInfo bdi;
+
+            s.granularity = DEDUP_DEFAULT_GRANULARITY;
+            if (bdrv_get_info(blk_bs(blk), &bdi) >= 0 &&
+                bdi.cluster_size >= BDRV_SECTOR_SIZE &&
+                bdi.cluster_size <= IO_BUF_SIZE &&
+                is_power_of_2(bdi.cluster_size)) {
+                s.granularity = bdi.cluster_size;
+            }
+        }
+        if (!buf) {
+            buf = blk_blockalign(blk, IO_BUF_SIZE);
+        }
+
+        ret = img_dedup_scan(&s, blk, argv[i], buf);
+        blk_unref(blk);
+        if (ret < 0) {
+            ret = 1;
+            goto out;
+        }
+    }
+
+    unique = g_hash_table_size(s.chunks);
+    saved = s.data_chunks - s.zero_chunks - unique;
+
+    printf("Images:              %d\n", argc - optind);
+    printf("Granularity:         %" PRId64 "\n", s.granularity);
+    printf("Allocated chunks:    %" PRIu64 "\n", s.data_chunks);
+    printf("Zero chunks:         %" PRIu64 "\n", s.zero_chunks);
+    printf("Unique chunks:       %" PRIu64 "\n", unique);
+    printf("Deduplication ratio: %.2f\n",
+           unique ? (double)(s.data_chunks - s.zero_chunks) / unique : 1.0);
+    printf("Reclaimable bytes:   %" PRIu64 "\n",
+           (saved + s.zero_chunks) * s.granularity);
+    ret = 0;
+
+out:
+    qemu_vfree(buf);
+    g_hash_table_destroy(s.chunks);
+    return ret;
+}
+
 static void dump_json_block_measure_info(BlockMeasureInfo *info)
 {
     QString *str;
@@ -123,7 +123,12 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                igd-passthru=on|off (enable Xen integrated Intel graphics passthrough, default=off)\n"
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
+    "                dirty-ring-size=n (KVM dirty ring entries per vCPU, default=0)\n"
+    "                dirty-sync-threads=n (threads merging the KVM dirty log during migration)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                tb-cache=file (keep TCG translations in file between runs;\n"
+    "                               file holds host code, use a trusted location)\n"
+    "                superblock-threshold=n (retranslate TBs run n times as superblocks)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
 ``-accel name[,prop=value[,...]]``
@@ -148,9 +153,44 @@ SRST
     ``kvm-shadow-mem=size``
         Defines the size of the KVM shadow MMU.
 
+    ``dirty-ring-size=n``
+        When the KVM accelerator is used, track dirty pages with a ring
+        of n entries per vCPU instead of per-slot bitmaps, so that the
+        cost of a dirty log sync depends on the number of dirtied pages
+        rather than on the size of guest memory.  n must be a power of
+        two; 4096 is a reasonable value.  If the host kernel does not
+        support the dirty ring, the bitmaps are used.  The default, 0,
+        always uses the bitmaps.
+
+    ``dirty-sync-threads=n``
+        Number of threads used to merge the dirty log of large KVM
+        memory slots into the migration bitmap, at most 64.  The
+        default is 1.
+
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``tb-cache=file``
+        Keeps translated code in ``file`` so that later runs with the
+        same QEMU binary, machine type and CPU model and features can
+        start without translating it again.  The file is read at startup
+        and rewritten at exit.  It holds at most 64 MiB of translated
+        code; the translations used least recently are dropped first.
+        Code is reused only where the guest code is unchanged.  This is
+        currently supported on x86-64 Linux hosts only.
+
+        The file contains host machine code that QEMU loads and runs
+        without further checks, so anybody who can write to it can run
+        arbitrary code in the QEMU process.  Keep it in a location that
+        only trusted users can write to.
+
+    ``superblock-threshold=n``
+        Translates a block of guest code again once it has run ``n``
+        times, this time continuing past forward jumps and branches so
+        that more code is optimized together.  The default of 0
+        disables this.  Only x86 guests support superblocks, and they
+        are not used with icount.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefor taking advantage of
@@ -4986,7 +5026,7 @@ SRST
 
             CN=laptop.example.com,O=Example Home,L=London,ST=London,C=GB
 
-    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink``
+    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,io-uring-sqpoll=on|off``
         Creates a dedicated event loop thread that devices can be
         assigned to. This is known as an IOThread. By default device
         emulation happens in vCPU threads or the main event loop thread.
@@ -5006,9 +5046,11 @@ SRST
         latency. Instead of entering a blocking system call to monitor
         file descriptors and then pay the cost of being woken up when an
         event occurs, the polling algorithm spins waiting for events for
-        a short time. The algorithm's default parameters are suitable
-        for many cases but can be adjusted based on knowledge of the
-        workload and/or host device latency.
+        a short time. The polling time is tracked separately for each
+        event source, so sources that rarely fire stop being polled while
+        others in the same IOThread stay busy. The algorithm's default
+        parameters are suitable for many cases but can be adjusted based
+        on knowledge of the workload and/or host device latency.
 
         The ``poll-max-ns`` parameter is the maximum number of
         nanoseconds to busy wait for events. Polling can be disabled by
@@ -5029,6 +5071,13 @@ SRST
         ::
 
             (qemu) qom-set /objects/iothread1 poll-max-ns 100000
+
+        The ``io-uring-sqpoll`` parameter makes the IOThread's io_uring
+        rings, both for fd monitoring and for ``aio=io_uring`` block
+        I/O, use a kernel submission queue polling thread. Requests can
+        then be submitted without system calls while that kernel thread
+        is busy, at the cost of a host CPU spent polling. This requires
+        Linux 5.11 or later and cannot be changed at run-time.
 ERST
 
 
@@ -81,6 +81,8 @@ static TCGv_i64 cpu_bndu[4];
 
 #include "exec/gen-icount.h"
 
+#define MAX_SIDE_EXITS 4
+
 typedef struct DisasContext {
     DisasContextBase base;
 
@@ -142,6 +144,13 @@ typedef struct DisasContext {
     TCGv_i32 tmp3_i32;
     TCGv_i64 tmp1_i64;
 
+    /* superblock side exits, emitted at the end of the TB */
+    bool superblock_extended;
+    unsigned goto_tb_used;
+    int nb_side_exits;
+    TCGLabel *side_exit_label[MAX_SIDE_EXITS];
+    target_ulong side_exit_eip[MAX_SIDE_EXITS];
+
     sigjmp_buf jmpbuf;
 } DisasContext;
 
@@ -2228,6 +2237,7 @@ static inline void gen_goto_tb(DisasContext *s, int tb_num, target_ulong eip)
     if (use_goto_tb(s, pc))  {
         /* jump to same page: we can use a direct jump */
         tcg_gen_goto_tb(tb_num);
+        s->goto_tb_used |= 1 << tb_num;
         gen_jmp_im(s, eip);
         tcg_gen_exit_tb(s->base.tb, tb_num);
         s->base.is_jmp = DISAS_NORETURN;
@@ -2238,11 +2248,73 @@ static inline void gen_goto_tb(DisasContext *s, int tb_num, target_ulong eip)
     }
 }
 
+/*
+ * Superblocks are not ended by forward branches.  Conditional ones
+ * are predicted not taken and leave the TB through a side exit when
+ * they are; direct jumps are followed.  Side exits are chained with
+ * the goto_tb slots that the end of the TB leaves free, so that a
+ * mispredicted branch does not have to look up its target.  The TB
+ * still covers less than a page of contiguous guest code, so that code
+ * modification is detected as usual.
+ *
+ * The guest may never execute the code past a branch, so fetching it
+ * must not fault where the guest would not: once the TB has been
+ * extended, it stays within the page of its first instruction.
+ */
+static bool use_superblock(DisasContext *s)
+{
+    return (tb_cflags(s->base.tb) & CF_SUPERBLOCK) && s->jmp_opt &&
+           !(s->flags & HF_RF_MASK);
+}
+
+static bool superblock_same_page(DisasContext *s, target_ulong eip)
+{
+    target_ulong pc = s->cs_base + eip;
+
+    return !((pc ^ s->base.pc_first) & TARGET_PAGE_MASK);
+}
+
+static bool gen_superblock_jmp(DisasContext *s, target_ulong eip)
+{
+    target_ulong pc = s->cs_base + eip;
+
+    if (!use_superblock(s) || pc < s->pc ||
+        pc - s->base.pc_first >= TARGET_PAGE_SIZE - 32 ||
+        !superblock_same_page(s, eip)) {
+        return false;
+    }
+    s->pc = pc;
+    s->superblock_extended = true;
+    return true;
+}
+
+static bool gen_superblock_jcc(DisasContext *s, int b,
+                               target_ulong val, target_ulong next_eip)
+{
+    TCGLabel *l1;
+
+    if (!use_superblock(s) || val <= next_eip ||
+        s->nb_side_exits == MAX_SIDE_EXITS ||
+        !superblock_same_page(s, next_eip)) {
+        return false;
+    }
+    l1 = gen_new_label();
+    gen_jcc1(s, b, l1);
+    s->side_exit_label[s->nb_side_exits] = l1;
+    s->side_exit_eip[s->nb_side_exits] = val;
+    s->nb_side_exits++;
+    s->superblock_extended = true;
+    return true;
+}
+
 static inline void gen_jcc(DisasContext *s, int b,
                            target_ulong val, target_ulong next_eip)
 {
     TCGLabel *l1, *l2;
 
+    if (gen_superblock_jcc(s, b, val, next_eip)) {
+        return;
+    }
     if (s->jmp_opt) {
         l1 = gen_new_label();
         gen_jcc1(s, b, l1);
@@ -6616,7 +6688,9 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             tval &= 0xffffffff;
         }
         gen_bnd_jmp(s);
-        gen_jmp(s, tval);
+        if (!gen_superblock_jmp(s, tval)) {
+            gen_jmp(s, tval);
+        }
         break;
     case 0xea: /* ljmp im */
         {
@@ -6638,7 +6712,9 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         if (dflag == MO_16) {
             tval &= 0xffff;
         }
-        gen_jmp(s, tval);
+        if (!gen_superblock_jmp(s, tval)) {
+            gen_jmp(s, tval);
+        }
         break;
     case 0x70 ... 0x7f: /* jcc Jb */
         tval = (int8_t)insn_get(env, s, MO_8);
@@ -8519,6 +8595,9 @@ static void i386_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cpu)
     dc->ptr0 = tcg_temp_new_ptr();
     dc->ptr1 = tcg_temp_new_ptr();
     dc->cc_srcT = tcg_temp_local_new();
+    dc->superblock_extended = false;
+    dc->goto_tb_used = 0;
+    dc->nb_side_exits = 0;
 }
 
 static void i386_tr_tb_start(DisasContextBase *db, CPUState *cpu)
@@ -8590,6 +8669,11 @@ static void i386_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
         dc->base.is_jmp = DISAS_TOO_MANY;
     } else if ((pc_next - dc->base.pc_first) >= (TARGET_PAGE_SIZE - 32)) {
         dc->base.is_jmp = DISAS_TOO_MANY;
+    } else if (dc->superblock_extended
+               && (((pc_next + TARGET_MAX_INSN_SIZE - 1) ^ dc->base.pc_first)
+                   & TARGET_PAGE_MASK)) {
+        /* The next instruction may be on a page the guest never reaches. */
+        dc->base.is_jmp = DISAS_TOO_MANY;
     }
 
     dc->base.pc_next = pc_next;
@@ -8598,11 +8682,29 @@ static void i386_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
 static void i386_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
 {
     DisasContext *dc = container_of(dcbase, DisasContext, base);
+    target_ulong eip;
+    int i, tb_num;
 
     if (dc->base.is_jmp == DISAS_TOO_MANY) {
         gen_jmp_im(dc, dc->base.pc_next - dc->cs_base);
         gen_eob(dc);
     }
+
+    /*
+     * Side exits take the goto_tb slots not used by the end of the TB,
+     * in program order.  The remaining ones look up their TB.
+     */
+    for (i = 0; i < dc->nb_side_exits; i++) {
+        eip = dc->side_exit_eip[i];
+        gen_set_label(dc->side_exit_label[i]);
+        tb_num = ctz32(~dc->goto_tb_used);
+        if (tb_num < 2 && use_goto_tb(dc, dc->cs_base + eip)) {
+            gen_goto_tb(dc, tb_num, eip);
+        } else {
+            gen_jmp_im(dc, eip);
+            tcg_gen_lookup_and_goto_ptr();
+        }
+    }
 }
 
 static void i386_tr_disas_log(const DisasContextBase *dcbase,
@@ -134,6 +134,7 @@ extern bool have_avx2;
 #define TCG_TARGET_HAS_mulsh_i32        0
 #define TCG_TARGET_HAS_goto_ptr         1
 #define TCG_TARGET_HAS_direct_jump      1
+#define TCG_TARGET_HAS_tb_relocs        (TCG_TARGET_REG_BITS == 64)
 
 #if TCG_TARGET_REG_BITS == 64
 /* Keep target addresses zero-extended in a register.  */
@@ -219,6 +220,11 @@ static inline void tb_target_set_jmp_target(uintptr_t tc_ptr,
     /* no need to flush icache explicitly */
 }
 
+#if TCG_TARGET_HAS_tb_relocs
+/* Host ISA features that affect the generated code, for the TB cache.  */
+uint32_t tcg_target_code_features(void);
+#endif
+
 /* This defines the natural memory order supported by this
  * architecture before guarantees made by various barrier
  * instructions.
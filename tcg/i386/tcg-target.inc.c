@@ -167,6 +167,14 @@ static bool have_lzcnt;
 
 static tcg_insn_unit *tb_ret_addr;
 
+#if TCG_TARGET_HAS_tb_relocs
+uint32_t tcg_target_code_features(void)
+{
+    return have_cmov | have_bmi1 << 1 | have_popcnt << 2 | have_avx1 << 3
+        | have_avx2 << 4 | have_movbe << 5 | have_bmi2 << 6 | have_lzcnt << 7;
+}
+#endif
+
 static bool patch_reloc(tcg_insn_unit *code_ptr, int type,
                         intptr_t value, intptr_t addend)
 {
@@ -708,6 +716,7 @@ static void tcg_out_sib_offset(TCGContext *s, int r, int rm, int index,
             intptr_t pc = (intptr_t)s->code_ptr + 5 + ~rm;
             intptr_t disp = offset - pc;
             if (disp == (int32_t)disp) {
+                s->tb_relocatable = false;
                 tcg_out8(s, (LOWREGMASK(r) << 3) | 5);
                 tcg_out32(s, disp);
                 return;
@@ -1005,6 +1014,14 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
         tgen_arithr(s, ARITH_XOR, ret, ret);
         return;
     }
+    if (s->tb_relocatable && type != TCG_TYPE_I32
+        && tcg_in_current_tb(s, arg)) {
+        /* Keep addresses within the TB valid when the TB is moved.  */
+        tcg_out_opc(s, OPC_LEA | P_REXW, ret, 0, 0);
+        tcg_out8(s, (LOWREGMASK(ret) << 3) | 5);
+        tcg_out32(s, arg - ((uintptr_t)s->code_ptr + 4));
+        return;
+    }
     if (arg == (uint32_t)arg || type == TCG_TYPE_I32) {
         tcg_out_opc(s, OPC_MOVL_Iv + LOWREGMASK(ret), 0, ret, 0);
         tcg_out32(s, arg);
@@ -1018,7 +1035,7 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
 
     /* Try a 7 byte pc-relative lea before the 10 byte movq.  */
     diff = arg - ((uintptr_t)s->code_ptr + 7);
-    if (diff == (int32_t)diff) {
+    if (diff == (int32_t)diff && !s->tb_relocatable) {
         tcg_out_opc(s, OPC_LEA | P_REXW, ret, 0, 0);
         tcg_out8(s, (LOWREGMASK(ret) << 3) | 5);
         tcg_out32(s, diff);
@@ -1609,6 +1626,22 @@ static void tcg_out_branch(TCGContext *s, int call, tcg_insn_unit *dest)
     if (disp == (int32_t)disp) {
         tcg_out_opc(s, call ? OPC_CALL_Jz : OPC_JMP_long, 0, 0, 0);
         tcg_out32(s, disp);
+        tcg_out_tb_reloc(s, s->code_ptr - 4, dest, TCG_TB_RELOC_PCREL32);
+    } else if (s->tb_relocatable) {
+        /*
+         * The constant pool is not relocated by the TB cache, so keep
+         * the address inline: "jmp *0(%rip); .quad dest" or
+         * "call *2(%rip); jmp 1f; .quad dest; 1:".
+         */
+        tcg_out_opc(s, OPC_GRP5, 0, 0, 0);
+        tcg_out8(s, (call ? EXT5_CALLN_Ev : EXT5_JMPN_Ev) << 3 | 5);
+        tcg_out32(s, call ? 2 : 0);
+        if (call) {
+            tcg_out8(s, OPC_JMP_short);
+            tcg_out8(s, 8);
+        }
+        tcg_out_tb_reloc(s, s->code_ptr, dest, TCG_TB_RELOC_ABS64);
+        tcg_out64(s, (uintptr_t)dest);
     } else {
         /* rip-relative addressing into the constant pool.
            This is 6 + 8 = 14 bytes, as compared to using an
@@ -1333,7 +1333,6 @@ void tcg_optimize(TCGContext *s)
                 /* Simplify LT/GE comparisons vs zero to a single compare
                    vs the high word of the input.  */
             do_brcond_high:
-                bitmap_zero(temps_used.l, nb_temps);
                 op->opc = INDEX_op_brcond_i32;
                 op->args[0] = op->args[1];
                 op->args[1] = op->args[3];
@@ -1359,7 +1358,6 @@ void tcg_optimize(TCGContext *s)
                     goto do_default;
                 }
             do_brcond_low:
-                bitmap_zero(temps_used.l, nb_temps);
                 op->opc = INDEX_op_brcond_i32;
                 op->args[1] = op->args[2];
                 op->args[2] = op->args[4];
@@ -1478,7 +1476,12 @@ void tcg_optimize(TCGContext *s)
                We trash everything if the operation is the end of a basic
                block, otherwise we only trash the output args.  "mask" is
                the non-zero bits mask for the first output arg.  */
-            if (def->flags & TCG_OPF_BB_END) {
+            if (def->flags & TCG_OPF_COND_BRANCH) {
+                /*
+                 * Only the fall-through path follows a conditional
+                 * branch, so everything known still holds after it.
+                 */
+            } else if (def->flags & TCG_OPF_BB_END) {
                 bitmap_zero(temps_used.l, nb_temps);
             } else {
         do_reset_output:
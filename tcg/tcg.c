@@ -341,6 +341,46 @@ static void set_jmp_reset_offset(TCGContext *s, int which)
     assert(s->tb_jmp_reset_offset[which] == off);
 }
 
+/* Return true if @ptr lies within the current TB or its descriptor.  */
+static __attribute__((unused)) bool tcg_in_current_tb(TCGContext *s,
+                                                      uintptr_t ptr)
+{
+    return ptr >= s->tb_start && ptr <= (uintptr_t)s->code_ptr;
+}
+
+/*
+ * Record the field of type @kind at @ptr, which refers to @target,
+ * for the TB cache.  References within the TB move with it.
+ */
+static __attribute__((unused)) void tcg_out_tb_reloc(TCGContext *s,
+                                                     tcg_insn_unit *ptr,
+                                                     void *target,
+                                                     TCGTBRelocKind kind)
+{
+    uintptr_t addr = (uintptr_t)target;
+    TCGTBReloc *r;
+
+    if (!s->tb_relocatable || tcg_in_current_tb(s, addr)) {
+        return;
+    }
+    if (s->nb_tb_relocs == TCG_MAX_TB_RELOCS
+        || (addr >= (uintptr_t)region.start && addr < (uintptr_t)region.end)) {
+        s->tb_relocatable = false;
+        return;
+    }
+
+    r = &s->tb_relocs[s->nb_tb_relocs++];
+    r->offset = tcg_ptr_byte_diff(ptr, s->code_buf);
+    r->kind = kind;
+    if (addr >= (uintptr_t)s->code_gen_prologue
+        && addr < (uintptr_t)region.start) {
+        r->base = TCG_TB_RELOC_PROLOGUE;
+    } else {
+        r->base = TCG_TB_RELOC_TEXT;
+    }
+    r->addend = addr - tcg_tb_reloc_base(r->base);
+}
+
 #include "tcg-target.inc.c"
 
 /* compare a pointer @ptr and a tb_tc @s */
@@ -1129,6 +1169,19 @@ void tcg_prologue_init(TCGContext *s)
     }
 }
 
+/* Return the address that TCGTBReloc.addend is relative to.  */
+uintptr_t tcg_tb_reloc_base(TCGTBRelocBase base)
+{
+    switch (base) {
+    case TCG_TB_RELOC_PROLOGUE:
+        return (uintptr_t)tcg_ctx->code_gen_prologue;
+    case TCG_TB_RELOC_TEXT:
+        return (uintptr_t)tcg_gen_code;
+    default:
+        g_assert_not_reached();
+    }
+}
+
 void tcg_func_start(TCGContext *s)
 {
     tcg_pool_reset(s);
@@ -1141,6 +1194,9 @@ void tcg_func_start(TCGContext *s)
     s->nb_labels = 0;
     s->current_frame_offset = s->frame_start;
 
+    s->tb_relocatable = s->tb_record_relocs;
+    s->nb_tb_relocs = 0;
+
 #ifdef CONFIG_DEBUG_TCG
     s->goto_tb_issue_mask = 0;
 #endif
@@ -2529,6 +2585,28 @@ static void la_global_sync(TCGContext *s, int ng)
     }
 }
 
+/*
+ * liveness analysis: conditional branch: globals and local temps
+ * should be synced.  Only the fall-through path follows the branch,
+ * so temps keep the state computed from it.
+ */
+static void la_bb_sync(TCGContext *s, int ng, int nt)
+{
+    int i;
+
+    la_global_sync(s, ng);
+
+    for (i = ng; i < nt; ++i) {
+        if (s->temps[i].temp_local) {
+            int state = s->temps[i].state;
+            s->temps[i].state = state | TS_MEM;
+            if (state == TS_DEAD) {
+                la_reset_pref(&s->temps[i]);
+            }
+        }
+    }
+}
+
 /* liveness analysis: sync globals back to memory and kill.  */
 static void la_global_kill(TCGContext *s, int ng)
 {
@@ -2805,6 +2883,8 @@ static void liveness_pass_1(TCGContext *s)
             /* If end of basic block, update.  */
             if (def->flags & TCG_OPF_BB_EXIT) {
                 la_func_end(s, nb_globals, nb_temps);
+            } else if (def->flags & TCG_OPF_COND_BRANCH) {
+                la_bb_sync(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_BB_END) {
                 la_bb_end(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
@@ -2917,7 +2997,10 @@ static bool liveness_pass_2(TCGContext *s)
             nb_oargs = def->nb_oargs;
 
             /* Set flags similar to how calls require.  */
-            if (def->flags & TCG_OPF_BB_END) {
+            if (def->flags & TCG_OPF_COND_BRANCH) {
+                /* Like reading globals: sync_globals */
+                call_flags = TCG_CALL_NO_WRITE_GLOBALS;
+            } else if (def->flags & TCG_OPF_BB_END) {
                 /* Like writing globals: save_globals */
                 call_flags = 0;
             } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
@@ -3389,6 +3472,28 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
     save_globals(s, allocated_regs);
 }
 
+/*
+ * At a conditional branch, we assume all globals and local temps are
+ * synced to their location, but they stay in registers for the
+ * fall-through path.
+ */
+static void tcg_reg_alloc_cbranch(TCGContext *s, TCGRegSet allocated_regs)
+{
+    int i;
+
+    sync_globals(s, allocated_regs);
+
+    for (i = s->nb_globals; i < s->nb_temps; i++) {
+        TCGTemp *ts = &s->temps[i];
+        /*
+         * The liveness analysis already ensures that local temps are
+         * synced.  Keep an tcg_debug_assert for safety.
+         */
+        tcg_debug_assert(!ts->temp_local || ts->val_type != TEMP_VAL_REG
+                         || ts->mem_coherent);
+    }
+}
+
 /*
  * Specialized code generation for INDEX_op_movi_*.
  */
@@ -3741,7 +3846,9 @@ static void tcg_reg_alloc_op(TCGContext *s, const TCGOp *op)
         }
     }
 
-    if (def->flags & TCG_OPF_BB_END) {
+    if (def->flags & TCG_OPF_COND_BRANCH) {
+        tcg_reg_alloc_cbranch(s, i_allocated_regs);
+    } else if (def->flags & TCG_OPF_BB_END) {
         tcg_reg_alloc_bb_end(s, i_allocated_regs);
     } else {
         if (def->flags & TCG_OPF_CALL_CLOBBER) {
@@ -4177,6 +4284,7 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 
     s->code_buf = tb->tc.ptr;
     s->code_ptr = tb->tc.ptr;
+    s->tb_start = (uintptr_t)tb;
 
 #ifdef TCG_TARGET_NEED_LDST_LABELS
     QSIMPLEQ_INIT(&s->ldst_labels);
@@ -181,6 +181,24 @@ static bool check_guest_output(QTestState *qts, const testdef_t *test, int fd)
     return false;
 }
 
+/* Check the TB lookup counters of a guest that ran under TCG.  */
+static void check_jit_info(QTestState *qts)
+{
+    char *info = qtest_hmp(qts, "info jit");
+    const char *p = strstr(info, "TB L2 cache hits");
+    size_t hits, lookups;
+
+    /* Without TCG, the guest ran under KVM.  */
+    if (!strstr(info, "only available with accel=tcg")) {
+        g_assert(p);
+        g_assert_cmpint(sscanf(p, "TB L2 cache hits %zu/%zu",
+                               &hits, &lookups), ==, 2);
+        g_assert_cmpuint(lookups, >, 0);
+        g_assert_cmpuint(hits, <=, lookups);
+    }
+    g_free(info);
+}
+
 static void test_machine(const void *data)
 {
     const testdef_t *test = data;
@@ -232,6 +250,7 @@ static void test_machine(const void *data)
     }
     unlink(serialtmp);
 
+    check_jit_info(qts);
     qtest_quit(qts);
 
     close(ser_fd);
@@ -1099,6 +1099,65 @@ static void test_migrate_fd_proto(void)
     test_migrate_end(from, to, true);
 }
 
+static void test_migrate_fd_file_mapped_ram(void)
+{
+    MigrateStart *args = migrate_start_new();
+    char *path = g_strdup_printf("%s/migfile", tmpfs);
+    QTestState *from, *to;
+    QDict *rsp;
+    int fd;
+
+    if (test_migrate_start(&from, &to, "defer", args)) {
+        g_free(path);
+        return;
+    }
+
+    migrate_set_parameter_int(from, "downtime-limit", 300);
+    /* 1GB/s */
+    migrate_set_parameter_int(from, "max-bandwidth", 1000000000);
+    migrate_set_parameter_int(from, "multifd-channels", 4);
+    migrate_set_parameter_int(to, "multifd-channels", 4);
+    migrate_set_capability(from, "mapped-ram", "true");
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    /* Save the guest to a file */
+    fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0600);
+    g_assert_cmpint(fd, >=, 0);
+    rsp = wait_command_fd(from, fd,
+                          "{ 'execute': 'getfd',"
+                          "  'arguments': { 'fdname': 'fd-mig' }}");
+    qobject_unref(rsp);
+    close(fd);
+
+    migrate_qmp(from, "fd:fd-mig", "{}");
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    wait_for_migration_complete(from);
+
+    /* Restore it on the destination */
+    fd = open(path, O_RDONLY);
+    g_assert_cmpint(fd, >=, 0);
+    rsp = wait_command_fd(to, fd,
+                          "{ 'execute': 'getfd',"
+                          "  'arguments': { 'fdname': 'fd-mig' }}");
+    qobject_unref(rsp);
+    close(fd);
+
+    rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
+                           "  'arguments': { 'uri': 'fd:fd-mig' }}");
+    qobject_unref(rsp);
+
+    qtest_qmp_eventwait(to, "RESUME");
+    wait_for_serial("dest_serial");
+    test_migrate_end(from, to, true);
+    cleanup("migfile");
+    g_free(path);
+}
+
 static void do_test_validate_uuid(MigrateStart *args, bool should_fail)
 {
     char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
@@ -1260,7 +1319,7 @@ static void test_migrate_auto_converge(void)
     test_migrate_end(from, to, true);
 }
 
-static void test_multifd_tcp(const char *method)
+static void test_multifd_tcp(const char *method, bool zero_page)
 {
     MigrateStart *args = migrate_start_new();
     QTestState *from, *to;
@@ -1290,6 +1349,11 @@ static void test_multifd_tcp(const char *method)
     migrate_set_capability(from, "multifd", "true");
     migrate_set_capability(to, "multifd", "true");
 
+    if (zero_page) {
+        migrate_set_capability(from, "multifd-zero-page", "true");
+        migrate_set_capability(to, "multifd-zero-page", "true");
+    }
+
     /* Start incoming migration from the 1st socket */
     rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
                            "  'arguments': { 'uri': 'tcp:127.0.0.1:0' }}");
@@ -1320,18 +1384,23 @@ static void test_multifd_tcp(const char *method)
 
 static void test_multifd_tcp_none(void)
 {
-    test_multifd_tcp("none");
+    test_multifd_tcp("none", false);
+}
+
+static void test_multifd_tcp_zero_page(void)
+{
+    test_multifd_tcp("none", true);
 }
 
 static void test_multifd_tcp_zlib(void)
 {
-    test_multifd_tcp("zlib");
+    test_multifd_tcp("zlib", false);
 }
 
 #ifdef CONFIG_ZSTD
 static void test_multifd_tcp_zstd(void)
 {
-    test_multifd_tcp("zstd");
+    test_multifd_tcp("zstd", false);
 }
 #endif
 
@@ -1488,6 +1557,8 @@ int main(int argc, char **argv)
     /* qtest_add_func("/migration/ignore_shared", test_ignore_shared); */
     qtest_add_func("/migration/xbzrle/unix", test_xbzrle_unix);
     qtest_add_func("/migration/fd_proto", test_migrate_fd_proto);
+    qtest_add_func("/migration/fd_file/mapped-ram",
+                   test_migrate_fd_file_mapped_ram);
     qtest_add_func("/migration/validate_uuid", test_validate_uuid);
     qtest_add_func("/migration/validate_uuid_error", test_validate_uuid_error);
     qtest_add_func("/migration/validate_uuid_src_not_set",
@@ -1497,6 +1568,8 @@ int main(int argc, char **argv)
 
     qtest_add_func("/migration/auto_converge", test_migrate_auto_converge);
     qtest_add_func("/migration/multifd/tcp/none", test_multifd_tcp_none);
+    qtest_add_func("/migration/multifd/tcp/zero-page",
+                   test_multifd_tcp_zero_page);
     qtest_add_func("/migration/multifd/tcp/cancel", test_multifd_tcp_cancel);
     qtest_add_func("/migration/multifd/tcp/zlib", test_multifd_tcp_zlib);
 #ifdef CONFIG_ZSTD
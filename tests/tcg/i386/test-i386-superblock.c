@@ -0,0 +1,133 @@
+/*
+ * Test superblock translation.
+ *
+ * Run with a low -superblock-threshold, so that the code below is
+ * translated again as superblocks after its first runs.  The results
+ * must be the same whether a forward branch leaves the superblock
+ * through a side exit or falls through, and whether a jump is followed
+ * or not.  The checks run in several threads at once, so that the
+ * code is retranslated while other threads are running it.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define NR_THREADS 4
+
+/*
+ * Return max(a, b) + 1.  The jg is predicted not taken and leaves the
+ * superblock when it is; the jmp is followed.
+ */
+static int __attribute__((noinline)) max_plus_one(int a, int b)
+{
+    int r;
+
+    __asm__ volatile ("cmp %2, %1\n\t"
+                      "jg 1f\n\t"
+                      "mov %2, %0\n\t"
+                      "jmp 2f\n"
+                      "1:\n\t"
+                      "mov %1, %0\n"
+                      "2:\n\t"
+                      "add $1, %0"
+                      : "=&r" (r) : "r" (a), "r" (b) : "cc");
+    return r;
+}
+
+/* A chain of forward branches, each taken or not depending on @x.  */
+static int __attribute__((noinline)) classify(uint32_t x)
+{
+    int r = 0;
+
+    __asm__ volatile ("test $1, %1\n\t"
+                      "jz 1f\n\t"
+                      "add $1, %0\n"
+                      "1:\n\t"
+                      "test $2, %1\n\t"
+                      "jz 2f\n\t"
+                      "add $10, %0\n\t"
+                      "jmp 3f\n"
+                      "2:\n\t"
+                      "add $100, %0\n"
+                      "3:\n\t"
+                      "test $4, %1\n\t"
+                      "jnz 4f\n\t"
+                      "add $1000, %0\n"
+                      "4:"
+                      : "+r" (r) : "r" (x) : "cc");
+    return r;
+}
+
+static int classify_ref(uint32_t x)
+{
+    return (x & 1 ? 1 : 0) + (x & 2 ? 10 : 100) + (x & 4 ? 0 : 1000);
+}
+
+static int sum_bits(uint32_t x)
+{
+    int i, n = 0;
+
+    for (i = 0; i < 32; i++) {
+        if (x & (1u << i)) {
+            n++;
+        }
+    }
+    return n;
+}
+
+static void *run_checks(void *arg)
+{
+    uint32_t x;
+    int i;
+    intptr_t ret = 0;
+
+    /* Hot on its first runs, then the branch goes the other way.  */
+    for (i = 0; i < 8; i++) {
+        if (max_plus_one(i, 100) != 101) {
+            printf("FAIL: max_plus_one(%d, 100)\n", i);
+            ret = 1;
+        }
+    }
+    for (i = 0; i < 8; i++) {
+        if (max_plus_one(200 + i, 100) != 201 + i) {
+            printf("FAIL: max_plus_one(%d, 100)\n", 200 + i);
+            ret = 1;
+        }
+    }
+
+    /* Every combination of taken and not taken, in changing order.  */
+    for (i = 0; i < 64; i++) {
+        x = (i * 5) & 7;
+        if (classify(x) != classify_ref(x)) {
+            printf("FAIL: classify(%u) = %d\n", x, classify(x));
+            ret = 1;
+        }
+    }
+
+    for (x = 1; x; x <<= 1) {
+        if (sum_bits(x | 0x80000001u) != (x == 1 || x == 0x80000000u
+                                           ? 2 : 3)) {
+            printf("FAIL: sum_bits(%#x)\n", x | 0x80000001u);
+            ret = 1;
+        }
+    }
+    return (void *)ret;
+}
+
+int main(void)
+{
+    pthread_t threads[NR_THREADS];
+    void *thread_ret;
+    int i, ret;
+
+    for (i = 0; i < NR_THREADS; i++) {
+        pthread_create(&threads[i], NULL, run_checks, NULL);
+    }
+    ret = run_checks(NULL) != NULL;
+    for (i = 0; i < NR_THREADS; i++) {
+        pthread_join(threads[i], &thread_ret);
+        ret |= thread_ret != NULL;
+    }
+    return ret;
+}
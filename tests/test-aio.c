@@ -18,6 +18,9 @@
 #include "qemu/error-report.h"
 #include "qemu/coroutine.h"
 #include "qemu/main-loop.h"
+#ifdef CONFIG_TIMERFD
+#include <sys/timerfd.h>
+#endif
 
 static AioContext *ctx;
 
@@ -512,6 +515,116 @@ static void test_timer_schedule(void)
     timer_del(&data.timer);
 }
 
+#ifdef CONFIG_TIMERFD
+/*
+ * Two handlers that fire in turn, each POLL_DELAY_NS after the other, like
+ * a virtqueue notifier and the AIO completions it causes.  A timerfd wakes
+ * up aio_poll() if polling does not catch the event first.
+ */
+#define POLL_DELAY_NS   (50 * SCALE_US)
+#define POLL_MAX_NS     (2 * SCALE_MS)
+
+typedef struct {
+    int fd;
+    int64_t deadline;
+    int n;
+} PollTestData;
+
+static PollTestData poll_data[2];
+static int poll_turn;
+static bool poll_stopped;
+
+static void poll_test_arm(PollTestData *data)
+{
+    struct itimerspec its = {
+        .it_value.tv_nsec = POLL_DELAY_NS,
+    };
+
+    data->deadline = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + POLL_DELAY_NS;
+    g_assert_cmpint(timerfd_settime(data->fd, 0, &its, NULL), ==, 0);
+}
+
+static bool poll_test_fire(PollTestData *data)
+{
+    if (poll_stopped || data != &poll_data[poll_turn] ||
+        qemu_clock_get_ns(QEMU_CLOCK_REALTIME) < data->deadline) {
+        return false;
+    }
+    data->n++;
+    poll_turn ^= 1;
+    poll_test_arm(&poll_data[poll_turn]);
+    return true;
+}
+
+static bool poll_test_io_poll(void *opaque)
+{
+    return poll_test_fire(opaque);
+}
+
+static void poll_test_io_read(void *opaque)
+{
+    PollTestData *data = opaque;
+    uint64_t expirations;
+
+    /* Polling may have seen the deadline before the timerfd expired */
+    if (read(data->fd, &expirations, sizeof(expirations)) < 0) {
+        g_assert_cmpint(errno, ==, EAGAIN);
+    }
+    poll_test_fire(data);
+}
+
+static void test_poll_alternate(void)
+{
+    int64_t max_poll_ns = 0;
+    int i;
+
+    aio_context_set_poll_params(ctx, POLL_MAX_NS, 0, 0, &error_abort);
+    for (i = 0; i < 2; i++) {
+        poll_data[i].fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        g_assert_cmpint(poll_data[i].fd, >=, 0);
+        poll_data[i].n = 0;
+        aio_set_fd_handler(ctx, poll_data[i].fd, false, poll_test_io_read,
+                           NULL, poll_test_io_poll, &poll_data[i]);
+    }
+    poll_turn = 0;
+    poll_stopped = false;
+    poll_test_arm(&poll_data[0]);
+
+    while (poll_data[0].n + poll_data[1].n < 200) {
+        aio_poll(ctx, true);
+        max_poll_ns = MAX(max_poll_ns, ctx->poll_ns);
+    }
+
+    /*
+     * Each handler misses every other iteration.  That must not reset its
+     * polling time, or the context would never poll long enough to catch
+     * the next event.
+     */
+    g_assert_cmpint(max_poll_ns, >=, POLL_DELAY_NS);
+
+    /* Once both handlers have been idle for longer than poll-max-ns... */
+    poll_stopped = true;
+    for (i = 0; i < 2; i++) {
+        struct itimerspec its = { };
+
+        g_assert_cmpint(timerfd_settime(poll_data[i].fd, 0, &its, NULL),
+                        ==, 0);
+    }
+    g_usleep(2 * POLL_MAX_NS / SCALE_US);
+    aio_poll(ctx, false);
+
+    /* ... the context stops polling */
+    g_assert_cmpint(ctx->poll_ns, ==, 0);
+
+    for (i = 0; i < 2; i++) {
+        aio_set_fd_handler(ctx, poll_data[i].fd, false, NULL, NULL, NULL,
+                           NULL);
+        close(poll_data[i].fd);
+    }
+    aio_context_set_poll_params(ctx, 0, 0, 0, &error_abort);
+}
+#endif
+
 /* Now the same tests, using the context as a GSource.  They are
  * very similar to the ones above, with g_main_context_iteration
  * replacing aio_poll.  However:
@@ -901,6 +1014,9 @@ int main(int argc, char **argv)
     g_test_add_func("/aio/event/flush",             test_flush_event_notifier);
     g_test_add_func("/aio/external-client",         test_aio_external_client);
     g_test_add_func("/aio/timer/schedule",          test_timer_schedule);
+#ifdef CONFIG_TIMERFD
+    g_test_add_func("/aio/poll/alternate",          test_poll_alternate);
+#endif
 
     g_test_add_func("/aio/coroutine/queue-chaining", test_queue_chaining);
 
@@ -20,6 +20,8 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/bitmap.h"
+#include "qemu/units.h"
 
 static char buffer[8 * 1024 * 1024];
 
@@ -58,21 +60,97 @@ static void test_1(void)
     }
 }
 
+static void test_find_nonzero(void)
+{
+    size_t s, o;
+
+    g_assert_cmpuint(buffer_find_nonzero_offset(buffer, sizeof(buffer)), ==,
+                     sizeof(buffer));
+
+    for (s = 1; s < 4096; s += 7) {
+        for (o = 0; o < s; o += 5) {
+            buffer[1 + o] = 1;
+            g_assert_cmpuint(buffer_find_nonzero_offset(buffer + 1, s), ==, o);
+            buffer[1 + o] = 0;
+        }
+        g_assert_cmpuint(buffer_find_nonzero_offset(buffer + 1, s), ==, s);
+    }
+}
+
+static void test_bitmap(void)
+{
+    const size_t granularity = 4096;
+    const size_t len = 64 * granularity + 100;
+    unsigned long *bitmap = bitmap_new(DIV_ROUND_UP(len, granularity));
+    size_t i;
+
+    buffer_zero_bitmap(buffer, len, granularity, bitmap);
+    g_assert(bitmap_full(bitmap, DIV_ROUND_UP(len, granularity)));
+
+    /* Mark every third chunk as non-zero, including the short last one */
+    for (i = 0; i * granularity < len; i += 3) {
+        buffer[i * granularity + (i % granularity)] = 1;
+    }
+    buffer[len - 1] = 1;
+    buffer_zero_bitmap(buffer, len, granularity, bitmap);
+    for (i = 0; i * granularity < len; i++) {
+        bool nonzero = i % 3 == 0 || (i + 1) * granularity >= len;
+        g_assert_cmpint(test_bit(i, bitmap), ==, !nonzero);
+    }
+
+    memset(buffer, 0, len);
+    g_free(bitmap);
+}
+
 static void test_2(void)
 {
     if (g_test_perf()) {
         test_1();
+        test_find_nonzero();
+        test_bitmap();
     } else {
         do {
             test_1();
+            test_find_nonzero();
+            test_bitmap();
         } while (test_buffer_is_zero_next_accel());
     }
 }
 
+/* Throughput of buffer_is_zero() on zeroed buffers, for each accelerator */
+static void test_perf(void)
+{
+    static const size_t sizes[] = { 512, 4096, 64 * 1024, sizeof(buffer) };
+    int accel = 0;
+
+    do {
+        size_t i;
+
+        for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+            uint64_t total = 0;
+            double elapsed;
+
+            g_test_timer_start();
+            do {
+                g_assert(buffer_is_zero(buffer, sizes[i]));
+                total += sizes[i];
+            } while (total < 4 * GiB);
+            elapsed = g_test_timer_elapsed();
+
+            g_test_message("accelerator %d, %zu byte buffers: %.2f GiB/s",
+                           accel, sizes[i], total / elapsed / GiB);
+        }
+        accel++;
+    } while (test_buffer_is_zero_next_accel());
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
     g_test_add_func("/cutils/bufferiszero", test_2);
+    if (g_test_perf()) {
+        g_test_add_func("/cutils/bufferiszero/perf", test_perf);
+    }
 
     return g_test_run();
 }
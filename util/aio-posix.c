@@ -15,6 +15,7 @@
 
 #include "qemu/osdep.h"
 #include "block/block.h"
+#include "qapi/error.h"
 #include "qemu/rcu.h"
 #include "qemu/rcu_queue.h"
 #include "qemu/sockets.h"
@@ -385,8 +386,14 @@ void aio_dispatch(AioContext *ctx)
     timerlistgroup_run_timers(&ctx->tlg);
 }
 
+/*
+ * Handlers are polled for their own polling time only, except that each
+ * of them is polled at least once (@elapsed_time == 0) so that none of them
+ * starves while another one keeps the context in polling mode.
+ */
 static bool run_poll_handlers_once(AioContext *ctx,
                                    int64_t now,
+                                   int64_t elapsed_time,
                                    int64_t *timeout)
 {
     bool progress = false;
@@ -394,9 +401,13 @@ static bool run_poll_handlers_once(AioContext *ctx,
     AioHandler *tmp;
 
     QLIST_FOREACH_SAFE(node, &ctx->poll_aio_handlers, node_poll, tmp) {
+        if (elapsed_time > node->poll_ns) {
+            continue;
+        }
         if (aio_node_check(ctx, node->is_external) &&
             node->io_poll(node->opaque)) {
             node->poll_idle_timeout = now + POLL_IDLE_INTERVAL_NS;
+            node->poll_event = true;
 
             /*
              * Polling was successful, exit try_poll_mode immediately
@@ -474,7 +485,7 @@ static bool remove_idle_poll_handlers(AioContext *ctx, int64_t now)
 static bool run_poll_handlers(AioContext *ctx, int64_t max_ns, int64_t *timeout)
 {
     bool progress;
-    int64_t start_time, elapsed_time;
+    int64_t start_time, elapsed_time = 0;
 
     assert(ctx->notify_me);
     assert(qemu_lockcnt_count(&ctx->list_lock) > 0);
@@ -493,7 +504,8 @@ static bool run_poll_handlers(AioContext *ctx, int64_t max_ns, int64_t *timeout)
 
     start_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     do {
-        progress = run_poll_handlers_once(ctx, start_time, timeout);
+        progress = run_poll_handlers_once(ctx, start_time, elapsed_time,
+                                          timeout);
         elapsed_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_time;
         max_ns = qemu_soonest_timeout(*timeout, max_ns);
         assert(!(max_ns && progress));
@@ -551,6 +563,90 @@ static bool try_poll_mode(AioContext *ctx, int64_t *timeout)
     return false;
 }
 
+/*
+ * Adjust the polling time of a handler after an aio_poll() iteration that
+ * ended at @now and blocked (or polled) for @block_ns.  Handlers that had
+ * an event within their polling time are left alone, handlers whose event
+ * came a bit too late poll longer next time, and handlers that had to wait
+ * longer than poll_max_ns poll less.
+ *
+ * An iteration without an event for the handler says little by itself:
+ * another handler may simply have fired first, as a virtqueue notifier
+ * and the AIO completions it causes tend to do in turn.  A handler only
+ * polls less once it has been idle for longer than the longest polling
+ * window, poll_max_ns.  Handlers for idle devices thus stop costing
+ * polling time even while other handlers in the same AioContext are busy.
+ */
+static void adjust_handler_polling_time(AioContext *ctx, AioHandler *node,
+                                        int64_t now, int64_t block_ns)
+{
+    if (node->poll_event) {
+        node->poll_event_time = now;
+    }
+
+    if (!node->poll_event && now - node->poll_event_time <= ctx->poll_max_ns) {
+        /* Another handler may just have fired first, no adjustment needed */
+    } else if (!node->poll_event || block_ns > ctx->poll_max_ns) {
+        /*
+         * Idle for the whole window, or we'd have to poll for too long:
+         * poll less
+         */
+        if (ctx->poll_shrink) {
+            node->poll_ns /= ctx->poll_shrink;
+        } else {
+            node->poll_ns = 0;
+        }
+    } else if (block_ns <= node->poll_ns) {
+        /* This is the sweet spot, no adjustment needed */
+    } else if (node->poll_ns < ctx->poll_max_ns) {
+        /* There is room to grow, poll longer */
+        int64_t grow = ctx->poll_grow;
+
+        if (grow == 0) {
+            grow = 2;
+        }
+
+        if (node->poll_ns) {
+            node->poll_ns *= grow;
+        } else {
+            node->poll_ns = 4000; /* start polling at 4 microseconds */
+        }
+    }
+
+    if (node->poll_ns > ctx->poll_max_ns) {
+        node->poll_ns = ctx->poll_max_ns;
+    }
+    node->poll_event = false;
+}
+
+/*
+ * The AioContext polls for as long as its most active handler wants.
+ * Called with ctx->list_lock incremented.
+ */
+static void adjust_polling_time(AioContext *ctx, AioHandlerList *ready_list,
+                                int64_t now, int64_t block_ns)
+{
+    AioHandler *node;
+    int64_t old = ctx->poll_ns;
+    int64_t poll_ns = 0;
+
+    QLIST_FOREACH(node, ready_list, node_ready) {
+        node->poll_event = true;
+    }
+
+    QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
+        adjust_handler_polling_time(ctx, node, now, block_ns);
+        poll_ns = MAX(poll_ns, node->poll_ns);
+    }
+
+    ctx->poll_ns = poll_ns;
+    if (poll_ns < old) {
+        trace_poll_shrink(ctx, old, poll_ns);
+    } else if (poll_ns > old) {
+        trace_poll_grow(ctx, old, poll_ns);
+    }
+}
+
 bool aio_poll(AioContext *ctx, bool blocking)
 {
     AioHandlerList ready_list = QLIST_HEAD_INITIALIZER(ready_list);
@@ -608,43 +704,9 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     /* Adjust polling time */
     if (ctx->poll_max_ns) {
-        int64_t block_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
-
-        if (block_ns <= ctx->poll_ns) {
-            /* This is the sweet spot, no adjustment needed */
-        } else if (block_ns > ctx->poll_max_ns) {
-            /* We'd have to poll for too long, poll less */
-            int64_t old = ctx->poll_ns;
-
-            if (ctx->poll_shrink) {
-                ctx->poll_ns /= ctx->poll_shrink;
-            } else {
-                ctx->poll_ns = 0;
-            }
-
-            trace_poll_shrink(ctx, old, ctx->poll_ns);
-        } else if (ctx->poll_ns < ctx->poll_max_ns &&
-                   block_ns < ctx->poll_max_ns) {
-            /* There is room to grow, poll longer */
-            int64_t old = ctx->poll_ns;
-            int64_t grow = ctx->poll_grow;
+        int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
 
-            if (grow == 0) {
-                grow = 2;
-            }
-
-            if (ctx->poll_ns) {
-                ctx->poll_ns *= grow;
-            } else {
-                ctx->poll_ns = 4000; /* start polling at 4 microseconds */
-            }
-
-            if (ctx->poll_ns > ctx->poll_max_ns) {
-                ctx->poll_ns = ctx->poll_max_ns;
-            }
-
-            trace_poll_grow(ctx, old, ctx->poll_ns);
-        }
+        adjust_polling_time(ctx, &ready_list, now, now - start);
     }
 
     progress |= aio_bh_poll(ctx);
@@ -694,6 +756,19 @@ void aio_context_use_g_source(AioContext *ctx)
     aio_free_deleted_handlers(ctx);
 }
 
+void aio_context_set_io_uring_sqpoll(AioContext *ctx, bool sqpoll,
+                                     Error **errp)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    fdmon_io_uring_set_sqpoll(ctx, sqpoll, errp);
+    aio_free_deleted_handlers(ctx);
+#else
+    if (sqpoll) {
+        error_setg(errp, "io_uring SQPOLL mode requires io_uring support");
+    }
+#endif
+}
+
 void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink, Error **errp)
 {
@@ -36,6 +36,9 @@ struct AioHandler {
     unsigned flags; /* see fdmon-io_uring.c */
 #endif
     int64_t poll_idle_timeout; /* when to stop userspace polling */
+    int64_t poll_ns;           /* polling time for this handler */
+    int64_t poll_event_time;   /* when the last event was seen */
+    bool poll_event;           /* had an event in the current aio_poll() */
     bool is_external;
 };
 
@@ -67,6 +70,7 @@ static inline void fdmon_epoll_disable(AioContext *ctx)
 #ifdef CONFIG_LINUX_IO_URING
 bool fdmon_io_uring_setup(AioContext *ctx);
 void fdmon_io_uring_destroy(AioContext *ctx);
+void fdmon_io_uring_set_sqpoll(AioContext *ctx, bool sqpoll, Error **errp);
 #else
 static inline bool fdmon_io_uring_setup(AioContext *ctx)
 {
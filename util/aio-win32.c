@@ -418,6 +418,14 @@ void aio_context_use_g_source(AioContext *ctx)
 {
 }
 
+void aio_context_set_io_uring_sqpoll(AioContext *ctx, bool sqpoll,
+                                     Error **errp)
+{
+    if (sqpoll) {
+        error_setg(errp, "io_uring is not available on Windows");
+    }
+}
+
 void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink, Error **errp)
 {
@@ -401,7 +401,7 @@ LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
         return ctx->linux_io_uring;
     }
 
-    ctx->linux_io_uring = luring_init(errp);
+    ctx->linux_io_uring = luring_init(ctx, errp);
     if (!ctx->linux_io_uring) {
         return NULL;
     }
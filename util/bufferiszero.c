@@ -24,6 +24,7 @@
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
 #include "qemu/bswap.h"
+#include "qemu/bitops.h"
 
 static bool
 buffer_zero_int(const void *buf, size_t len)
@@ -329,6 +330,66 @@ static bool select_accel_fn(const void *buf, size_t len)
     return buffer_zero_int(buf, len);
 }
 
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+
+/* Note that this vectorized function requires len >= 64.  */
+
+static bool
+buffer_zero_neon(const void *buf, size_t len)
+{
+    uint64x2_t t = vld1q_u64(buf);
+    const uint64x2_t *p = (uint64x2_t *)(((uintptr_t)buf + 5 * 16) & -16);
+    const uint64x2_t *e = (uint64x2_t *)(((uintptr_t)buf + len) & -16);
+
+    /* Loop over 16-byte aligned blocks of 64.  */
+    while (likely(p <= e)) {
+        __builtin_prefetch(p);
+        if (unlikely(vmaxvq_u32(vreinterpretq_u32_u64(t)))) {
+            return false;
+        }
+        t = vorrq_u64(vorrq_u64(p[-4], p[-3]), vorrq_u64(p[-2], p[-1]));
+        p += 4;
+    }
+
+    /* Finish the aligned tail.  */
+    t = vorrq_u64(t, vorrq_u64(e[-3], vorrq_u64(e[-2], e[-1])));
+
+    /* Finish the unaligned tail.  */
+    t = vorrq_u64(t, vld1q_u64(buf + len - 16));
+
+    return !vmaxvq_u32(vreinterpretq_u32_u64(t));
+}
+
+/* Advanced SIMD is a mandatory part of ARMv8-A, so no runtime check.  */
+#define CACHE_NEON    1
+
+static unsigned cpuid_cache = CACHE_NEON;
+static bool (*buffer_accel)(const void *, size_t) = buffer_zero_neon;
+
+static void init_accel(unsigned cache)
+{
+    buffer_accel = (cache & CACHE_NEON) ? buffer_zero_neon : buffer_zero_int;
+}
+
+bool test_buffer_is_zero_next_accel(void)
+{
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+
+static bool select_accel_fn(const void *buf, size_t len)
+{
+    if (likely(len >= 64)) {
+        return buffer_accel(buf, len);
+    }
+    return buffer_zero_int(buf, len);
+}
+
 #else
 #define select_accel_fn  buffer_zero_int
 bool test_buffer_is_zero_next_accel(void)
@@ -353,3 +414,50 @@ bool buffer_is_zero(const void *buf, size_t len)
        includes a check for an unrolled loop over 64-bit integers.  */
     return select_accel_fn(buf, len);
 }
+
+/*
+ * Returns the offset of the first non-zero byte in the buffer, or @len if
+ * the buffer is all zeroes.
+ */
+size_t buffer_find_nonzero_offset(const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    size_t i, block;
+
+    /* Skip zero blocks with the accelerated check, then look for the byte */
+    for (i = 0; i < len; i += block) {
+        block = MIN(len - i, 1024);
+        if (!buffer_is_zero(p + i, block)) {
+            while (!p[i]) {
+                i++;
+            }
+            return i;
+        }
+    }
+    return len;
+}
+
+/*
+ * Checks @len bytes in chunks of @granularity bytes (the last chunk may be
+ * shorter) and sets bit i of @bitmap iff chunk i is all zeroes, clearing it
+ * otherwise.
+ */
+void buffer_zero_bitmap(const void *buf, size_t len, size_t granularity,
+                        unsigned long *bitmap)
+{
+    size_t i, offset;
+
+    assert(granularity > 0);
+
+    for (i = 0, offset = 0; offset < len; i++, offset += granularity) {
+        size_t chunk = MIN(len - offset, granularity);
+
+        /* Fetch the next chunk while this one is being checked.  */
+        __builtin_prefetch(buf + offset + granularity);
+        if (select_accel_fn(buf + offset, chunk)) {
+            set_bit(i, bitmap);
+        } else {
+            clear_bit(i, bitmap);
+        }
+    }
+}
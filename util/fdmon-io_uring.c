@@ -45,12 +45,16 @@
 
 #include "qemu/osdep.h"
 #include <poll.h>
+#include "qapi/error.h"
 #include "qemu/rcu_queue.h"
 #include "aio-posix.h"
 
 enum {
     FDMON_IO_URING_ENTRIES  = 128, /* sq/cq ring size */
 
+    /* Idle time in milliseconds before the SQPOLL thread goes to sleep */
+    FDMON_IO_URING_SQ_THREAD_IDLE = 1000,
+
     /* AioHandler::flags */
     FDMON_IO_URING_PENDING  = (1 << 0),
     FDMON_IO_URING_ADD      = (1 << 1),
@@ -321,11 +325,55 @@ static const FDMonOps fdmon_io_uring_ops = {
     .need_wait = fdmon_io_uring_need_wait,
 };
 
+int aio_io_uring_queue_init(AioContext *ctx, unsigned entries,
+                            struct io_uring *ring)
+{
+#ifdef IORING_FEAT_SQPOLL_NONFIXED
+    struct io_uring_params params = {
+        .flags = IORING_SETUP_SQPOLL,
+        .sq_thread_idle = FDMON_IO_URING_SQ_THREAD_IDLE,
+    };
+    int ret;
+#endif
+
+    if (!ctx->io_uring_sqpoll) {
+        return io_uring_queue_init(entries, ring, 0);
+    }
+
+#ifdef IORING_FEAT_SQPOLL_NONFIXED
+    /* Share the kernel thread with the fd monitoring ring */
+    if (ring != &ctx->fdmon_io_uring &&
+        ctx->fdmon_ops == &fdmon_io_uring_ops) {
+        params.flags |= IORING_SETUP_ATTACH_WQ;
+        params.wq_fd = ctx->fdmon_io_uring.ring_fd;
+    }
+
+    ret = io_uring_queue_init_params(entries, ring, &params);
+    if (ret != 0) {
+        return ret;
+    }
+
+    /*
+     * Older kernels only allow registered files with SQPOLL, but we poll
+     * arbitrary fds and cannot register all of them.
+     */
+    if (!(params.features & IORING_FEAT_SQPOLL_NONFIXED)) {
+        io_uring_queue_exit(ring);
+        return -ENOTSUP;
+    }
+
+    return 0;
+#else
+    return -ENOTSUP;
+#endif
+}
+
 bool fdmon_io_uring_setup(AioContext *ctx)
 {
     int ret;
 
-    ret = io_uring_queue_init(FDMON_IO_URING_ENTRIES, &ctx->fdmon_io_uring, 0);
+    ret = aio_io_uring_queue_init(ctx, FDMON_IO_URING_ENTRIES,
+                                  &ctx->fdmon_io_uring);
     if (ret != 0) {
         return false;
     }
@@ -359,3 +407,46 @@ void fdmon_io_uring_destroy(AioContext *ctx)
         ctx->fdmon_ops = &fdmon_poll_ops;
     }
 }
+
+void fdmon_io_uring_set_sqpoll(AioContext *ctx, bool sqpoll, Error **errp)
+{
+    AioHandler *node;
+
+    if (ctx->io_uring_sqpoll == sqpoll) {
+        return;
+    }
+
+    if (ctx->linux_io_uring) {
+        error_setg(errp, "io_uring SQPOLL mode cannot be changed after "
+                   "block I/O has started");
+        return;
+    }
+
+    ctx->io_uring_sqpoll = sqpoll;
+
+    /* Block I/O rings pick up the new mode when they are created */
+    if (ctx->fdmon_ops != &fdmon_io_uring_ops) {
+        return;
+    }
+
+    /*
+     * Replace the fd monitoring ring.  Handlers that are already registered
+     * must be added to the new ring, their POLL_ADD went away with the old
+     * one.
+     */
+    fdmon_io_uring_destroy(ctx);
+    if (!fdmon_io_uring_setup(ctx)) {
+        error_setg(errp, "Unable to %s io_uring SQPOLL mode",
+                   sqpoll ? "enable" : "disable");
+        ctx->io_uring_sqpoll = !sqpoll;
+        if (!fdmon_io_uring_setup(ctx)) {
+            return; /* fdmon-poll works too */
+        }
+    }
+
+    QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+        if (!QLIST_IS_INSERTED(node, node_deleted)) {
+            enqueue(&ctx->submit_list, node, FDMON_IO_URING_ADD);
+        }
+    }
+}